@@ -19,32 +19,196 @@
 
 using namespace sequana;
 
+int AirQScd30ConfigActuator::set_value(Scd30Config& value)
+{
+    int result = _sensor.configure_scd30(value);
+    if (result == 0) {
+        _value = value;
+        // Recalibration is a one-time action, not a setting.
+        _value.frc_ppm = 0;
+    }
+    // Let the client see the configuration actually in use.
+    update_notify();
+    return result;
+}
+
+
+int AirQSensor::configure_scd30(const Scd30Config& config)
+{
+    const Scd30Config& current = _scd_config_actuator.get_value();
+    uint32_t items = 0;
+
+    if ((config.interval_s < SCD30_MIN_INTERVAL_S) || (config.interval_s > SCD30_MAX_INTERVAL_S) ||
+        ((config.frc_ppm != 0) && ((config.frc_ppm < SCD30_MIN_FRC_PPM) || (config.frc_ppm > SCD30_MAX_FRC_PPM)))) {
+        return -1;
+    }
+
+    if (config.interval_s != current.interval_s) {
+        items |= Scd30Driver::CONFIG_INTERVAL;
+        _scd_interval_ms = config.interval_s * 1000UL;
+        schedule_scd(_scd_interval_ms + SCD30_READY_MARGIN_MS);
+    }
+    if ((config.asc != 0) != (current.asc != 0)) {
+        items |= Scd30Driver::CONFIG_ASC;
+    }
+    if (config.altitude_m != current.altitude_m) {
+        items |= Scd30Driver::CONFIG_ALTITUDE;
+    }
+    if (config.temp_offset != current.temp_offset) {
+        items |= Scd30Driver::CONFIG_TEMP_OFFSET;
+    }
+    if (config.frc_ppm != 0) {
+        items |= Scd30Driver::CONFIG_FRC;
+    }
+
+    if (items) {
+        _scd_driver.write_config(config, items, callback(this, &AirQSensor::scd_config_written));
+    }
+    return 0;
+}
+
+
+void AirQSensor::scd_config_written(Scd30Driver::Status status)
+{
+    if (status != Scd30Driver::STATUS_OK) {
+        _scd_driver.read_config(callback(this, &AirQSensor::scd_config_read));
+    }
+}
+
+
 /** Callback function periodically updating sensor value.
+ * Result of the previous gas measurement is published
+ * and the next one is started.
  */
 void AirQSensor::updater()
 {
-    bool update = false;
     uint8_t iaq;
 
     if (_zmod_driver.read(_value.tvoc, _value.eco2, iaq) == Zmod44xxDriver::STATUS_OK) {
-        update = true;
+        update_notify();
     };
+    _zmod_driver.start_measurement();
+}
+
+
+void AirQSensor::schedule_scd(uint32_t delay_ms)
+{
+    if (_scd_event_id) {
+        _ev_queue->cancel(_scd_event_id);
+    }
+    _scd_event_id = _ev_queue->call_in(delay_ms, callback(this, &AirQSensor::scd_updater));
+}
 
-    if (_scd_driver.read(_value.co2) == Scd30Driver::STATUS_OK) {
-        update = true;
-    };
 
-    if (update) {
+/** Callback function updating CO2 sensor value.
+ * Reads are kept in phase with the sensor measurement interval,
+ * so that data status is not polled needlessly.
+ */
+void AirQSensor::scd_updater()
+{
+    _scd_event_id = 0;
+    if (_scd_driver.read(callback(this, &AirQSensor::scd_read_done)) != Scd30Driver::STATUS_OK) {
+        // Data not ready yet or sensor busy with configuration.
+        schedule_scd(SCD30_RETRY_MS);
+    }
+}
+
+
+void AirQSensor::scd_read_done(Scd30Driver::Status status)
+{
+    if (status == Scd30Driver::STATUS_OK) {
+        const Scd30Value& scd_value = _scd_driver.get_value();
+        _value.co2 = scd_value.co2;
         update_notify();
+        _climate.update(scd_value.temperature, scd_value.humidity);
+        if (_ref_fresh) {
+            track_self_heating(scd_value.temperature);
+        }
+        schedule_scd(_scd_interval_ms + SCD30_READY_MARGIN_MS);
+    } else if (status == Scd30Driver::STATUS_NOT_READY) {
+        schedule_scd(SCD30_RETRY_MS);
+    } else {
+        schedule_scd(_scd_interval_ms);
     }
 }
 
 
+void AirQSensor::set_ambient(const ComboEnvValue& value)
+{
+    if (_has_gas) {
+        _zmod_driver.set_ambient(value.temperature, value.humidity);
+    }
+    _ref_temperature = value.temperature;
+    _ref_fresh = true;
+}
+
+
+/** CO2 sensor is compensated by its own temperature and humidity sensor,
+ * which reads high because of self-heating. The difference to the reference
+ * sensor is written as the temperature offset, the sensor subtracts it.
+ */
+void AirQSensor::track_self_heating(int16_t temperature)
+{
+    const Scd30Config& config = _scd_config_actuator.get_value();
+    int32_t heating = temperature - _ref_temperature + config.temp_offset;
+    int32_t average;
+
+    _ref_fresh = false;
+    if (_heating_samples == 0) {
+        _heating_acc = heating * (1 << HEATING_AVERAGE_SHIFT);
+    } else {
+        _heating_acc += heating - _heating_acc / (1 << HEATING_AVERAGE_SHIFT);
+    }
+    if (++_heating_samples < HEATING_SETTLE_SAMPLES) {
+        return;
+    }
+
+    average = _heating_acc / (1 << HEATING_AVERAGE_SHIFT);
+    if (average < 0) {
+        average = 0;
+    }
+    if ((average >= config.temp_offset + HEATING_HYSTERESIS) || (average <= config.temp_offset - HEATING_HYSTERESIS)) {
+        Scd30Config new_config = config;
+        new_config.temp_offset = (uint16_t)average;
+        new_config.frc_ppm = 0;
+        _scd_config_actuator.set_value(new_config);
+        _heating_samples = 0;
+    }
+}
+
+
+void AirQSensor::scd_initialized(Scd30Driver::Status status)
+{
+    _scd_driver.read_config(callback(this, &AirQSensor::scd_config_read));
+}
+
+
+void AirQSensor::scd_config_read(Scd30Driver::Status status)
+{
+    Scd30Config config;
+
+    if (status == Scd30Driver::STATUS_OK) {
+        config = _scd_driver.get_config();
+        if ((config.interval_s >= SCD30_MIN_INTERVAL_S) && (config.interval_s <= SCD30_MAX_INTERVAL_S)) {
+            _scd_interval_ms = config.interval_s * 1000UL;
+        }
+    }
+    _scd_config_actuator.init_value(config);
+    schedule_scd(_scd_interval_ms + SCD30_READY_MARGIN_MS);
+}
+
+
 /** Initialize driver and setup periodic sensor updates.
+ * CO2 sensor updates start once its configuration is read.
  */
 void AirQSensor::start(EventQueue& ev_queue)
 {
-    _zmod_driver.init_chip();
-    _scd_driver.init_chip();
-    ev_queue.call_every(2400, callback(this, &AirQSensor::updater));
+    _ev_queue = &ev_queue;
+    if (_has_gas) {
+        _zmod_driver.init_chip();
+        ev_queue.call_every(ZMOD_PERIOD_MS, callback(this, &AirQSensor::updater));
+    }
+    if (_has_co2) {
+        _scd_driver.init_chip(callback(this, &AirQSensor::scd_initialized));
+    }
 }
@@ -18,8 +18,10 @@
 
 #include <mbed.h>
 #include "Sensor.h"
+#include "Actuator.h"
 #include "Zmod44xxDriver.h"
 #include "Scd30Driver.h"
+#include "ComboEnvSensor.h"
 
 
 namespace sequana {
@@ -31,29 +33,189 @@ namespace sequana {
  * and needs converter to be implemented.
  */
 struct AirQValue {
-    uint32_t    tvoc;       //<! total volatile organic compounds
-    uint32_t    eco2;       //<! estimated CO2 level
-    uint32_t    co2;        //<! measured CO2 level
+    uint32_t    tvoc;       //<! total volatile organic compounds, 0.01 mg/m3
+    uint32_t    eco2;       //<! estimated CO2 level, ppm
+    uint32_t    co2;        //<! measured CO2 level, ppm
+};
+
+
+/** Temperature and humidity measured by the CO2 sensor.
+ * When this matches format of the sensor characteristic then
+ * no conversion is needed.
+ */
+struct AirQClimateValue {
+    int16_t     temperature;    //<! temperature, 0.01 deg C
+    uint16_t    humidity;       //<! relative humidity, 0.01 %
+};
+
+
+/** Notified on change of 5 % TVOC (at least 0.05 mg/m3), 2 % eCO2
+ * (at least 20 ppm) or 1 % CO2 (at least 10 ppm).
+ */
+template <> struct NotifyFilter<AirQValue> {
+    static const uint32_t MAX_SILENCE_MS = 60000;
+
+    static bool changed(const AirQValue& value, const AirQValue& notified)
+    {
+        return outside_deadband(value.tvoc, notified.tvoc, 5, 50) ||
+               outside_deadband(value.eco2, notified.eco2, 20, 20) ||
+               outside_deadband(value.co2, notified.co2, 10, 10);
+    }
+};
+
+
+/** Notified on change of 0.1 deg C or 1 %.
+ */
+template <> struct NotifyFilter<AirQClimateValue> {
+    static const uint32_t MAX_SILENCE_MS = 60000;
+
+    static bool changed(const AirQClimateValue& value, const AirQClimateValue& notified)
+    {
+        return outside_deadband(value.temperature, notified.temperature, 10) ||
+               outside_deadband(value.humidity, notified.humidity, 100);
+    }
+};
+
+
+/** CO2 sensor temperature and humidity interface, allows cross-checking
+ * the main environmental sensor. Updated together with the air quality sensor.
+ */
+class AirQClimateSensor : public Sensor<AirQClimateValue> {
+public:
+    virtual void start(EventQueue& ev_queue) {}
+
+    /** Publish new value.
+     */
+    void update(int16_t temperature, uint16_t humidity)
+    {
+        _value.temperature = temperature;
+        _value.humidity = humidity;
+        update_notify();
+    }
+};
+
+
+class AirQSensor;
+
+/** CO2 sensor configuration interface.
+ */
+class AirQScd30ConfigActuator : public Actuator<Scd30Config> {
+public:
+    AirQScd30ConfigActuator(AirQSensor &sensor) : _sensor(sensor) {}
+
+    virtual void    start(EventQueue& ev_queue) {}
+    virtual int     set_value(Scd30Config& value);
+
+    /** Set value read from the sensor.
+     */
+    void init_value(const Scd30Config& value)
+    {
+        _value = value;
+        update_notify();
+    }
+
+protected:
+    AirQSensor &_sensor;
 };
 
 
 /** Sequana air quality sensor interface.
  *
- * For now it's a stub only.
+ * CO2 sensor is polled in step with its measurement interval,
+ * other sensors are polled periodically. Ambient temperature and humidity,
+ * when provided, compensate the gas sensor and calibrate CO2 sensor
+ * self-heating.
  */
 class AirQSensor : public Sensor<AirQValue> {
 public:
-    AirQSensor(I2C &i2c, uint32_t zmod_addr, DigitalOut &zmod_reset, uint32_t scd_addr) :
-        _zmod_driver(i2c, (uint8_t)zmod_addr, zmod_reset),
-        _scd_driver(i2c, (uint8_t)scd_addr)
+    AirQSensor(I2CBus &i2c, uint32_t zmod_addr, DigitalOut &zmod_reset, uint32_t scd_addr, PinName scd_rdy = NC) :
+        _zmod_driver(i2c, (uint8_t)zmod_addr, zmod_reset, ZMOD_PERIOD_MS),
+        _scd_driver(i2c, (uint8_t)scd_addr, scd_rdy),
+        _scd_config_actuator(*this),
+        _ev_queue(NULL),
+        _scd_event_id(0),
+        _scd_interval_ms(2000),
+        _ref_temperature(0),
+        _ref_fresh(false),
+        _heating_acc(0),
+        _heating_samples(0),
+        _has_gas(true),
+        _has_co2(true)
     {}
 
     virtual void start(EventQueue& ev_queue);
 
+    /** Select devices fitted, missing ones are never accessed.
+     * Must be called before start().
+     */
+    void set_devices(bool gas, bool co2)
+    {
+        _has_gas = gas;
+        _has_co2 = co2;
+    }
+
+    /** Get CO2 sensor configuration interface.
+     */
+    Actuator<Scd30Config>& get_scd30_config() { return _scd_config_actuator; }
+
+    /** Change CO2 sensor configuration.
+     *
+     * Only the changed settings are written, as the sensor stores them
+     * in non-volatile memory. Forced recalibration is applied when frc_ppm
+     * is not 0. Settings are written in the background, configuration
+     * is read back from the sensor when the write fails.
+     *
+     * @param config new configuration
+     * @returns 0 when accepted, (-1) when not
+     */
+    int configure_scd30(const Scd30Config& config);
+
+    /** Get CO2 sensor temperature and humidity interface.
+     */
+    Sensor<AirQClimateValue>& get_climate() { return _climate; }
+
+    /** Take ambient temperature and humidity measured by the reference sensor.
+     * Subscriber of ComboEnvSensor climate updates.
+     */
+    void set_ambient(const ComboEnvValue& value);
+
 protected:
+    static const uint32_t ZMOD_PERIOD_MS        = 2400;
+    // Poll shortly after data is expected, retry soon when it's not ready yet.
+    static const uint32_t SCD30_READY_MARGIN_MS = 50;
+    static const uint32_t SCD30_RETRY_MS        = 100;
+    static const uint16_t SCD30_MIN_INTERVAL_S  = 2;
+    static const uint16_t SCD30_MAX_INTERVAL_S  = 1800;
+    static const uint16_t SCD30_MIN_FRC_PPM     = 400;
+    static const uint16_t SCD30_MAX_FRC_PPM     = 2000;
+    // CO2 sensor self-heating is averaged over 256 readings and corrected
+    // once settled, only a change of 1 K is written as it's kept in NVM.
+    static const uint32_t HEATING_AVERAGE_SHIFT = 8;
+    static const uint32_t HEATING_SETTLE_SAMPLES = 1024;
+    static const int32_t  HEATING_HYSTERESIS    = 100;
+
     void updater();
+    void scd_updater();
+    void schedule_scd(uint32_t delay_ms);
+    void scd_initialized(Scd30Driver::Status status);
+    void scd_config_read(Scd30Driver::Status status);
+    void scd_config_written(Scd30Driver::Status status);
+    void scd_read_done(Scd30Driver::Status status);
+    void track_self_heating(int16_t temperature);
+
     Zmod44xxDriver  _zmod_driver;
     Scd30Driver     _scd_driver;
+    AirQClimateSensor _climate;
+    AirQScd30ConfigActuator _scd_config_actuator;
+    EventQueue      *_ev_queue;
+    int             _scd_event_id;
+    uint32_t        _scd_interval_ms;
+    int16_t         _ref_temperature;
+    bool            _ref_fresh;
+    int32_t         _heating_acc;
+    uint32_t        _heating_samples;
+    bool            _has_gas;
+    bool            _has_co2;
 };
 
 
@@ -15,160 +15,464 @@
  */
 
 #include <mbed.h>
+#include <string.h>
 #include "As7261Driver.h"
 
 
 #define NUM_RETRIES     10
 
+// Integration time unit is 2.8 ms. ADC full scale is assumed to be
+// 1024 counts per integration time unit, limited to 16 bits.
+#define COUNTS_PER_INT_TIME     1024
+#define MAX_COUNTS              65535
+
+// Exposure is kept so that the raw clear channel stays within
+// 10..90 % of the full scale, aiming at the half of it.
+#define LOW_HEADROOM_PERCENT    10
+#define HIGH_HEADROOM_PERCENT   90
+
+// Headroom is checked again when calibrated Y changes by this factor,
+// small absolute changes are ignored in the dark.
+#define LIGHT_CHANGE_FACTOR     1.5f
+#define LIGHT_CHANGE_MIN        1.0f
+
+// Steps differ by a factor of about 4, brightest light first.
+static const struct {
+    uint8_t gain;
+    uint8_t int_time;
+} exposures[] = {
+    { As7261Driver::ControlReg::GAINx1,     16 },
+    { As7261Driver::ControlReg::GAINx1,     64 },
+    { As7261Driver::ControlReg::GAINx1,     255 },
+    { As7261Driver::ControlReg::GAINx4,     255 },
+    { As7261Driver::ControlReg::GAINx16,    255 },
+    { As7261Driver::ControlReg::GAINx64,    255 }
+};
+
+#define NUM_EXPOSURES           (sizeof(exposures) / sizeof(exposures[0]))
+
+// Setting used before the auto-gain loop was introduced.
+#define DEFAULT_EXPOSURE        4
+
+
+
+As7261Driver::As7261Driver(I2CBus& bus, uint8_t address, PinName int_pin) :
+    _bus(bus),
+    _xfer(address, I2CBus::FREQUENCY_FAST),
+    _int_pin(NULL),
+    _read_pending(false),
+    _job(JOB_NONE),
+    _phase(PHASE_DRAIN_STATUS),
+    _step(0),
+    _retries(0),
+    _reg(0),
+    _data(0),
+    _run_data(NULL),
+    _run_left(0),
+    _exposure(DEFAULT_EXPOSURE),
+    _exposure_pending(false),
+    _check_exposure(true),
+    _raw_fetched(false),
+    _settle(0),
+    _ref_y(0.0f),
+    _start_count(0),
+    _transactions(0),
+    _status(STATUS_NOT_READY),
+    _last_i(0),
+    _last_t(0)
+{
+    memset(_xyz, 0, sizeof(_xyz));
+    _xfer.done = callback(this, &As7261Driver::on_transfer);
+    if (int_pin != NC) {
+        // Open drain output, active low.
+        _int_pin = new InterruptIn(int_pin);
+        _int_pin->mode(PullUp);
+    }
+}
 
 
-int As7261Driver::read_phy_reg(PhyReg reg, uint8_t &value)
+void As7261Driver::read_phy_reg(PhyReg reg)
+{
+    _tx_buffer[0] = reg;
+    _xfer.tx_data = _tx_buffer;
+    _xfer.tx_length = 1;
+    _xfer.rx_data = _rx_buffer;
+    _xfer.rx_length = 1;
+    _bus.submit(_xfer);
+}
+
+void As7261Driver::write_phy_reg(PhyReg reg, uint8_t value)
 {
-    char reg_addr = reg;
+    _tx_buffer[0] = reg;
+    _tx_buffer[1] = value;
+    _xfer.tx_data = _tx_buffer;
+    _xfer.tx_length = 2;
+    _xfer.rx_length = 0;
+    _bus.submit(_xfer);
+}
 
-    int status = _i2c.write(_address, &reg_addr, 1);
-    if (status == 0) {
-        return _i2c.read(_address, (char*)&value, 1);
+void As7261Driver::poll_status()
+{
+    if (++_retries >= NUM_RETRIES) {
+        register_done(STATUS_NOT_READY);
+    } else {
+        read_phy_reg(STATUS_REG);
     }
-    return status;
 }
 
-int As7261Driver::write_phy_reg(PhyReg reg, uint8_t value)
+void As7261Driver::start_read_registers(VirtualReg reg, uint32_t count, uint8_t *data, bool check_buffers)
 {
-    char reg_addr[2] = {reg, value};
+    _reg = reg;
+    _run_left = count;
+    _run_data = data;
+    if (check_buffers) {
+        _phase = PHASE_DRAIN_STATUS;
+        read_phy_reg(STATUS_REG);
+    } else {
+        _phase = PHASE_ADDRESS;
+        write_phy_reg(WRITE_REG, _reg);
+    }
+}
 
-    int status = _i2c.write(_address, reg_addr, 2);
-    return status;
+void As7261Driver::start_write_register(VirtualReg reg, uint8_t value)
+{
+    _reg = reg | WRITE_OP;
+    _data = value;
+    _phase = PHASE_TX_READY;
+    _retries = 0;
+    read_phy_reg(STATUS_REG);
 }
 
-int As7261Driver::check_buffer_status(uint8_t mask, uint8_t required)
+
+/** Virtual register access protocol, advanced by each bus transaction completion.
+ */
+void As7261Driver::on_transfer(int result)
 {
-    int status = 0;
-    int retry_cnt;
-    uint8_t reg_val;
+    uint8_t value = (uint8_t)_rx_buffer[0];
+
+    if (result != 0) {
+        register_done(STATUS_NOT_READY);
+        return;
+    }
+
+    switch (_phase) {
+    case PHASE_DRAIN_STATUS:
+        if (value & StatusReg::RX_PENDING) {
+            _phase = PHASE_DRAIN;
+            read_phy_reg(READ_REG);
+            break;
+        }
+        // fall through
+    case PHASE_DRAIN:
+        // check that register address can be written
+        _phase = PHASE_TX_READY;
+        _retries = 0;
+        read_phy_reg(STATUS_REG);
+        break;
+
+    case PHASE_TX_READY:
+        if (value & StatusReg::TX_PENDING) {
+            poll_status();
+        } else {
+            _phase = PHASE_ADDRESS;
+            write_phy_reg(WRITE_REG, _reg);
+        }
+        break;
+
+    case PHASE_ADDRESS:
+        // check that data is ready or that buffer can take the data
+        _phase = (_reg & WRITE_OP) ? PHASE_TX_DATA_READY : PHASE_RX_READY;
+        _retries = 0;
+        read_phy_reg(STATUS_REG);
+        break;
+
+    case PHASE_RX_READY:
+        if (value & StatusReg::RX_PENDING) {
+            _phase = PHASE_DATA_READ;
+            read_phy_reg(READ_REG);
+        } else {
+            poll_status();
+        }
+        break;
+
+    case PHASE_DATA_READ:
+        *_run_data++ = value;
+        if (--_run_left) {
+            // data arrived, so the address buffer is free for the next register
+            ++_reg;
+            _phase = PHASE_ADDRESS;
+            write_phy_reg(WRITE_REG, _reg);
+        } else {
+            register_done(STATUS_OK);
+        }
+        break;
+
+    case PHASE_TX_DATA_READY:
+        if (value & StatusReg::TX_PENDING) {
+            poll_status();
+        } else {
+            _phase = PHASE_DATA_WRITE;
+            write_phy_reg(WRITE_REG, _data);
+        }
+        break;
 
-    for (retry_cnt = 0; retry_cnt < NUM_RETRIES; ++retry_cnt) {
-        status = read_phy_reg(STATUS_REG, reg_val);
-        if (status == 0) {
-            if ((reg_val & mask) == required) {
-                break;
+    case PHASE_DATA_WRITE:
+        register_done(STATUS_OK);
+        break;
+    }
+}
+
+
+/** Called when virtual register access completes, starts the next step of the job.
+ */
+void As7261Driver::register_done(Status status)
+{
+    switch (_job) {
+    case JOB_INIT:
+        _bus.get_event_queue().call_in(RESET_TIME_MS, callback(this, &As7261Driver::configure));
+        break;
+
+    case JOB_EXPOSURE:
+        if ((_step++ == 0) && (status == STATUS_OK)) {
+            uint8_t control = ControlReg::MODE_1 | exposures[_exposure].gain;
+            if (_int_pin) {
+                control |= ControlReg::INT_EN;
+            }
+            start_write_register(SETUP_CONTROL, control);
+        } else {
+            finish(status);
+        }
+        break;
+
+    case JOB_READ:
+        if (status != STATUS_OK) {
+            finish(status);
+            return;
+        }
+        if (_step++ == 0) {
+            // check data is ready
+            if ((_data & ControlReg::DATA_RDY) == 0) {
+                finish(STATUS_NOT_READY);
+                return;
+            }
+            // Raw clear channel precedes the XYZ block, it's only fetched when headroom is checked.
+            _raw_fetched = _check_exposure && (_settle == 0);
+            if (_raw_fetched) {
+                start_read_registers(RAW_C, RAW_REG_SIZE + 3 * CAL_XYZ_REG_SIZE, _regs, false);
             } else {
-                status = 3;
+                start_read_registers(CAL_X, 3 * CAL_XYZ_REG_SIZE, &_regs[RAW_REG_SIZE], false);
             }
+        } else if (_step == 2) {
+            start_read_registers(CAL_LUX, 2 * LUXCCT_REG_SIZE, &_regs[RAW_REG_SIZE + 3 * CAL_XYZ_REG_SIZE], false);
+        } else {
+            parse();
+            finish(STATUS_OK);
         }
+        break;
+
+    default:
+        finish(status);
+        break;
     }
-    return status;
 }
 
-As7261Driver::Status As7261Driver::read_register(VirtualReg reg, uint8_t &value)
+
+/** Writes integration time and then gain, both are applied from the next conversion.
+ */
+void As7261Driver::configure()
 {
-    int status;
-    uint8_t temp;
+    _job = JOB_EXPOSURE;
+    _step = 0;
+    _check_exposure = true;
+    // conversion in progress still uses the previous setting
+    _settle = 1;
+    start_write_register(INT_TIME, exposures[_exposure].int_time);
+}
 
-    // preventive read of the buffer
-    status = check_buffer_status(StatusReg::RX_PENDING, 0);
-    if (status) {
-        status = read_phy_reg(READ_REG, temp);
-    }
 
-    // check that register address can be written
-    status = check_buffer_status(StatusReg::TX_PENDING, 0);
-    // setup register to read
-    if (status == 0) {
-        status = write_phy_reg(WRITE_REG, reg);
+/** Selects exposure bringing the raw clear channel to the half of the full scale.
+ * Each step changes sensitivity about four times, so the loop converges
+ * within two or three conversions even from saturation.
+ */
+void As7261Driver::adjust_exposure(uint32_t raw)
+{
+    uint32_t full_scale = COUNTS_PER_INT_TIME * exposures[_exposure].int_time;
+    uint32_t target;
+    int32_t level = (int32_t)_exposure;
+
+    if (full_scale > MAX_COUNTS) {
+        full_scale = MAX_COUNTS;
     }
-    // check that data is ready
-    if (status == 0) {
-        status = check_buffer_status(StatusReg::RX_PENDING, StatusReg::RX_PENDING);
+    target = full_scale / 2;
+
+    if (raw * 100 >= full_scale * HIGH_HEADROOM_PERCENT) {
+        if (raw >= full_scale - full_scale / 64) {
+            // clipped, actual level is unknown
+            level -= 2;
+        } else {
+            for (; raw > 2 * target; raw /= 4) {
+                --level;
+            }
+        }
+    } else if (raw * 100 < full_scale * LOW_HEADROOM_PERCENT) {
+        for (raw = raw ? raw : 1; 2 * raw < target; raw *= 4) {
+            ++level;
+        }
     }
-    // read the data
-    if (status == 0) {
-        status = read_phy_reg(READ_REG, value);
+
+    if (level < 0) {
+        level = 0;
+    } else if (level >= (int32_t)NUM_EXPOSURES) {
+        level = NUM_EXPOSURES - 1;
+    }
+    if ((uint32_t)level != _exposure) {
+        _exposure = (uint32_t)level;
+        _exposure_pending = true;
     }
+}
 
-    return status ? STATUS_NOT_READY : STATUS_OK;
+
+/** Called from interrupt context when conversion completes.
+ */
+void As7261Driver::int_irq()
+{
+    _bus.get_event_queue().call(callback(this, &As7261Driver::data_ready));
 }
 
 
-As7261Driver::Status As7261Driver::write_register(VirtualReg reg, uint8_t value)
+void As7261Driver::data_ready()
 {
-    int status;
+    // When the previous result was not collected yet conversion data is left
+    // in the sensor, start_read() fetches it as the interrupt stays asserted.
+    if (_status == STATUS_OK) {
+        return;
+    }
+    if (_job == JOB_NONE) {
+        start_read_cycle();
+    } else {
+        _read_pending = true;
+    }
+}
 
-    // check that register address can be written
-    status = check_buffer_status(StatusReg::TX_PENDING, 0);
-    // setup register to write
-    if (status == 0) {
-        status = write_phy_reg(WRITE_REG, reg | WRITE_OP);
+
+/** Converts registers fetched by the read cycle, all values are big-endian.
+ */
+void As7261Driver::parse()
+{
+    const uint8_t *reg = _regs;
+
+    if (_raw_fetched) {
+        adjust_exposure((uint32_t)((reg[0] << 8) | reg[1]));
     }
-    // check that buffer is ready
-    if (status == 0) {
-        status = check_buffer_status(StatusReg::TX_PENDING, 0);
+    reg += RAW_REG_SIZE;
+
+    for (uint32_t i = 0; i < 3; ++i) {
+        uint32_t raw = ((uint32_t)reg[0] << 24) | ((uint32_t)reg[1] << 16) | ((uint32_t)reg[2] << 8) | reg[3];
+        memcpy(&_xyz[i], &raw, sizeof(float));
+        reg += CAL_XYZ_REG_SIZE;
     }
-    // write the data
-    if (status == 0) {
-        status = write_phy_reg(WRITE_REG, value);
+    _last_i = (uint16_t)((reg[0] << 8) | reg[1]);
+    _last_t = (uint16_t)((reg[2] << 8) | reg[3]);
+
+    // Headroom is checked when light changes, stable light costs no extra transactions.
+    if (_settle) {
+        --_settle;
+    } else if (_raw_fetched) {
+        _ref_y = _xyz[1];
+        _check_exposure = false;
+    } else if ((_xyz[1] > _ref_y * LIGHT_CHANGE_FACTOR + LIGHT_CHANGE_MIN) ||
+               (_xyz[1] * LIGHT_CHANGE_FACTOR + LIGHT_CHANGE_MIN < _ref_y)) {
+        _check_exposure = true;
     }
+}
 
-    return status ? STATUS_NOT_READY : STATUS_OK;
+
+void As7261Driver::finish(Status status)
+{
+    if (_job == JOB_READ) {
+        if (status == STATUS_OK) {
+            _transactions = _xfer.count - _start_count;
+            _status = status;
+        } else if (_status != STATUS_OK) {
+            // result not collected yet is kept
+            _status = status;
+        }
+    }
+    _job = JOB_NONE;
+
+    if (_exposure_pending) {
+        _exposure_pending = false;
+        configure();
+    } else if (_read_pending) {
+        _read_pending = false;
+        start_read_cycle();
+    }
 }
 
 
 void As7261Driver::init_chip(void)
 {
-    write_register(SETUP_CONTROL, ControlReg::RESET);
-    for(uint32_t i = 0; i < 100000; i++);
-
-    write_register(SETUP_CONTROL, ControlReg::MODE_1| ControlReg::GAINx16);
-    for(uint32_t i = 0; i < 10000; i++);
+    if (_job != JOB_NONE) {
+        return;
+    }
+    _job = JOB_INIT;
+    _step = 0;
+    start_write_register(SETUP_CONTROL, ControlReg::RESET);
+    if (_int_pin) {
+        _int_pin->fall(callback(this, &As7261Driver::int_irq));
+    }
 }
 
 
-As7261Driver::Status As7261Driver::read(uint32_t &lux, uint32_t &cct)
+void As7261Driver::start_read_cycle()
 {
-    Status      status;
-    uint8_t     byte;
-    uint32_t    val;
-    unsigned    i;
+    _job = JOB_READ;
+    _step = 0;
+    _start_count = _xfer.count;
+    start_read_registers(SETUP_CONTROL, 1, &_data, true);
+}
 
-    // check data is ready
-    status = read_register(SETUP_CONTROL, byte);
-    if (status != STATUS_OK) {
-        return status;
-    }
-    if ((byte & ControlReg::DATA_RDY) == 0) {
+
+As7261Driver::Status As7261Driver::start_read()
+{
+    if (_job != JOB_NONE) {
         return STATUS_NOT_READY;
     }
+    // Interrupt not asserted, nothing to fetch.
+    if (_int_pin && _int_pin->read()) {
+        return STATUS_OK;
+    }
+    start_read_cycle();
+    return STATUS_OK;
+}
 
-    // read LUX
-    val = 0;
-    for (i = 0; i < LUXCCT_REG_SIZE; ++i) {
-        status = read_register((VirtualReg)(CAL_LUX + i), byte);
-        if (status != STATUS_OK) {
-            return status;
-        }
-        val = (val << 8) | byte;
+
+As7261Driver::Status As7261Driver::read(uint32_t &lux, uint32_t &cct)
+{
+    Status status = _status;
+
+    if (_xfer.degraded()) {
+        // Device stopped responding, cycles are still started so it can come back.
+        return STATUS_STALLED;
     }
-    lux = val;
 
-    // read CCT
-    val = 0;
-    for (i = 0; i < LUXCCT_REG_SIZE; ++i) {
-        status = read_register((VirtualReg)(CAL_CCT + i), byte);
-        if (status != STATUS_OK) {
-            return status;
-        }
-        val = (val << 8) | byte;
+    if (status == STATUS_OK) {
+        lux = _last_i;
+        cct = _last_t;
     }
-    cct = val;
+    _status = STATUS_NOT_READY;
 
 //    printf("as7261: lux=0x%04lx, cct=0x%04lx\n", lux, cct);
-    return STATUS_OK;
+    return status;
 }
 
 
 As7261Driver::Status As7261Driver::led_on(bool status)
 {
-    return write_register(LED_CONTROL, status ? LedControlReg::LED_DRV_12mA : LedControlReg::LED_OFF);
+    if (_job != JOB_NONE) {
+        return STATUS_NOT_READY;
+    }
+    _job = JOB_LED;
+    start_write_register(LED_CONTROL, status ? LedControlReg::LED_DRV_12mA : LedControlReg::LED_OFF);
+    return STATUS_OK;
 }
-
-
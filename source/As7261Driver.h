@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 #include <Sensor.h>
+#include "I2CBus.h"
 
 
 /** Driver for AS7261 light sensor.
@@ -39,13 +40,20 @@ public:
 
     enum VirtualReg {
         SETUP_CONTROL   = 0x04,
+        INT_TIME        = 0x05,
         LED_CONTROL     = 0x07,
+        RAW_C           = 0x12,
+        CAL_X           = 0x14,
+        CAL_Y           = 0x18,
+        CAL_Z           = 0x1C,
         CAL_LUX         = 0x3C,
         CAL_CCT         = 0x3E,
         WRITE_OP        = 0x80
     };
 
     static const uint32_t   LUXCCT_REG_SIZE = 2;
+    static const uint32_t   CAL_XYZ_REG_SIZE = 4;
+    static const uint32_t   RAW_REG_SIZE = 2;
 
     struct StatusReg {
         static const uint8_t RX_PENDING = 0x01;
@@ -83,14 +91,48 @@ public:
      *
      * @param bus I2C bus to use for communication
      * @param address I2C address to use
+     * @param int_pin interrupt pin, NC when not wired
      */
-    As7261Driver(I2C& bus, uint8_t address) : _i2c(bus), _address(address), _last_i(0), _last_t(0) {};
+    As7261Driver(I2CBus& bus, uint8_t address, PinName int_pin = NC);
 
-    /** Read measured values from sensor.
+    /** Read values fetched by the last read cycle.
+     *
+     * Each result is returned only once, STATUS_NOT_READY is returned
+     * until the next read cycle completes, STATUS_STALLED while the
+     * sensor does not respond on the bus.
      */
     Status read(uint32_t& lux, uint32_t& cct);
 
+    /** Get calibrated CIE 1931 tristimulus values fetched by the last read cycle.
+     */
+    void get_xyz(float& x, float& y, float& z) const
+    {
+        x = _xyz[0];
+        y = _xyz[1];
+        z = _xyz[2];
+    }
+
+    /** Get number of bus transactions used by the last successful read cycle.
+     */
+    uint32_t get_transactions() const { return _transactions; }
+
+    /** Get current exposure level, 0 for the brightest light.
+     */
+    uint32_t get_exposure() const { return _exposure; }
+
+    /** Start read cycle, values are fetched when conversion data is ready.
+     *
+     * When the interrupt pin is wired read cycles are started by the
+     * interrupt, this only catches up when the pin shows pending data
+     * and does not access the bus otherwise.
+     *
+     * @returns STATUS_OK when started or not needed, STATUS_NOT_READY when driver is busy
+     */
+    Status start_read();
+
     /** Set lighting led status.
+     *
+     * @returns STATUS_OK when started, STATUS_NOT_READY when driver is busy
      */
     Status led_on(bool state);
 
@@ -99,17 +141,78 @@ public:
     void init_chip();
 
 protected:
-    int read_phy_reg(PhyReg reg, uint8_t &value);
-    int write_phy_reg(PhyReg reg, uint8_t value);
-    int check_buffer_status(uint8_t mask, uint8_t required);
-    Status read_register(VirtualReg reg, uint8_t &value);
-    Status write_register(VirtualReg reg, uint8_t value);
+    // Sensor firmware restarts after reset.
+    static const uint32_t RESET_TIME_MS = 1000;
+
+    enum Job {
+        JOB_NONE,
+        JOB_INIT,
+        JOB_READ,
+        JOB_EXPOSURE,
+        JOB_LED
+    };
+
+    /** Steps of the virtual register access protocol.
+     *
+     * Registers of a read run are fetched back to back: data arriving
+     * in the read buffer shows that the address was taken, so the
+     * preventive read and the address buffer check are done once per run.
+     */
+    enum Phase {
+        PHASE_DRAIN_STATUS,     // preventive check of the read buffer
+        PHASE_DRAIN,            // stale data read
+        PHASE_TX_READY,         // waiting for address to be accepted
+        PHASE_ADDRESS,          // register address write
+        PHASE_RX_READY,         // waiting for register data
+        PHASE_DATA_READ,        // register data read
+        PHASE_TX_DATA_READY,    // waiting for data to be accepted
+        PHASE_DATA_WRITE        // register data write
+    };
+
+    void read_phy_reg(PhyReg reg);
+    void write_phy_reg(PhyReg reg, uint8_t value);
+    void poll_status();
+    void start_read_registers(VirtualReg reg, uint32_t count, uint8_t *data, bool check_buffers);
+    void start_write_register(VirtualReg reg, uint8_t value);
+    void on_transfer(int result);
+    void register_done(Status status);
+    void configure();
+    void adjust_exposure(uint32_t raw);
+    void int_irq();
+    void data_ready();
+    void start_read_cycle();
+    void parse();
+    void finish(Status status);
 
 protected:
-    I2C&        _i2c;
-    uint8_t     _address;
-    uint16_t    _last_i;
-    uint16_t    _last_t;
+    I2CBus&         _bus;
+    I2CTransaction  _xfer;
+    InterruptIn     *_int_pin;
+    bool            _read_pending;
+    char            _tx_buffer[2];
+    char            _rx_buffer[1];
+    Job             _job;
+    Phase           _phase;
+    uint32_t        _step;
+    uint32_t        _retries;
+    uint8_t         _reg;
+    uint8_t         _data;
+    uint8_t         *_run_data;
+    uint32_t        _run_left;
+    // Raw clear channel, calibrated XYZ block, LUX and CCT.
+    uint8_t         _regs[RAW_REG_SIZE + 3 * CAL_XYZ_REG_SIZE + 2 * LUXCCT_REG_SIZE];
+    uint32_t        _exposure;
+    bool            _exposure_pending;
+    bool            _check_exposure;
+    bool            _raw_fetched;
+    uint32_t        _settle;
+    float           _ref_y;
+    uint32_t        _start_count;
+    uint32_t        _transactions;
+    Status          _status;
+    uint16_t        _last_i;
+    uint16_t        _last_t;
+    float           _xyz[3];
 };
 
 
@@ -22,20 +22,61 @@
 
 using namespace sequana;
 
+static uint32_t to_fixed(float value, float scale, uint32_t max)
+{
+    float scaled = value * scale + 0.5f;
+
+    if (!(scaled > 0.0f)) {
+        return 0;
+    }
+    return (scaled >= (float)max) ? max : (uint32_t)scaled;
+}
+
+
+/** Chromaticity is calculated here rather than read from the sensor,
+ * it saves bus transactions.
+ */
+void ComboEnvColorSensor::update(float x, float y, float z)
+{
+    float sum = x + y + z;
+
+    _value.tristimulus[0] = to_fixed(x, 100.0f, UINT32_MAX);
+    _value.tristimulus[1] = to_fixed(y, 100.0f, UINT32_MAX);
+    _value.tristimulus[2] = to_fixed(z, 100.0f, UINT32_MAX);
+    if (sum > 0.0f) {
+        _value.chromaticity[0] = (uint16_t)to_fixed(x / sum, 10000.0f, 10000);
+        _value.chromaticity[1] = (uint16_t)to_fixed(y / sum, 10000.0f, 10000);
+    } else {
+        _value.chromaticity[0] = 0;
+        _value.chromaticity[1] = 0;
+    }
+    update_notify();
+}
+
+
 /** Callback function periodically updating sensor value.
+ * Values fetched since the last call are published and the next
+ * read cycles are started, bus transfers complete in the background.
+ * Subscribers receive the sensor value itself, only fields they
+ * subscribed to are fresh.
  */
 void ComboEnvSensor::updater()
 {
     bool update = false;
     uint32_t temp;
 
-    if (_as_driver.read(_value.ambient_light, temp) == As7261Driver::STATUS_OK) {
+    if (_has_light && (_as_driver.read(_value.ambient_light, temp) == As7261Driver::STATUS_OK)) {
+        float x, y, z;
         update = true;
         _value.color_temp = temp;
+        _as_driver.get_xyz(x, y, z);
+        _color.update(x, y, z);
+        _light_publisher.publish(_value);
     };
 
-    if (_hs_driver.read(_value.humidity, _value.temperature) == Hs3001Driver::STATUS_OK) {
+    if (_has_humidity && (_hs_driver.read(_value.humidity, _value.temperature) == Hs3001Driver::STATUS_OK)) {
         update = true;
+        _climate_publisher.publish(_value);
     };
 
     if (_pdm_driver.read(_value.noise) == NoiseLevelDriver::STATUS_OK) {
@@ -45,7 +86,12 @@ void ComboEnvSensor::updater()
     if (update) {
         update_notify();
     }
-    _hs_driver.start_conversion();
+    if (_has_light) {
+        _as_driver.start_read();
+    }
+    if (_has_humidity) {
+        _hs_driver.start_conversion();
+    }
 }
 
 
@@ -53,8 +99,13 @@ void ComboEnvSensor::updater()
  */
 void ComboEnvSensor::start(EventQueue& ev_queue)
 {
-    _as_driver.init_chip();
-    _hs_driver.start_conversion();
+    if (_has_light) {
+        _as_driver.init_chip();
+    }
+    if (_has_humidity) {
+        // Resolution was programmed at boot, see main().
+        _hs_driver.start_conversion();
+    }
     _pdm_driver.start_measurement();
     ev_queue.call_every(1000, callback(this, &ComboEnvSensor::updater));
 }
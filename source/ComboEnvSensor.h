@@ -18,6 +18,7 @@
 
 #include <mbed.h>
 #include "Sensor.h"
+#include "Publisher.h"
 #include "As7261Driver.h"
 #include "Hs3001Driver.h"
 #include "NoiseLevelDriver.h"
@@ -31,31 +32,142 @@ namespace sequana {
  * and needs converter to be implemented.
  */
 struct ComboEnvValue {
-    int16_t     temperature;    //<! temperature
-    uint16_t    humidity;       //<! relative humidity
-    uint32_t    ambient_light;  //<! ambient light level
+    int16_t     temperature;    //<! temperature, 0.01 deg C
+    uint16_t    humidity;       //<! relative humidity, %
+    uint32_t    ambient_light;  //<! ambient light level, lux
     uint16_t    color_temp;     //<! light temperature
     uint16_t    noise;          //<! noise level
 };
 
 
+/** Light color measured by the ambient light sensor.
+ * When this matches format of the sensor characteristic then
+ * no conversion is needed.
+ */
+struct LightColorValue {
+    uint32_t    tristimulus[3];     //<! calibrated CIE 1931 X, Y, Z, 0.01 units
+    uint16_t    chromaticity[2];    //<! CIE 1931 x, y chromaticity, 0.0001 units
+};
+
+
+/** Notified on change of 0.1 deg C, 2 %RH, 5 % of light and noise level
+ * or 50 K color temperature.
+ */
+template <> struct NotifyFilter<ComboEnvValue> {
+    static const uint32_t MAX_SILENCE_MS = 60000;
+
+    static bool changed(const ComboEnvValue& value, const ComboEnvValue& notified)
+    {
+        return outside_deadband(value.temperature, notified.temperature, 10) ||
+               outside_deadband(value.humidity, notified.humidity, 2) ||
+               outside_deadband(value.ambient_light, notified.ambient_light, 1, 50) ||
+               outside_deadband(value.color_temp, notified.color_temp, 50) ||
+               outside_deadband(value.noise, notified.noise, 1, 50);
+    }
+};
+
+
+/** Notified on change of 5 % of tristimulus values or 0.002 of chromaticity.
+ */
+template <> struct NotifyFilter<LightColorValue> {
+    static const uint32_t MAX_SILENCE_MS = 60000;
+
+    static bool changed(const LightColorValue& value, const LightColorValue& notified)
+    {
+        return outside_deadband(value.tristimulus[0], notified.tristimulus[0], 100, 50) ||
+               outside_deadband(value.tristimulus[1], notified.tristimulus[1], 100, 50) ||
+               outside_deadband(value.tristimulus[2], notified.tristimulus[2], 100, 50) ||
+               outside_deadband(value.chromaticity[0], notified.chromaticity[0], 20) ||
+               outside_deadband(value.chromaticity[1], notified.chromaticity[1], 20);
+    }
+};
+
+
+/** Light color interface, updated together with the combo sensor.
+ */
+class ComboEnvColorSensor : public Sensor<LightColorValue> {
+public:
+    virtual void start(EventQueue& ev_queue) {}
+
+    /** Publish new value calculated from tristimulus values.
+     */
+    void update(float x, float y, float z);
+};
+
+
 /** Sequana combo environmental sensor interface.
-*/
+ *
+ * Besides the characteristic, fresh readings are passed to other parts
+ * of the system which compensate for ambient conditions.
+ */
 class ComboEnvSensor : public Sensor<ComboEnvValue> {
 public:
-    ComboEnvSensor(I2C &i2c, uint32_t as_addr, uint32_t hs_addr, PinName pdm_data, PinName pdm_clk) :
-        _as_driver(i2c, as_addr),
-        _hs_driver(i2c, hs_addr),
-        _pdm_driver(pdm_data, pdm_clk)
+    static const uint32_t MAX_AMBIENT_SUBSCRIBERS = 2;
+    typedef Publisher<ComboEnvValue, MAX_AMBIENT_SUBSCRIBERS> AmbientPublisher;
+
+    ComboEnvSensor(I2CBus &i2c, uint32_t as_addr, uint32_t hs_addr, PinName pdm_data, PinName pdm_clk, PinName as_int = NC,
+                   Hs3001Driver::Resolution hs_resolution = Hs3001Driver::RESOLUTION_14_BIT) :
+        _as_driver(i2c, as_addr, as_int),
+        _hs_driver(i2c, hs_addr, hs_resolution),
+        _pdm_driver(pdm_data, pdm_clk),
+        _has_light(true),
+        _has_humidity(true)
     {}
 
     virtual void start(EventQueue& ev_queue);
 
+    /** Program humidity sensor resolution, see Hs3001Driver::program_resolution().
+     * Must be the first access to the shield after reset.
+     *
+     * @param done called when finished
+     */
+    void program_humidity_resolution(Callback<void()> done)
+    {
+        _hs_driver.program_resolution(done);
+    }
+
+    /** Select devices fitted, missing ones are never accessed.
+     * Must be called before start().
+     */
+    void set_devices(bool light, bool humidity)
+    {
+        _has_light = light;
+        _has_humidity = humidity;
+    }
+
+    /** Get light color interface.
+     */
+    Sensor<LightColorValue>& get_color() { return _color; }
+
+    /** Subscribe to temperature and humidity, called each time they are
+     * read from the sensor.
+     *
+     * @returns 0 when subscribed, (-1) when there are too many subscribers
+     */
+    int subscribe_climate(AmbientPublisher::Subscriber subscriber)
+    {
+        return _climate_publisher.subscribe(subscriber);
+    }
+
+    /** Subscribe to ambient light level, called each time it's read from the sensor.
+     *
+     * @returns 0 when subscribed, (-1) when there are too many subscribers
+     */
+    int subscribe_light(AmbientPublisher::Subscriber subscriber)
+    {
+        return _light_publisher.subscribe(subscriber);
+    }
+
 protected:
     void updater();
     As7261Driver _as_driver;
     Hs3001Driver _hs_driver;
     NoiseLevelDriver _pdm_driver;
+    ComboEnvColorSensor _color;
+    AmbientPublisher _climate_publisher;
+    AmbientPublisher _light_publisher;
+    bool _has_light;
+    bool _has_humidity;
 };
 
 
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CRC8_H_
+#define CRC8_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+namespace crc8_detail {
+
+// One MSB-first shift of the CRC register.
+constexpr uint8_t step(uint8_t crc, uint8_t poly)
+{
+    return (crc & 0x80) ? (uint8_t)((crc << 1) ^ poly) : (uint8_t)(crc << 1);
+}
+
+// CRC of a single byte with zero initial value, i.e. a table entry.
+constexpr uint8_t entry(uint8_t value, uint8_t poly, int bits = 8)
+{
+    return (bits == 0) ? value : entry(step(value, poly), poly, bits - 1);
+}
+
+template <size_t... I> struct IndexList {};
+template <size_t N, size_t... I> struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...> {};
+template <size_t... I> struct MakeIndexList<0, I...> { typedef IndexList<I...> type; };
+
+struct Table {
+    uint8_t     value[256];
+};
+
+template <uint8_t POLY, size_t... I>
+constexpr Table make_table(IndexList<I...>)
+{
+    return Table{{ entry((uint8_t)I, POLY)... }};
+}
+
+} // namespace crc8_detail
+
+
+/** Byte-wide table-driven CRC-8, MSB first, no reflection.
+ *
+ * The 256-entry table is generated at compile time, so each byte
+ * costs a single lookup.
+ *
+ * @param POLY generator polynomial
+ * @param INIT initial value
+ * @param XOR_OUT final XOR value
+ */
+template <uint8_t POLY, uint8_t INIT, uint8_t XOR_OUT = 0x00>
+class Crc8 {
+public:
+    static constexpr crc8_detail::Table TABLE =
+        crc8_detail::make_table<POLY>(typename crc8_detail::MakeIndexList<256>::type());
+
+    /** Get initial CRC value.
+     */
+    static uint8_t init() { return INIT; }
+
+    /** Update CRC value with data.
+     */
+    static uint8_t update(uint8_t crc, const void *data, size_t length)
+    {
+        const uint8_t *d = (const uint8_t *)data;
+
+        while (length--) {
+            crc = TABLE.value[crc ^ *d++];
+        }
+        return crc;
+    }
+
+    /** Get final CRC value.
+     */
+    static uint8_t finalize(uint8_t crc) { return crc ^ XOR_OUT; }
+
+    /** Calculate CRC of a data block.
+     */
+    static uint8_t calculate(const void *data, size_t length)
+    {
+        return finalize(update(init(), data, length));
+    }
+};
+
+template <uint8_t POLY, uint8_t INIT, uint8_t XOR_OUT>
+constexpr crc8_detail::Table Crc8<POLY, INIT, XOR_OUT>::TABLE;
+
+
+/** CRC-8 used by Sensirion sensors (SCD30, SPS30 over I2C, SHT and SGP families).
+ */
+typedef Crc8<0x31, 0xFF> SensirionCrc8;
+
+
+#endif // CRC8_H_
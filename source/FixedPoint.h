@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FIXED_POINT_H_
+#define FIXED_POINT_H_
+
+#include <stdint.h>
+
+/** Integer math helpers shared by sensor data processing.
+ */
+namespace fixed_point {
+
+/** Integer square root.
+ */
+static inline uint32_t isqrt(uint64_t value)
+{
+    uint64_t result = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)result;
+}
+
+/** Integer atan2(y, x) approximation.
+ *
+ * @returns angle in 0.01 deg, in range -18000..18000
+ */
+static inline int16_t atan2_cdeg(int32_t y, int32_t x)
+{
+    uint32_t ax = (x < 0) ? -x : x;
+    uint32_t ay = (y < 0) ? -y : y;
+    bool swapped = ay > ax;
+    uint32_t num = swapped ? ax : ay;
+    uint32_t den = swapped ? ay : ax;
+
+    if (den == 0) {
+        return 0;
+    }
+
+    // r = num / den in Q15, range 0..1
+    uint32_t r = (uint32_t)(((uint64_t)num << 15) / den);
+
+    // atan(r) ~= pi/4 * r + 0.273 * r * (1 - r) [rad], max error ~0.22 deg
+    int32_t angle = (int32_t)((4500 * r + ((1564 * r) >> 15) * (32768 - r)) >> 15);
+
+    if (swapped) {
+        angle = 9000 - angle;
+    }
+    if (x < 0) {
+        angle = 18000 - angle;
+    }
+    if (y < 0) {
+        angle = -angle;
+    }
+    return (int16_t)angle;
+}
+
+/** Multiply two Q15 numbers.
+ */
+static inline int32_t mul_q15(int32_t a, int32_t b)
+{
+    return (a * b) >> 15;
+}
+
+} // namespace fixed_point
+
+#endif // FIXED_POINT_H_
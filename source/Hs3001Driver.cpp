@@ -18,30 +18,205 @@
 #include "Hs3001Driver.h"
 
 
-Hs3001Driver::Status Hs3001Driver::read(uint16_t& humidity, int16_t& temperature)
+const uint8_t Hs3001Driver::RESOLUTION_REGS[NUM_RESOLUTION_REGS] = {
+    HUMIDITY_RES_READ,
+    TEMP_RES_READ
+};
+
+// Typical conversion time per channel is 0.55, 1.31, 4.5 and 16.9 ms, with margin.
+const uint8_t Hs3001Driver::CONVERSION_TIME_MS[4] = { 2, 4, 11, 40 };
+
+
+Hs3001Driver::Hs3001Driver(I2CBus& bus, uint8_t address, Resolution resolution) :
+    _bus(bus),
+    _xfer(address, I2CBus::FREQUENCY_FAST),
+    _state(STATE_IDLE),
+    _status(STATUS_NOT_READY),
+    _conversion_time_ms(CONVERSION_TIME_MS[3]),
+    _reg_index(0),
+    _humidity(0),
+    _temperature(0)
 {
-    static uint8_t buffer[4];
-    uint32_t val;
+    if ((resolution < RESOLUTION_8_BIT) || (resolution > RESOLUTION_14_BIT) || (resolution & 1)) {
+        resolution = RESOLUTION_14_BIT;
+    }
+    _resolution_code = (uint8_t)((resolution - RESOLUTION_8_BIT) / 2);
+    _xfer.done = callback(this, &Hs3001Driver::on_transfer);
+}
 
-    _i2c.read(_address, reinterpret_cast<char*>(buffer), 1);
 
-    if ((buffer[0] & 0xC0) == 0x40) {
-        return STATUS_STALLED;
+void Hs3001Driver::program_resolution(Callback<void()> done)
+{
+    if (_state != STATE_IDLE) {
+        return;
     }
 
-    _i2c.read(_address, reinterpret_cast<char*>(buffer), 4);
-	val = (((uint32_t)buffer[0] & 0x3f) << 8) | (uint32_t)buffer[1];
-    humidity = (uint16_t)((val * 100 + 0x2000) / 0x3fff);
+    _program_done = done;
+    _reg_index = 0;
+    send_command(PROGRAM_ENTER, 0, STATE_PROGRAM_ENTER);
+}
+
+
+Hs3001Driver::Status Hs3001Driver::read(uint16_t& humidity, int16_t& temperature)
+{
+    Status status = _status;
 
-    val = (((uint32_t)buffer[2]) << 6) | (((uint32_t)buffer[3]) >> 2);
-    temperature = (int16_t)(val * 16500 / 0x3fff) - 4000;
+    if (_xfer.degraded()) {
+        // Device stopped responding, cycles are still started so it can come back.
+        return STATUS_STALLED;
+    }
 
-//    printf("hs3001: raw=%08lx, h=0x%04x, t=0x%04x\n", *reinterpret_cast<uint32_t*>(buffer), humidity, temperature);
-    return STATUS_OK;
+    if (status == STATUS_OK) {
+        humidity = _humidity;
+        temperature = _temperature;
+    }
+    _status = STATUS_NOT_READY;
+    return status;
 }
 
+
 void Hs3001Driver::start_conversion(void)
 {
-    static char buffer = 0;
-     _i2c.write(_address, &buffer, 1);
+    if (_state != STATE_IDLE) {
+        return;
+    }
+
+    _buffer[0] = 0;
+    _xfer.tx_data = _buffer;
+    _xfer.tx_length = 1;
+    _xfer.rx_length = 0;
+    _state = STATE_TRIGGER;
+    _bus.submit(_xfer);
+}
+
+
+void Hs3001Driver::fetch()
+{
+    _xfer.tx_length = 0;
+    _xfer.rx_data = _buffer;
+    _xfer.rx_length = 4;
+    _state = STATE_FETCH;
+    _bus.submit(_xfer);
+}
+
+
+void Hs3001Driver::send_command(uint8_t cmd, uint16_t data, State state)
+{
+    _buffer[0] = cmd;
+    _buffer[1] = (char)(data >> 8);
+    _buffer[2] = (char)data;
+    _xfer.tx_data = _buffer;
+    _xfer.tx_length = 3;
+    _xfer.rx_length = 0;
+    _state = state;
+    _bus.submit(_xfer);
+}
+
+
+/** Check next resolution register or leave programming mode when all are done.
+ */
+void Hs3001Driver::program_next()
+{
+    if (_reg_index < NUM_RESOLUTION_REGS) {
+        send_command(RESOLUTION_REGS[_reg_index], 0, STATE_REG_REQUEST);
+    } else {
+        send_command(PROGRAM_EXIT, 0, STATE_PROGRAM_EXIT);
+    }
+}
+
+
+void Hs3001Driver::read_register()
+{
+    _xfer.tx_length = 0;
+    _xfer.rx_data = _buffer;
+    _xfer.rx_length = 3;
+    _state = STATE_REG_READ;
+    _bus.submit(_xfer);
+}
+
+
+void Hs3001Driver::program_done()
+{
+    _state = STATE_IDLE;
+    if (_reg_index == NUM_RESOLUTION_REGS) {
+        _conversion_time_ms = CONVERSION_TIME_MS[_resolution_code];
+    }
+    if (_program_done) {
+        _program_done();
+    }
+}
+
+
+void Hs3001Driver::on_transfer(int result)
+{
+    uint32_t val;
+
+    if (result != 0) {
+        if ((_state >= STATE_PROGRAM_ENTER) && (_state < STATE_PROGRAM_EXIT)) {
+            // Leave programming mode, conversions keep the default timing.
+            send_command(PROGRAM_EXIT, 0, STATE_PROGRAM_EXIT);
+        } else if (_state == STATE_PROGRAM_EXIT) {
+            program_done();
+        } else {
+            _state = STATE_IDLE;
+            _status = STATUS_NOT_READY;
+        }
+        return;
+    }
+
+    switch (_state) {
+        case STATE_PROGRAM_ENTER:
+            program_next();
+            return;
+
+        case STATE_REG_REQUEST:
+            _bus.get_event_queue().call_in(REG_READ_DELAY_MS, callback(this, &Hs3001Driver::read_register));
+            return;
+
+        case STATE_REG_READ:
+            if ((uint8_t)_buffer[0] != PROGRAM_READ_OK) {
+                // Programming mode window missed, sensor returned measurement data.
+                send_command(PROGRAM_EXIT, 0, STATE_PROGRAM_EXIT);
+                return;
+            }
+            val = ((uint32_t)(uint8_t)_buffer[1] << 8) | (uint8_t)_buffer[2];
+            if (((val & RESOLUTION_MASK) >> RESOLUTION_SHIFT) == _resolution_code) {
+                ++_reg_index;
+                program_next();
+            } else {
+                val = (val & ~RESOLUTION_MASK) | ((uint32_t)_resolution_code << RESOLUTION_SHIFT);
+                send_command(RESOLUTION_REGS[_reg_index] + REG_WRITE, (uint16_t)val, STATE_REG_WRITE);
+            }
+            return;
+
+        case STATE_REG_WRITE:
+            ++_reg_index;
+            _bus.get_event_queue().call_in(REG_WRITE_TIME_MS, callback(this, &Hs3001Driver::program_next));
+            return;
+
+        case STATE_PROGRAM_EXIT:
+            program_done();
+            return;
+
+        case STATE_TRIGGER:
+            _state = STATE_CONVERSION;
+            _bus.get_event_queue().call_in(_conversion_time_ms, callback(this, &Hs3001Driver::fetch));
+            return;
+
+        default:
+            break;
+    }
+
+    _state = STATE_IDLE;
+    if ((_buffer[0] & 0xC0) == 0x40) {
+        _status = STATUS_STALLED;
+        return;
+    }
+
+    val = (((uint32_t)_buffer[0] & 0x3f) << 8) | (uint8_t)_buffer[1];
+    _humidity = (uint16_t)((val * 100 + 0x2000) / 0x3fff);
+
+    val = (((uint32_t)(uint8_t)_buffer[2]) << 6) | (((uint32_t)(uint8_t)_buffer[3]) >> 2);
+    _temperature = (int16_t)(val * 16500 / 0x3fff) - 4000;
+    _status = STATUS_OK;
 }
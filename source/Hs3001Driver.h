@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 #include <Sensor.h>
+#include "I2CBus.h"
 
 
 /** Driver for HS3001 temperature/humidity sensor.
@@ -31,25 +32,106 @@ public:
         STATUS_NOT_READY
     };
 
+    /** Humidity and temperature measurement resolution.
+     * Lower resolution shortens conversion time and reduces energy per measurement.
+     */
+    enum Resolution {
+        RESOLUTION_8_BIT = 8,
+        RESOLUTION_10_BIT = 10,
+        RESOLUTION_12_BIT = 12,
+        RESOLUTION_14_BIT = 14
+    };
+
 public:
     /** Create and initialize driver.
      *
      * @param bus I2C bus to use for communication
      * @param address I2C address to use
+     * @param resolution resolution of both humidity and temperature measurements
+     */
+    Hs3001Driver(I2CBus& bus, uint8_t address, Resolution resolution = RESOLUTION_14_BIT);
+
+    /** Program measurement resolution.
+     *
+     * Resolution is kept in the sensor non-volatile memory and can only be
+     * changed in programming mode, which is accepted within 10 ms of the sensor
+     * power-up and only before any measurement request. This must be the first
+     * access to the sensor, started as early after reset as possible. Sensor
+     * power is not switched by the board, so whether the window is met still
+     * depends on the boot time. When it is missed the sensor keeps its stored
+     * resolution and conversions are timed for the default (14-bit) one.
+     *
+     * @param done called when finished, whether programming succeeded or not
      */
-    Hs3001Driver(I2C& bus, uint8_t address) : _i2c(bus), _address(address){};
+    void program_resolution(Callback<void()> done);
 
-    /** Read measured values from sensor.
+    /** Read values measured by the last conversion.
+     *
+     * Each result is returned only once, STATUS_NOT_READY is returned
+     * until the next conversion result is fetched from the sensor,
+     * STATUS_STALLED while the sensor does not respond on the bus.
      */
     Status read(uint16_t& hudmity, int16_t& temperature);
 
     /** Start next measurement/ conversion cycle.
+     * Result is fetched automatically when the conversion completes.
      */
     void start_conversion(void);
 
 protected:
-    I2C&        _i2c;
-    uint8_t     _address;
+    // Programming mode commands.
+    enum Command {
+        PROGRAM_ENTER       = 0xA0,
+        PROGRAM_EXIT        = 0x80,
+        HUMIDITY_RES_READ   = 0x06,
+        TEMP_RES_READ       = 0x11,
+        REG_WRITE           = 0x40      // added to register read command
+    };
+
+    static const uint8_t PROGRAM_READ_OK = 0x81;
+    static const uint16_t RESOLUTION_MASK = 0x0C00;
+    static const uint32_t RESOLUTION_SHIFT = 10;
+    static const uint32_t NUM_RESOLUTION_REGS = 2;
+    static const uint8_t RESOLUTION_REGS[NUM_RESOLUTION_REGS];
+    // Conversion time of both channels per resolution register code.
+    static const uint8_t CONVERSION_TIME_MS[4];
+
+    // Register read response is available after 120 us.
+    static const uint32_t REG_READ_DELAY_MS = 1;
+    // Non-volatile memory write takes 14 ms.
+    static const uint32_t REG_WRITE_TIME_MS = 15;
+
+    enum State {
+        STATE_IDLE,
+        STATE_TRIGGER,
+        STATE_CONVERSION,
+        STATE_FETCH,
+        STATE_PROGRAM_ENTER,
+        STATE_REG_REQUEST,
+        STATE_REG_READ,
+        STATE_REG_WRITE,
+        STATE_PROGRAM_EXIT
+    };
+
+    void fetch();
+    void send_command(uint8_t cmd, uint16_t data, State state);
+    void program_next();
+    void read_register();
+    void program_done();
+    void on_transfer(int result);
+
+protected:
+    I2CBus&         _bus;
+    I2CTransaction  _xfer;
+    char            _buffer[4];
+    State           _state;
+    Status          _status;
+    uint8_t         _resolution_code;
+    uint32_t        _conversion_time_ms;
+    uint32_t        _reg_index;
+    uint16_t        _humidity;
+    int16_t         _temperature;
+    Callback<void()> _program_done;
 };
 
 
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mbed.h>
+#include "hal/pinmap.h"
+#include "PeripheralPins.h"
+#include "I2CBus.h"
+
+
+#define I2C_EVENT_FAILED    (I2C_EVENT_ERROR | I2C_EVENT_ERROR_NO_SLAVE | I2C_EVENT_TRANSFER_EARLY_NACK)
+
+#ifdef MBED_DEBUG
+static uint32_t transfer_stat = 0;
+static uint32_t error_stat = 0;
+static uint32_t frequency_switch_stat = 0;
+static uint32_t timeout_stat = 0;
+static uint32_t recovery_stat = 0;
+#endif // MBED_DEBUG
+
+
+/** Time limit for a transaction: duration on the wire (address bytes,
+ * data bytes and acknowledges) plus clock stretching allowance.
+ */
+static uint32_t transfer_timeout_ms(const I2CTransaction *t, uint32_t margin_ms)
+{
+    uint32_t bits = 9 * (t->tx_length + t->rx_length + 2) + 2;
+
+    return (bits * 1000) / t->frequency + 1 + margin_ms;
+}
+
+
+I2CBus::I2CBus(PinName sda, PinName scl, EventQueue &ev_queue) :
+    _sda(sda),
+    _scl(scl),
+    _i2c(sda, scl),
+    _ev_queue(ev_queue),
+    _head(NULL),
+    _tail(NULL),
+    _frequency(0),
+    _event(0),
+    _generation(0),
+    _timeout_id(0),
+    _stuck(false)
+{
+    for (uint32_t i = 0; i < NUM_TRANSFER_TAGS; ++i) {
+        _tags[i].bus = this;
+        _tags[i].generation = 0;
+        _tags[i].active = false;
+    }
+}
+
+
+int I2CBus::submit(I2CTransaction &transaction)
+{
+    if ((transaction.next != NULL) || (_tail == &transaction)) {
+        return -1;
+    }
+
+    if (_head == NULL) {
+        _head = &transaction;
+        _tail = &transaction;
+        start_transfer();
+    } else {
+        _tail->next = &transaction;
+        _tail = &transaction;
+    }
+    return 0;
+}
+
+
+void I2CBus::start_transfer()
+{
+    I2CTransaction *t = _head;
+
+#ifdef MBED_DEBUG
+    ++transfer_stat;
+#endif // MBED_DEBUG
+    ++t->count;
+
+    if (_stuck) {
+        // Lines are held low, fail without touching the bus until recovered.
+        _event = I2C_EVENT_ERROR;
+        _ev_queue.call(callback(this, &I2CBus::complete), _generation);
+        return;
+    }
+
+    if (t->frequency != _frequency) {
+#ifdef MBED_DEBUG
+        ++frequency_switch_stat;
+#endif // MBED_DEBUG
+        _frequency = t->frequency;
+        _i2c.frequency(_frequency);
+    }
+
+    _timeout_id = _ev_queue.call_in(transfer_timeout_ms(t, TIMEOUT_MARGIN_MS),
+                                    callback(this, &I2CBus::on_timeout), _generation);
+
+    TransferTag *tag = &_tags[_generation % NUM_TRANSFER_TAGS];
+    tag->generation = _generation;
+    tag->active = true;
+    if (_i2c.transfer(t->address, t->tx_data, t->tx_length, t->rx_data, t->rx_length,
+                      callback(&I2CBus::transfer_irq, tag), I2C_EVENT_ALL) != 0) {
+        // Transfer not started, complete it with an error in a regular way.
+        tag->active = false;
+        _event = I2C_EVENT_ERROR;
+        _ev_queue.call(callback(this, &I2CBus::complete), _generation);
+    }
+}
+
+
+/** Called from interrupt context, completion is deferred to the event queue.
+ * Each transfer has its own handler tag, an interrupt of an aborted transfer
+ * is dropped even when it arrives after the next transfer has started.
+ */
+void I2CBus::transfer_irq(TransferTag *tag, int event)
+{
+    I2CBus *bus = tag->bus;
+
+    if (!tag->active || (tag->generation != bus->_generation)) {
+        return;
+    }
+    tag->active = false;
+    bus->_event = event;
+    bus->_ev_queue.call(callback(bus, &I2CBus::complete), tag->generation);
+}
+
+
+void I2CBus::complete(uint32_t generation)
+{
+    if (generation != _generation) {
+        // Transfer was already aborted on timeout.
+        return;
+    }
+
+    if (_timeout_id) {
+        _ev_queue.cancel(_timeout_id);
+        _timeout_id = 0;
+    }
+
+    if ((_event & I2C_EVENT_ERROR) && !_stuck) {
+        // Bus error or arbitration lost, a slave may be holding SDA low.
+        recover_bus();
+    }
+
+    finish(((_event & I2C_EVENT_FAILED) || !(_event & I2C_EVENT_TRANSFER_COMPLETE)) ? -1 : 0);
+}
+
+
+/** Transfer did not complete in time, it is aborted and the bus is recovered.
+ */
+void I2CBus::on_timeout(uint32_t generation)
+{
+    if (generation != _generation) {
+        return;
+    }
+
+#ifdef MBED_DEBUG
+    ++timeout_stat;
+#endif // MBED_DEBUG
+    _timeout_id = 0;
+    ++_head->timeouts;
+    // Fence the interrupt before the abort, it must not be delivered any more.
+    _tags[_generation % NUM_TRANSFER_TAGS].active = false;
+    _i2c.abort_transfer();
+    recover_bus();
+    finish(-1);
+}
+
+
+void I2CBus::finish(int result)
+{
+    I2CTransaction *t = _head;
+
+    if (result) {
+#ifdef MBED_DEBUG
+        ++error_stat;
+#endif // MBED_DEBUG
+        ++t->errors;
+        ++t->failures;
+    } else {
+        t->failures = 0;
+    }
+
+    ++_generation;
+    _head = t->next;
+    t->next = NULL;
+    if (_head == NULL) {
+        _tail = NULL;
+    } else {
+        // Keep the bus busy, next transaction does not wait for the callback.
+        start_transfer();
+    }
+
+    if (t->done) {
+        t->done(result);
+    }
+}
+
+
+void I2CBus::recover_bus()
+{
+    if (!recover()) {
+        _stuck = true;
+        _ev_queue.call_in(RECOVERY_RETRY_MS, callback(this, &I2CBus::retry_recovery));
+    }
+}
+
+
+void I2CBus::retry_recovery()
+{
+    if (recover()) {
+        _stuck = false;
+    } else {
+        _ev_queue.call_in(RECOVERY_RETRY_MS, callback(this, &I2CBus::retry_recovery));
+    }
+}
+
+
+/** Standard bus clear: a slave holding SDA low is in the middle of
+ * sending a byte, it is clocked out (at most 8 bits and acknowledge)
+ * until SDA is released and the transaction is terminated with STOP.
+ * Blocks for at most 120 us.
+ *
+ * @returns true when both lines are released
+ */
+bool I2CBus::recover()
+{
+    bool released;
+
+#ifdef MBED_DEBUG
+    ++recovery_stat;
+#endif // MBED_DEBUG
+    {
+        DigitalInOut scl(_scl, PIN_OUTPUT, OpenDrain, 1);
+        DigitalInOut sda(_sda, PIN_OUTPUT, OpenDrain, 1);
+
+        wait_us(RECOVERY_HALF_PERIOD_US);
+        for (uint32_t i = 0; (i < RECOVERY_CLOCKS) && !sda.read(); ++i) {
+            scl = 0;
+            wait_us(RECOVERY_HALF_PERIOD_US);
+            scl = 1;
+            wait_us(RECOVERY_HALF_PERIOD_US);
+        }
+
+        // STOP: SDA goes high while SCL is high.
+        scl = 0;
+        wait_us(RECOVERY_HALF_PERIOD_US);
+        sda = 0;
+        wait_us(RECOVERY_HALF_PERIOD_US);
+        scl = 1;
+        wait_us(RECOVERY_HALF_PERIOD_US);
+        sda = 1;
+        wait_us(RECOVERY_HALF_PERIOD_US);
+
+        released = sda.read() && scl.read();
+    }
+
+    // Pins were taken over as GPIO, they are routed back to the controller.
+    // Controller is kept, initializing it again would reserve its pins twice.
+    pin_function(_sda, pinmap_function(_sda, PinMap_I2C_SDA));
+    pin_function(_scl, pinmap_function(_scl, PinMap_I2C_SCL));
+    _frequency = 0;
+
+    return released;
+}
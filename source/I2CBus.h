@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef I2C_BUS_H_
+#define I2C_BUS_H_
+
+#include <mbed.h>
+
+
+/** Single bus transaction: optional write followed by optional read
+ * using repeated start.
+ *
+ * Transaction descriptor and its buffers are owned by the driver and
+ * must not be modified until the completion callback is called.
+ */
+struct I2CTransaction {
+    uint8_t             address;    //<! device address, 8-bit format
+    uint32_t            frequency;  //<! bus clock used for this device, Hz
+    const char          *tx_data;   //<! data to write
+    uint32_t            tx_length;  //<! number of bytes to write, 0 for read only
+    char                *rx_data;   //<! buffer for read data
+    uint32_t            rx_length;  //<! number of bytes to read, 0 for write only
+    Callback<void(int)> done;       //<! completion callback, receives 0 on success
+    uint32_t            count;      //<! number of times executed, updated by the bus
+    uint32_t            errors;     //<! number of failed executions, updated by the bus
+    uint32_t            timeouts;   //<! number of executions aborted on timeout, updated by the bus
+    uint32_t            failures;   //<! consecutive failed executions, updated by the bus
+    I2CTransaction      *next;      //<! queue link, used by the bus
+
+    /** Consecutive failures after which the device is reported as degraded.
+     */
+    static const uint32_t DEGRADED_FAILURES = 3;
+
+    I2CTransaction(uint8_t addr, uint32_t freq) :
+        address(addr),
+        frequency(freq),
+        tx_data(NULL),
+        tx_length(0),
+        rx_data(NULL),
+        rx_length(0),
+        count(0),
+        errors(0),
+        timeouts(0),
+        failures(0),
+        next(NULL)
+    {}
+
+    /** Check whether the device stopped responding.
+     * Device recovers from degraded state with the first successful transaction.
+     */
+    bool degraded() const { return failures >= DEGRADED_FAILURES; }
+};
+
+
+/** I2C bus shared by multiple drivers.
+ *
+ * Transactions from all drivers are queued and executed one after
+ * another using non-blocking transfers, so the event queue thread never
+ * waits for the bus. Completion callbacks are called from the event queue.
+ *
+ * Every transfer is guarded by a timeout, so a device which stops responding
+ * fails its own transactions instead of blocking the bus. After a timeout
+ * or a bus error the bus is recovered by clocking out a slave holding SDA
+ * low; while the lines stay low transactions fail immediately and recovery
+ * is retried periodically.
+ */
+class I2CBus {
+public:
+    static const uint32_t FREQUENCY_STANDARD    = 100000;
+    static const uint32_t FREQUENCY_FAST        = 400000;
+
+public:
+    /** Create bus scheduler.
+     *
+     * @param sda I2C data pin
+     * @param scl I2C clock pin
+     * @param ev_queue event queue used to call completion callbacks
+     */
+    I2CBus(PinName sda, PinName scl, EventQueue &ev_queue);
+
+    /** Queue transaction for execution.
+     *
+     * @param transaction transaction to execute, must not be already queued
+     * @returns 0 when queued, (-1) when transaction is already pending
+     */
+    int submit(I2CTransaction &transaction);
+
+    /** Get event queue used by the bus, drivers use it for their timers.
+     */
+    EventQueue& get_event_queue() { return _ev_queue; }
+
+    /** Check whether bus lines are held low and could not be recovered.
+     */
+    bool is_stuck() const { return _stuck; }
+
+protected:
+    // Allowance for clock stretching, SCD30 may stretch up to 150 ms.
+    static const uint32_t TIMEOUT_MARGIN_MS         = 200;
+    // Recovery clocks out up to one byte and acknowledge bit at 100 kHz.
+    static const uint32_t RECOVERY_CLOCKS           = 9;
+    static const uint32_t RECOVERY_HALF_PERIOD_US   = 5;
+    static const uint32_t RECOVERY_RETRY_MS         = 1000;
+    // Handler tags alternate between consecutive transfers.
+    static const uint32_t NUM_TRANSFER_TAGS         = 2;
+
+    /** Binds the interrupt handler to a single transfer.
+     */
+    struct TransferTag {
+        I2CBus              *bus;
+        volatile uint32_t   generation;
+        volatile bool       active;
+    };
+
+    void start_transfer();
+    static void transfer_irq(TransferTag *tag, int event);
+    void complete(uint32_t generation);
+    void on_timeout(uint32_t generation);
+    void finish(int result);
+    void recover_bus();
+    void retry_recovery();
+    bool recover();
+
+protected:
+    PinName         _sda;
+    PinName         _scl;
+    I2C             _i2c;
+    EventQueue      &_ev_queue;
+    I2CTransaction  *_head;
+    I2CTransaction  *_tail;
+    uint32_t        _frequency;
+    volatile int    _event;
+    // Identifies the transfer in progress, stale completions are ignored.
+    volatile uint32_t _generation;
+    TransferTag     _tags[NUM_TRANSFER_TAGS];
+    int             _timeout_id;
+    bool            _stuck;
+};
+
+
+#endif // I2C_BUS_H_
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include "IaqEstimator.h"
+
+// Resistance reported outside of the ADC measurement range.
+#define MIN_RESISTANCE      1e-3f
+#define MAX_RESISTANCE      10e9f
+
+// Results are not valid until the sensor and baseline settle.
+#define WARMUP_SAMPLES      100
+
+// Baseline follows cleaner air within a few samples,
+// polluted air is absorbed with 12 hours time constant.
+#define BASELINE_RISE       (1.0f / 16.0f)
+#define BASELINE_TAU_S      43200.0f
+
+// MOx resistance falls with concentration as C^(-beta),
+// clean air reference concentration is 0.1 mg/m3.
+#define TVOC_BETA           0.5f
+#define TVOC_CLEAN_MG       0.1f
+#define LN_TVOC_CLEAN       (-2.3025851f)
+#define LN_TVOC_MAX         3.4011974f      // 30 mg/m3
+
+// Water vapour lowers MOx resistance too, first order correction
+// in absolute humidity around typical indoor level.
+#define HUMIDITY_COEFF      0.02f           // ln(R) per g/m3
+#define HUMIDITY_REF_G      10.0f
+
+// eCO2 assumes VOCs are produced by occupants.
+#define ECO2_OUTDOOR_PPM    400.0f
+#define ECO2_PPM_PER_MG     400.0f
+#define ECO2_MAX_PPM        5000.0f
+
+// IAQ rating is linear in log concentration between UBA level limits:
+// 0.3, 1, 3, 10 and 30 mg/m3.
+#define NUM_IAQ_SEGMENTS    4
+static const float IAQ_LN_LIMIT[NUM_IAQ_SEGMENTS + 1] = {
+    -1.2039728f, 0.0f, 1.0986123f, 2.3025851f, 3.4011974f
+};
+
+
+IaqEstimator::IaqEstimator(uint32_t sample_period_ms) :
+    _decay(sample_period_ms / (BASELINE_TAU_S * 1000.0f)),
+    _compensation(0.0f)
+{
+    reset();
+}
+
+
+void IaqEstimator::reset()
+{
+    _samples = 0;
+    _baseline = 0.0f;
+    _estimate.tvoc = 0;
+    _estimate.eco2 = (uint32_t)ECO2_OUTDOOR_PPM;
+    _estimate.iaq = 10;
+}
+
+
+float IaqEstimator::resistance(uint16_t adc, uint16_t adc_low, uint16_t adc_high, uint8_t gain)
+{
+    if (adc <= adc_low) {
+        return MIN_RESISTANCE;
+    } else if (adc >= adc_high) {
+        return MAX_RESISTANCE;
+    }
+    return gain * 1e3f * (float)(adc - adc_low) / (float)(adc_high - adc);
+}
+
+
+/** Absolute humidity from the Magnus formula.
+ */
+void IaqEstimator::set_ambient(float temperature, float humidity)
+{
+    float saturation_hpa = 6.112f * expf(17.62f * temperature / (243.12f + temperature));
+    float absolute_g = 216.7f * (humidity / 100.0f) * saturation_hpa / (273.15f + temperature);
+
+    _compensation = HUMIDITY_COEFF * (absolute_g - HUMIDITY_REF_G);
+}
+
+
+bool IaqEstimator::add_sample(float rmox)
+{
+    float level = logf((rmox > MIN_RESISTANCE) ? rmox : MIN_RESISTANCE) + _compensation;
+
+    if (_samples == 0) {
+        _baseline = level;
+    } else if (level > _baseline) {
+        _baseline += BASELINE_RISE * (level - _baseline);
+    } else {
+        _baseline += _decay * (level - _baseline);
+    }
+
+    float ln_tvoc = LN_TVOC_CLEAN + (_baseline - level) / TVOC_BETA;
+    if (ln_tvoc > LN_TVOC_MAX) {
+        ln_tvoc = LN_TVOC_MAX;
+    }
+    float tvoc = expf(ln_tvoc);
+    _estimate.tvoc = (uint32_t)(tvoc * 100.0f + 0.5f);
+
+    float eco2 = ECO2_OUTDOOR_PPM + ECO2_PPM_PER_MG * ((tvoc > TVOC_CLEAN_MG) ? tvoc - TVOC_CLEAN_MG : 0.0f);
+    _estimate.eco2 = (uint32_t)((eco2 > ECO2_MAX_PPM) ? ECO2_MAX_PPM : eco2);
+
+    // All segments are evaluated, cost does not depend on the value.
+    float iaq = 1.0f;
+    for (uint32_t i = 0; i < NUM_IAQ_SEGMENTS; ++i) {
+        float t = (ln_tvoc - IAQ_LN_LIMIT[i]) / (IAQ_LN_LIMIT[i + 1] - IAQ_LN_LIMIT[i]);
+        iaq += (t < 0.0f) ? 0.0f : ((t > 1.0f) ? 1.0f : t);
+    }
+    _estimate.iaq = (uint8_t)(iaq * 10.0f + 0.5f);
+
+    if (_samples <= WARMUP_SAMPLES) {
+        ++_samples;
+    }
+    return _samples > WARMUP_SAMPLES;
+}
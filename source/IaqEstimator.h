@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IAQ_ESTIMATOR_H_
+#define IAQ_ESTIMATOR_H_
+
+#include <stdint.h>
+
+
+/** Indoor air quality estimated from a metal oxide gas sensor.
+ */
+struct IaqEstimate {
+    uint32_t    tvoc;       //<! total volatile organic compounds, 0.01 mg/m3
+    uint32_t    eco2;       //<! estimated CO2 level, ppm
+    uint8_t     iaq;        //<! indoor air quality rating 1..5 (UBA levels), 0.1 units
+};
+
+
+/** TVOC, eCO2 and IAQ estimation from MOx sensor resistance.
+ *
+ * Clean air resistance is tracked as a baseline which follows cleaner air
+ * quickly and polluted air slowly; VOC concentration is derived from the
+ * resistance drop below the baseline. Every sample costs the same: one
+ * logarithm, one exponential and a fixed number of arithmetic operations.
+ * Resistance is corrected for humidity when ambient conditions are known.
+ * Code does not depend on mbed, so it can be run on recorded traces.
+ */
+class IaqEstimator {
+public:
+    /** Create estimator.
+     *
+     * @param sample_period_ms interval between samples
+     */
+    IaqEstimator(uint32_t sample_period_ms);
+
+    /** Restart warm-up and baseline tracking.
+     */
+    void reset();
+
+    /** Convert raw ADC result to sensor resistance.
+     *
+     * @param adc ADC result
+     * @param adc_low ADC result with the lowest measurable resistance
+     * @param adc_high ADC result with the highest measurable resistance
+     * @param gain resistance scale, kOhm
+     * @returns resistance, Ohm
+     */
+    static float resistance(uint16_t adc, uint16_t adc_low, uint16_t adc_high, uint8_t gain);
+
+    /** Set ambient conditions used for humidity compensation.
+     * Correction is calculated here, so samples don't get more expensive.
+     *
+     * @param temperature temperature, deg C
+     * @param humidity relative humidity, %
+     */
+    void set_ambient(float temperature, float humidity);
+
+    /** Add resistance sample.
+     *
+     * @param rmox sensor resistance, Ohm
+     * @returns true when a valid estimate is available (warm-up complete)
+     */
+    bool add_sample(float rmox);
+
+    /** Get estimate calculated from the last sample.
+     */
+    const IaqEstimate& get_estimate() const { return _estimate; }
+
+protected:
+    uint32_t    _samples;
+    float       _baseline;      // ln of the clean air resistance
+    float       _decay;         // baseline adaptation rate towards lower resistance
+    float       _compensation;  // humidity correction added to ln of the resistance
+    IaqEstimate _estimate;
+};
+
+
+#endif // IAQ_ESTIMATOR_H_
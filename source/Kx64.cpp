@@ -16,9 +16,17 @@
 
 #include <mbed.h>
 #include "Kx64.h"
+#include "NvStorage.h"
 
 
-Kx64Driver::Kx64Driver(SPI& bus, PinName cs) : _spi(bus), _chip_select(cs)
+constexpr Kx64Driver::OdrSetting Kx64Driver::ODR_TABLE[];
+constexpr Kx64Driver::RangeSetting Kx64Driver::ACC_RANGE_TABLE[];
+
+
+Kx64Driver::Kx64Driver(SPI& bus, PinName cs) :
+    _spi(bus),
+    _chip_select(cs),
+    _acc_full_scale(ACC_RANGE_TABLE[Kx64Config::ACC_RANGE_8G].full_scale)
 {
     _chip_select = 1;
 };
@@ -59,39 +67,47 @@ void Kx64Driver::spi_read_multiple(uint8_t reg_address, uint8_t *data, uint32_t
 }
 
 
-#define AccScale(x) (int16_t)(((int32_t)(x) * 2 * 16000) >> 16)
-#define MagScale(x) (int16_t)((((int32_t)(x)) * 2 * 12000) >> 16)
-
-Kx64Driver::Status Kx64Driver::read(Kx64Value& value)
+static inline int16_t get_int16_le(const uint8_t *src)
 {
-    uint8_t buffer[14];
-//    uint8_t status[3];
-//    spi_read_multiple(BUF_STATUS_1, status, 3);
+    return (int16_t)((uint16_t)src[0] | ((uint16_t)src[1] << 8));
+}
 
-    spi_read_multiple(BUF_READ, &buffer[1], 13);
 
-#if 0
-    printf("kx64: raw=");
-    for (uint32_t i = 2; i < 14; i+=2) {
-        printf("%02x%02x ", buffer[i+1], buffer[i]);
+uint32_t Kx64Driver::read_fifo(Kx64Value *values, uint32_t max_count)
+{
+    uint8_t status[3];
+    uint32_t count;
+
+    spi_read_multiple(BUF_STATUS_1, status, 3);
+    count = (status[1] | ((status[2] & 0x03) << 8)) / SAMPLE_SIZE;
+    if (count > max_count) {
+        count = max_count;
+    }
+    if (count == 0) {
+        return 0;
     }
-    printf("  status %02x%02x\n", status[2], status[1]);
-#endif // 0
 
-    value.acc_x = AccScale(*reinterpret_cast<int16_t*>(buffer+2));
-    value.acc_y = AccScale(*reinterpret_cast<int16_t*>(buffer+4));
-    value.acc_z = AccScale(*reinterpret_cast<int16_t*>(buffer+6));
-    value.mag_x = MagScale(*reinterpret_cast<int16_t*>(buffer+8));
-    value.mag_y = MagScale(*reinterpret_cast<int16_t*>(buffer+10));
-    value.mag_z = MagScale(*reinterpret_cast<int16_t*>(buffer+12));
+    spi_read_multiple(BUF_READ, _fifo_buffer, count * SAMPLE_SIZE + 1);
+
+    const uint8_t *raw = &_fifo_buffer[1];
+    for (uint32_t i = 0; i < count; ++i) {
+        values[i].acc_x = scale(get_int16_le(raw + 0), _acc_full_scale);
+        values[i].acc_y = scale(get_int16_le(raw + 2), _acc_full_scale);
+        values[i].acc_z = scale(get_int16_le(raw + 4), _acc_full_scale);
+        values[i].mag_x = scale(get_int16_le(raw + 6), MAG_FULL_SCALE);
+        values[i].mag_y = scale(get_int16_le(raw + 8), MAG_FULL_SCALE);
+        values[i].mag_z = scale(get_int16_le(raw + 10), MAG_FULL_SCALE);
+        raw += SAMPLE_SIZE;
+    }
 
 #if 0
-    printf("Acc: %8d %8d %8d   Mag: %8d %8d %8d\n",
-           value.acc_x, value.acc_y, value.acc_z,
-           value.mag_x, value.mag_y, value.mag_z);
+    printf("Acc: %8d %8d %8d   Mag: %8d %8d %8d  (%lu samples)\n",
+           values[count - 1].acc_x, values[count - 1].acc_y, values[count - 1].acc_z,
+           values[count - 1].mag_x, values[count - 1].mag_y, values[count - 1].mag_z,
+           count);
 #endif // 0
 
-    return STATUS_OK;
+    return count;
 }
 
 void Kx64Driver::clear_buffer()
@@ -101,14 +117,176 @@ void Kx64Driver::clear_buffer()
 
 void Kx64Driver::init_chip()
 {
-    // Initialize chip
-    spi_transaction(CNTL2, 0x14);       // Acc range 8g, disable sensors, oversampling
-    spi_transaction(CNTL1, 0x03);       // Mag range 1200uT
-    spi_transaction(ODCNTL, 0x00);      // data rate 12.5 sps
-    spi_transaction(BUF_CTRL1, 12);     // trig level
+    // Initialize chip, sensors get enabled by configure()
+    spi_transaction(CNTL2, 0x00);       // disable sensors
     spi_transaction(BUF_CTRL2, 0x00);   // buffer FIFO mode
     spi_transaction(BUF_CTRL3, 0x7E);   // enable all Acc and Mag data
-    spi_transaction(CNTL2, 0x17);       // enable sensors
+}
+
+Kx64Driver::Status Kx64Driver::configure(const Kx64Config& config, uint32_t watermark)
+{
+    if ((config.odr >= Kx64Config::ODR_NUM) ||
+        (config.acc_range >= Kx64Config::ACC_RANGE_NUM) ||
+        (watermark == 0) || (watermark > FIFO_MAX_SAMPLES)) {
+        return STATUS_INVALID_CONFIG;
+    }
+
+    uint8_t cntl2 = ACC_RANGE_TABLE[config.acc_range].reg_value | Cntl2Reg::RES_MAX;
+
+    spi_transaction(CNTL2, cntl2);                              // disable sensors while configuring
+    spi_transaction(CNTL1, 0x03);                               // Mag range 1200uT
+    spi_transaction(ODCNTL, ODR_TABLE[config.odr].reg_value);
+    spi_transaction(BUF_CTRL1, watermark * SAMPLE_SIZE);        // trig level
+    spi_transaction(CNTL2, cntl2 | Cntl2Reg::ACC_EN | Cntl2Reg::MAG_EN);
+    _acc_full_scale = ACC_RANGE_TABLE[config.acc_range].full_scale;
+    clear_buffer();
+
+    return STATUS_OK;
+}
+
+
+int Kx64ConfigActuator::set_value(Kx64Config& value)
+{
+    int result = _sensor.configure(value);
+    if (result == 0) {
+        _value = value;
+    }
+    // Let the client see the configuration actually in use.
+    update_notify();
+    return result;
+}
+
+
+void Kx64FeatureSensor::process(const Kx64Value *samples, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        if (_engine.add_sample(samples[i].acc_x, samples[i].acc_y, samples[i].acc_z)) {
+            _value = _engine.get_features();
+            update_notify();
+        }
+    }
+}
+
+
+void Kx64SpectrumSensor::process(const Kx64Value *samples, uint32_t count)
+{
+    if (_mode == Kx64Config::SPECTRUM_OFF) {
+        return;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        if (_to_skip) {
+            --_to_skip;
+            continue;
+        }
+        int16_t sample;
+        switch (_mode) {
+            case Kx64Config::SPECTRUM_X:
+                sample = samples[i].acc_x;
+                break;
+            case Kx64Config::SPECTRUM_Y:
+                sample = samples[i].acc_y;
+                break;
+            default:
+                sample = samples[i].acc_z;
+                break;
+        }
+        if (_analyzer.add_sample(sample)) {
+            _value = _analyzer.get_peaks();
+            update_notify();
+            _to_skip = _skip;
+        }
+    }
+}
+
+void Kx64SpectrumSensor::configure(uint8_t mode, uint32_t rate_mhz, uint32_t skip)
+{
+    _mode = mode;
+    _skip = skip;
+    _to_skip = 0;
+    _analyzer.set_sample_rate(rate_mhz);
+    _analyzer.reset();
+}
+
+
+void Kx64MagCalibrationActuator::load()
+{
+    MagCalibration calibration;
+
+    if ((NvStorage::load(NvStorage::SLOT_MAG_CALIBRATION, &calibration, sizeof(calibration)) == 0) &&
+        MagCalibrator::valid(calibration)) {
+        _calibrator.set(calibration);
+        _value = calibration;
+        _saved_value = calibration;
+        _saved = true;
+    }
+}
+
+void Kx64MagCalibrationActuator::save()
+{
+    if (NvStorage::store(NvStorage::SLOT_MAG_CALIBRATION, &_value, sizeof(_value)) == 0) {
+        _saved_value = _value;
+        _saved = true;
+    }
+}
+
+int Kx64MagCalibrationActuator::set_value(MagCalibration& value)
+{
+    int result = 0;
+
+    if ((value.scale[0] == 0) && (value.scale[1] == 0) && (value.scale[2] == 0)) {
+        _calibrator.reset();
+        _value = _calibrator.get();
+        _saved = false;
+    } else if (MagCalibrator::valid(value)) {
+        _calibrator.set(value);
+        _value = _calibrator.get();
+        save();
+    } else {
+        result = -1;
+    }
+    // Let the client see the calibration actually in use.
+    update_notify();
+    return result;
+}
+
+void Kx64MagCalibrationActuator::process(Kx64Value *samples, uint32_t count)
+{
+    bool updated = false;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        Kx64Value &v = samples[i];
+        if (++_sample_count >= _decimation) {
+            _sample_count = 0;
+            updated |= _calibrator.add_sample(v.mag_x, v.mag_y, v.mag_z);
+        }
+        _calibrator.apply(v.mag_x, v.mag_y, v.mag_z);
+    }
+
+    if (updated) {
+        _value = _calibrator.get();
+        update_notify();
+        // Quality and error are whole percent, so improvements are saved a few times at most.
+        if ((_value.quality >= SAVE_MIN_QUALITY) && (_value.error <= SAVE_MAX_ERROR) &&
+            (!_saved || MagCalibrator::better(_value, _saved_value))) {
+            save();
+        }
+    }
+}
+
+
+void Kx64OrientationSensor::process(const Kx64Value *samples, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        const Kx64Value &v = samples[i];
+        _filter.add_sample(v.acc_x, v.acc_y, v.acc_z, v.mag_x, v.mag_y, v.mag_z);
+    }
+}
+
+void Kx64OrientationSensor::publish()
+{
+    if (_filter.get_orientation(_value)) {
+        update_notify();
+    }
 }
 
 
@@ -116,17 +294,83 @@ void Kx64Driver::init_chip()
  */
 void Kx64Sensor::updater()
 {
-    if (_driver.read(_value) == Kx64Driver::STATUS_OK) {
+    uint32_t count = _driver.read_fifo(_samples, Kx64Driver::FIFO_MAX_SAMPLES);
+
+    if (count > 0) {
+        _mag_calibration.process(_samples, count);
+        _value = _samples[count - 1];
+        _features.process(_samples, count);
+        _spectrum.process(_samples, count);
+        _orientation.process(_samples, count);
+    }
+    if (++_poll_count >= _polls_per_notify) {
+        _poll_count = 0;
         update_notify();
-    };
-    _driver.clear_buffer();
+        _orientation.publish();
+    }
+}
+
+/** Calculate FIFO watermark and polling period for a data rate
+ * and (re)schedule periodic sensor updates.
+ */
+void Kx64Sensor::schedule(const Kx64Config& config)
+{
+    uint32_t rate_mhz = Kx64Driver::ODR_TABLE[config.odr].rate_mhz;
+    uint32_t poll_ms;
+
+    // Collect as many samples as arrive within the notification period.
+    _watermark = (uint32_t)((uint64_t)rate_mhz * NOTIFY_PERIOD_MS / 1000000);
+    if (_watermark < 1) {
+        _watermark = 1;
+    } else if (_watermark > MAX_WATERMARK) {
+        _watermark = MAX_WATERMARK;
+    }
+    poll_ms = (uint32_t)((uint64_t)_watermark * 1000000 / rate_mhz);
+    if (poll_ms < MIN_POLL_PERIOD_MS) {
+        poll_ms = MIN_POLL_PERIOD_MS;
+    }
+    _polls_per_notify = (poll_ms < NOTIFY_PERIOD_MS) ? NOTIFY_PERIOD_MS / poll_ms : 1;
+    _poll_count = 0;
+    _mag_calibration.set_decimation((rate_mhz > MAG_CALIBRATION_RATE_MHZ) ? rate_mhz / MAG_CALIBRATION_RATE_MHZ : 1);
+    _orientation.set_sample_rate(rate_mhz);
+    _features.set_window((uint32_t)((uint64_t)rate_mhz * FEATURE_WINDOW_MS / 1000000));
+
+    // Analyze no more than one spectrum block per notification period.
+    uint32_t period_samples = (uint32_t)((uint64_t)rate_mhz * NOTIFY_PERIOD_MS / 1000000);
+    _spectrum.configure(config.spectrum_mode,
+                        rate_mhz,
+                        (period_samples > SPECTRUM_FFT_SIZE) ? period_samples - SPECTRUM_FFT_SIZE : 0);
+
+    if (_ev_queue) {
+        if (_event_id) {
+            _ev_queue->cancel(_event_id);
+        }
+        _event_id = _ev_queue->call_every(poll_ms, callback(this, &Kx64Sensor::updater));
+    }
+}
+
+int Kx64Sensor::configure(const Kx64Config& config)
+{
+    if ((config.odr >= Kx64Config::ODR_NUM) ||
+        (config.acc_range >= Kx64Config::ACC_RANGE_NUM) ||
+        (config.spectrum_mode >= Kx64Config::SPECTRUM_NUM)) {
+        return -1;
+    }
+    _config = config;
+    if (_ev_queue) {
+        schedule(config);
+        _driver.configure(config, _watermark);
+    }
+    return 0;
 }
 
 /** Initialize driver and setup periodic sensor updates.
  */
 void Kx64Sensor::start(EventQueue& ev_queue)
 {
+    _ev_queue = &ev_queue;
+    _mag_calibration.load();
     _driver.init_chip();
-    _driver.clear_buffer();
-    ev_queue.call_every(500, callback(this, &Kx64Sensor::updater));
+    schedule(_config);
+    _driver.configure(_config, _watermark);
 }
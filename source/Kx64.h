@@ -19,6 +19,11 @@
 
 #include <stdint.h>
 #include <Sensor.h>
+#include <Actuator.h>
+#include "MotionFeatureEngine.h"
+#include "SpectrumAnalyzer.h"
+#include "MagCalibrator.h"
+#include "OrientationFilter.h"
 
 
 /** Represents measurement result received from KX64/65 accelerometer and magnetometer sensor.
@@ -35,6 +40,66 @@ struct Kx64Value {
 };
 
 
+/** Represents KX64/65 sensor configuration selectable by BLE clients.
+ * Both fields are indexes into the driver configuration tables.
+ */
+struct Kx64Config {
+    /** Supported output data rates.
+     */
+    enum OutputDataRate {
+        ODR_0_781 = 0,
+        ODR_1_563,
+        ODR_3_125,
+        ODR_6_25,
+        ODR_12_5,
+        ODR_25,
+        ODR_50,
+        ODR_100,
+        ODR_200,
+        ODR_400,
+        ODR_800,
+        ODR_1600,
+        ODR_NUM
+    };
+
+    /** Supported accelerometer ranges.
+     */
+    enum AccRange {
+        ACC_RANGE_2G = 0,
+        ACC_RANGE_4G,
+        ACC_RANGE_8G,
+        ACC_RANGE_16G,
+        ACC_RANGE_NUM
+    };
+
+    /** Vibration spectrum mode, selects analyzed accelerometer axis.
+     */
+    enum SpectrumMode {
+        SPECTRUM_OFF = 0,
+        SPECTRUM_X,
+        SPECTRUM_Y,
+        SPECTRUM_Z,
+        SPECTRUM_NUM
+    };
+
+    uint8_t     odr;            //<! output data rate
+    uint8_t     acc_range;      //<! accelerometer range
+    uint8_t     spectrum_mode;  //<! vibration spectrum mode
+
+    Kx64Config(const uint8_t *data) :
+        odr(data[0]),
+        acc_range(data[1]),
+        spectrum_mode(data[2])
+    {}
+
+    Kx64Config() :
+        odr(ODR_12_5),
+        acc_range(ACC_RANGE_8G),
+        spectrum_mode(SPECTRUM_OFF)
+    {}
+};
+
+
 /** Driver for KX64/65 sensor.
  */
 class Kx64Driver {
@@ -44,7 +109,8 @@ public:
     enum Status {
         STATUS_OK = 0,
         STATUS_STALLED,
-        STATUS_NOT_READY
+        STATUS_NOT_READY,
+        STATUS_INVALID_CONFIG
     };
 
     /** KX64 chip register addresses.
@@ -65,6 +131,71 @@ public:
         READ_MASK       = 0x80
      };
 
+    struct Cntl2Reg {
+        static const uint8_t ACC_EN     = 0x01;
+        static const uint8_t MAG_EN     = 0x02;
+        static const uint8_t RES_MAX    = 0x04;
+        static const uint8_t GSEL_2G    = 0x00;
+        static const uint8_t GSEL_4G    = 0x08;
+        static const uint8_t GSEL_8G    = 0x10;
+        static const uint8_t GSEL_16G   = 0x18;
+    };
+
+    /** Output data rate setting: ODCNTL register value and resulting rate.
+     */
+    struct OdrSetting {
+        uint8_t     reg_value;
+        uint32_t    rate_mhz;   // samples per 1000 seconds
+    };
+
+    /** Accelerometer range setting: CNTL2 range bits and scaled full-scale value.
+     */
+    struct RangeSetting {
+        uint8_t     reg_value;
+        int32_t     full_scale;
+    };
+
+    // Accelerometer and magnetometer always run at the same rate.
+    static constexpr OdrSetting ODR_TABLE[Kx64Config::ODR_NUM] = {
+        { 0x88,     781 },
+        { 0x99,    1563 },
+        { 0xAA,    3125 },
+        { 0xBB,    6250 },
+        { 0x00,   12500 },
+        { 0x11,   25000 },
+        { 0x22,   50000 },
+        { 0x33,  100000 },
+        { 0x44,  200000 },
+        { 0x55,  400000 },
+        { 0x66,  800000 },
+        { 0x77, 1600000 }
+    };
+
+    // Full scale values keep the characteristic units the same for all ranges.
+    static constexpr RangeSetting ACC_RANGE_TABLE[Kx64Config::ACC_RANGE_NUM] = {
+        { Cntl2Reg::GSEL_2G,     4000 },
+        { Cntl2Reg::GSEL_4G,     8000 },
+        { Cntl2Reg::GSEL_8G,    16000 },
+        { Cntl2Reg::GSEL_16G,   32000 }
+    };
+
+    // Acceleration output units per 1 g, same for all ranges.
+    static constexpr int32_t ACC_UNITS_PER_G = 2000;
+
+    // Magnetometer has a single 1200uT range.
+    static constexpr int32_t MAG_FULL_SCALE = 12000;
+
+    static const uint32_t SAMPLE_SIZE       = 12;   // Acc and Mag XYZ, 16 bits each
+    static const uint32_t FIFO_SIZE         = 384;
+    static const uint32_t FIFO_MAX_SAMPLES  = FIFO_SIZE / SAMPLE_SIZE;
+
+    /** Scale raw 16-bit reading to the given full scale value.
+     */
+    static constexpr int16_t scale(int16_t raw, int32_t full_scale)
+    {
+        return (int16_t)(((int32_t)raw * 2 * full_scale) >> 16);
+    }
+
 public:
     /** Create and initialize driver.
      *
@@ -73,17 +204,31 @@ public:
      */
     Kx64Driver(SPI& bus, PinName cs);
 
-    /** Obtain reading of the sensor.
+    /** Read all measurements collected in the FIFO buffer.
      *
-     * @param[out] value measurement result
-     * @returns operation status
+     * @param[out] values measurement results, oldest first
+     * @param max_count capacity of the values buffer
+     * @returns number of measurements read
      */
-    Status read(Kx64Value& value);
+    uint32_t read_fifo(Kx64Value *values, uint32_t max_count);
 
     /** Initialize sensor chip after reset.
+     *
+     * Sensors are left disabled until configured.
      */
     void init_chip();
 
+    /** Apply output data rate and range configuration.
+     *
+     * Sensors are disabled while the configuration changes and
+     * the FIFO buffer is cleared afterwards.
+     *
+     * @param config new configuration
+     * @param watermark FIFO watermark level in samples
+     * @returns operation status
+     */
+    Status configure(const Kx64Config& config, uint32_t watermark);
+
     /** Clear readout buffer.
      *
      * Sensor read out is perform via the FIFO buffer included within the chip.
@@ -98,8 +243,168 @@ protected:
 
     SPI&        _spi;
     DigitalOut  _chip_select;
+    int32_t     _acc_full_scale;
     char        _tx_buffer[2];
     char        _rx_buffer[2];
+    uint8_t     _fifo_buffer[FIFO_SIZE + 1];
+};
+
+
+class Kx64Sensor;
+
+/** KX64 configuration interface.
+ *
+ * Allows BLE clients to select output data rate and accelerometer range.
+ */
+class Kx64ConfigActuator : public Actuator<Kx64Config> {
+public:
+    Kx64ConfigActuator(Kx64Sensor &sensor) : _sensor(sensor) {}
+
+    virtual void    start(EventQueue& ev_queue) {}
+    virtual int     set_value(Kx64Config& value);
+
+protected:
+    Kx64Sensor &_sensor;
+};
+
+
+/** KX64 motion features interface.
+ *
+ * Features are calculated from every accelerometer sample
+ * and published once per window.
+ */
+class Kx64FeatureSensor : public Sensor<MotionFeatures> {
+public:
+    Kx64FeatureSensor() :
+        _engine(MotionFeatureEngine::MIN_WINDOW,
+                SHOCK_THRESHOLD_G * Kx64Driver::ACC_UNITS_PER_G,
+                SHOCK_RELEASE_G * Kx64Driver::ACC_UNITS_PER_G)
+    {}
+
+    virtual void start(EventQueue& ev_queue) {}
+
+    /** Process accelerometer samples.
+     */
+    void process(const Kx64Value *samples, uint32_t count);
+
+    /** Change window length.
+     *
+     * @param window number of samples in a window
+     */
+    void set_window(uint32_t window) { _engine.set_window(window); }
+
+protected:
+    static const int32_t SHOCK_THRESHOLD_G  = 3;
+    static const int32_t SHOCK_RELEASE_G    = 2;
+
+    MotionFeatureEngine _engine;
+};
+
+
+/** KX64 vibration spectrum interface.
+ *
+ * When enabled, blocks of samples of the selected accelerometer axis
+ * are analyzed and the dominant frequencies are published.
+ */
+class Kx64SpectrumSensor : public Sensor<SpectrumPeaks> {
+public:
+    Kx64SpectrumSensor() : _mode(Kx64Config::SPECTRUM_OFF), _skip(0), _to_skip(0) {}
+
+    virtual void start(EventQueue& ev_queue) {}
+
+    /** Process accelerometer samples.
+     */
+    void process(const Kx64Value *samples, uint32_t count);
+
+    /** Change spectrum mode and sampling parameters.
+     *
+     * @param mode spectrum mode
+     * @param rate_mhz sampling rate in samples per 1000 seconds
+     * @param skip number of samples to skip between analyzed blocks
+     */
+    void configure(uint8_t mode, uint32_t rate_mhz, uint32_t skip);
+
+protected:
+    SpectrumAnalyzer    _analyzer;
+    uint8_t             _mode;
+    uint32_t            _skip;
+    uint32_t            _to_skip;
+};
+
+
+/** KX64 magnetometer calibration interface.
+ *
+ * Calibration is estimated online from magnetometer samples and applied
+ * to every sample read. It is stored in non-volatile memory once enough
+ * rotation has been seen and again whenever the fit improves. Clients may
+ * write a calibration to apply it, writing zero scale factors restarts
+ * the estimation.
+ */
+class Kx64MagCalibrationActuator : public Actuator<MagCalibration> {
+public:
+    Kx64MagCalibrationActuator() : _decimation(1), _sample_count(0), _saved(false) {}
+
+    virtual void    start(EventQueue& ev_queue) {}
+    virtual int     set_value(MagCalibration& value);
+
+    /** Restore calibration from non-volatile storage.
+     */
+    void load();
+
+    /** Feed estimator and calibrate magnetometer samples in place.
+     */
+    void process(Kx64Value *samples, uint32_t count);
+
+    /** Set estimator input decimation.
+     *
+     * @param decimation only every n-th sample is fed to the estimator
+     */
+    void set_decimation(uint32_t decimation) { _decimation = decimation; }
+
+protected:
+    // Calibration is stored once coverage and fit reach these levels.
+    static const uint8_t SAVE_MIN_QUALITY   = 90;
+    static const uint8_t SAVE_MAX_ERROR     = 5;
+
+    void save();
+
+    MagCalibrator   _calibrator;
+    uint32_t        _decimation;
+    uint32_t        _sample_count;
+    MagCalibration  _saved_value;
+    bool            _saved;
+};
+
+
+/** KX64 orientation interface.
+ *
+ * Fusion filter runs on every sample, orientation is published
+ * together with the measurement notifications.
+ */
+class Kx64OrientationSensor : public Sensor<Orientation> {
+public:
+    Kx64OrientationSensor() : _filter(FILTER_TIME_CONSTANT_MS) {}
+
+    virtual void start(EventQueue& ev_queue) {}
+
+    /** Process accelerometer and calibrated magnetometer samples.
+     */
+    void process(const Kx64Value *samples, uint32_t count);
+
+    /** Calculate and publish current orientation.
+     */
+    void publish();
+
+    /** Set sampling rate.
+     *
+     * @param rate_mhz sampling rate in samples per 1000 seconds
+     */
+    void set_sample_rate(uint32_t rate_mhz) { _filter.set_sample_rate(rate_mhz); }
+
+protected:
+    static const uint32_t FILTER_TIME_CONSTANT_MS = 200;
+
+    OrientationFilter   _filter;
 };
 
 
@@ -112,16 +417,72 @@ public:
      * @param spi SPI bus to use
      * @param cs CS/SS pin to use to select sensor on a bus
      */
-    Kx64Sensor(SPI &spi, PinName cs) : _driver(spi, cs) {}
+    Kx64Sensor(SPI &spi, PinName cs) :
+        _driver(spi, cs),
+        _config_actuator(*this),
+        _ev_queue(NULL),
+        _event_id(0),
+        _watermark(1),
+        _polls_per_notify(1),
+        _poll_count(0)
+    {}
 
     /** Schedule measurement process.
      */
     virtual void start(EventQueue& ev_queue);
 
+    /** Change sensor configuration and retune FIFO watermark and polling.
+     *
+     * @param config new configuration
+     * @returns 0 when success, (-1) when not
+     */
+    int configure(const Kx64Config& config);
+
+    /** Get configuration interface.
+     */
+    Actuator<Kx64Config>& get_config() { return _config_actuator; }
+
+    /** Get motion features interface.
+     */
+    Sensor<MotionFeatures>& get_features() { return _features; }
+
+    /** Get vibration spectrum interface.
+     */
+    Sensor<SpectrumPeaks>& get_spectrum() { return _spectrum; }
+
+    /** Get magnetometer calibration interface.
+     */
+    Actuator<MagCalibration>& get_mag_calibration() { return _mag_calibration; }
+
+    /** Get orientation interface.
+     */
+    Sensor<Orientation>& get_orientation() { return _orientation; }
+
 protected:
+    // Notifications are sent no faster than this, regardless of data rate.
+    static const uint32_t NOTIFY_PERIOD_MS      = 500;
+    static const uint32_t MIN_POLL_PERIOD_MS    = 10;
+    static const uint32_t FEATURE_WINDOW_MS     = 1000;
+    static const uint32_t MAG_CALIBRATION_RATE_MHZ = 12500;
+    // Leave FIFO headroom for polling jitter.
+    static const uint32_t MAX_WATERMARK         = Kx64Driver::FIFO_MAX_SAMPLES / 2;
+
     void updater();
+    void schedule(const Kx64Config& config);
 
-    Kx64Driver _driver;
+    Kx64Driver          _driver;
+    Kx64ConfigActuator  _config_actuator;
+    Kx64FeatureSensor   _features;
+    Kx64SpectrumSensor  _spectrum;
+    Kx64MagCalibrationActuator _mag_calibration;
+    Kx64OrientationSensor _orientation;
+    Kx64Config          _config;
+    EventQueue          *_ev_queue;
+    int                 _event_id;
+    uint32_t            _watermark;
+    uint32_t            _polls_per_notify;
+    uint32_t            _poll_count;
+    Kx64Value           _samples[Kx64Driver::FIFO_MAX_SAMPLES];
 };
 
 #endif // KX64_H_
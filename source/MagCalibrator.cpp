@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "MagCalibrator.h"
+
+// Samples are normalized to keep the normal equations well conditioned,
+// Earth field is roughly 250..650 magnetometer units.
+#define NORMALIZATION       (1.0f / 512.0f)
+
+// Forgetting factor, memory of about 1000 samples.
+#define FORGETTING_FACTOR   0.999f
+
+// Minimum number of samples before the first solution.
+#define MIN_SAMPLES         64
+
+// Normal equations are solved every this many samples.
+#define SOLVE_INTERVAL      32
+
+// Fit error averaging constant.
+#define ERROR_FILTER        (1.0f / 64.0f)
+
+
+MagCalibrator::MagCalibrator()
+{
+    reset();
+}
+
+
+void MagCalibrator::reset()
+{
+    memset(_normal, 0, sizeof(_normal));
+    memset(_rhs, 0, sizeof(_rhs));
+    _samples = 0;
+    _coverage = 0;
+    _error = 1.0f;
+    _radius = 0.0f;
+    for (uint32_t i = 0; i < 3; ++i) {
+        _fit.offset[i] = 0;
+        _fit.scale[i] = SCALE_ONE;
+    }
+    _fit.quality = 0;
+    _fit.error = 100;
+    _calibration = _fit;
+    _restored = false;
+}
+
+
+void MagCalibrator::set(const MagCalibration& calibration)
+{
+    _calibration = calibration;
+    _restored = true;
+}
+
+
+bool MagCalibrator::valid(const MagCalibration& calibration)
+{
+    for (uint32_t i = 0; i < 3; ++i) {
+        if ((calibration.scale[i] < MIN_SCALE) || (calibration.scale[i] > MAX_SCALE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool MagCalibrator::add_sample(int16_t x, int16_t y, int16_t z)
+{
+    float v[3] = { x * NORMALIZATION, y * NORMALIZATION, z * NORMALIZATION };
+    float phi[NUM_PARAMS] = { v[0] * v[0], v[1] * v[1], v[2] * v[2], v[0], v[1], v[2] };
+
+    for (uint32_t i = 0; i < NUM_PARAMS; ++i) {
+        for (uint32_t j = i; j < NUM_PARAMS; ++j) {
+            _normal[i][j] = FORGETTING_FACTOR * _normal[i][j] + phi[i] * phi[j];
+        }
+        _rhs[i] = FORGETTING_FACTOR * _rhs[i] + phi[i];
+    }
+
+    update_quality(x, y, z);
+
+    ++_samples;
+    if ((_samples >= MIN_SAMPLES) && ((_samples % SOLVE_INTERVAL) == 0)) {
+        return solve();
+    }
+    return false;
+}
+
+
+// Direction coverage and fit error, both calculated using the estimator's fit.
+void MagCalibrator::update_quality(int16_t x, int16_t y, int16_t z)
+{
+    apply(_fit, x, y, z);
+
+    int32_t v[3] = { x, y, z };
+    uint32_t ax[3] = { (uint32_t)abs(v[0]), (uint32_t)abs(v[1]), (uint32_t)abs(v[2]) };
+
+    // Bin = dominant axis and its sign (cube face), split by signs of the other two.
+    uint32_t dom = (ax[0] >= ax[1]) ? ((ax[0] >= ax[2]) ? 0 : 2) : ((ax[1] >= ax[2]) ? 1 : 2);
+    uint32_t bin = dom * 8 +
+                   ((v[dom] < 0) ? 4 : 0) +
+                   ((v[(dom + 1) % 3] < 0) ? 2 : 0) +
+                   ((v[(dom + 2) % 3] < 0) ? 1 : 0);
+    _coverage |= 1UL << bin;
+
+    uint32_t bins = 0;
+    for (uint32_t mask = _coverage; mask; mask &= mask - 1) {
+        ++bins;
+    }
+    _fit.quality = (uint8_t)(bins * 100 / NUM_BINS);
+
+    if (_radius > 0.0f) {
+        float r = sqrtf((float)v[0] * v[0] + (float)v[1] * v[1] + (float)v[2] * v[2]);
+        _error += ERROR_FILTER * (fabsf(r - _radius) / _radius - _error);
+        float percent = _error * 100.0f;
+        _fit.error = (percent > 100.0f) ? 100 : (uint8_t)percent;
+    }
+    if (!_restored) {
+        _calibration.quality = _fit.quality;
+        _calibration.error = _fit.error;
+    }
+}
+
+
+// Solves normal equations by Gaussian elimination with partial pivoting
+// and converts ellipsoid coefficients to offsets and scales. Restored
+// calibration stays in use until the fit beats it.
+bool MagCalibrator::solve()
+{
+    float m[NUM_PARAMS][NUM_PARAMS + 1];
+    float a[NUM_PARAMS];
+
+    for (uint32_t i = 0; i < NUM_PARAMS; ++i) {
+        for (uint32_t j = 0; j < NUM_PARAMS; ++j) {
+            m[i][j] = (j >= i) ? _normal[i][j] : _normal[j][i];
+        }
+        m[i][NUM_PARAMS] = _rhs[i];
+    }
+
+    for (uint32_t col = 0; col < NUM_PARAMS; ++col) {
+        uint32_t pivot = col;
+        for (uint32_t row = col + 1; row < NUM_PARAMS; ++row) {
+            if (fabsf(m[row][col]) > fabsf(m[pivot][col])) {
+                pivot = row;
+            }
+        }
+        if (fabsf(m[pivot][col]) < 1e-9f) {
+            return false;
+        }
+        if (pivot != col) {
+            for (uint32_t j = 0; j <= NUM_PARAMS; ++j) {
+                float t = m[col][j];
+                m[col][j] = m[pivot][j];
+                m[pivot][j] = t;
+            }
+        }
+        for (uint32_t row = col + 1; row < NUM_PARAMS; ++row) {
+            float f = m[row][col] / m[col][col];
+            for (uint32_t j = col; j <= NUM_PARAMS; ++j) {
+                m[row][j] -= f * m[col][j];
+            }
+        }
+    }
+    for (int32_t i = NUM_PARAMS - 1; i >= 0; --i) {
+        float sum = m[i][NUM_PARAMS];
+        for (uint32_t j = i + 1; j < NUM_PARAMS; ++j) {
+            sum -= m[i][j] * a[j];
+        }
+        a[i] = sum / m[i][i];
+    }
+
+    // Ellipsoid must be real and closed.
+    if ((a[0] <= 0.0f) || (a[1] <= 0.0f) || (a[2] <= 0.0f)) {
+        return false;
+    }
+
+    float center[3];
+    float g = 1.0f;
+    for (uint32_t i = 0; i < 3; ++i) {
+        center[i] = -a[i + 3] / (2.0f * a[i]);
+        g += a[i] * center[i] * center[i];
+    }
+
+    float radius[3];
+    for (uint32_t i = 0; i < 3; ++i) {
+        radius[i] = sqrtf(g / a[i]) / NORMALIZATION;
+    }
+    // Reference radius keeps the field magnitude in magnetometer units.
+    float reference = cbrtf(radius[0] * radius[1] * radius[2]);
+
+    for (uint32_t i = 0; i < 3; ++i) {
+        float offset = center[i] / NORMALIZATION;
+        float scale = reference / radius[i] * SCALE_ONE;
+        if ((fabsf(offset) > INT16_MAX) || (scale < MIN_SCALE) || (scale > MAX_SCALE)) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < 3; ++i) {
+        _fit.offset[i] = (int16_t)lroundf(center[i] / NORMALIZATION);
+        _fit.scale[i] = (uint16_t)lroundf(reference / radius[i] * SCALE_ONE);
+    }
+    _radius = reference;
+
+    if (_restored && !better(_fit, _calibration)) {
+        return false;
+    }
+    _calibration = _fit;
+    _restored = false;
+    return true;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MAG_CALIBRATOR_H_
+#define MAG_CALIBRATOR_H_
+
+#include <stdint.h>
+
+
+/** Magnetometer hard-iron (offset) and soft-iron (scale) calibration.
+ * When this matches format of the sensor characteristic then
+ * no conversion is needed.
+ */
+struct MagCalibration {
+    int16_t     offset[3];  //<! hard-iron offset per axis, magnetometer units
+    uint16_t    scale[3];   //<! soft-iron scale per axis, Q12 (4096 = 1.0)
+    uint8_t     quality;    //<! rotation coverage seen by the estimator, percent
+    uint8_t     error;      //<! fit error of the calibrated field magnitude, percent
+};
+
+
+/** Online magnetometer calibration.
+ *
+ * Fits an axis-aligned ellipsoid a1*x^2 + a2*y^2 + a3*z^2 + a4*x + a5*y + a6*z = 1
+ * to the incoming samples. Normal equations are accumulated with exponential
+ * forgetting at constant cost per sample and solved periodically.
+ *
+ * A calibration set from outside is kept until the estimator's own fit
+ * is better.
+ */
+class MagCalibrator {
+public:
+    static const uint16_t SCALE_ONE = 4096;
+    // Soft-iron scales outside this range mean a broken fit or sensor.
+    static const uint16_t MIN_SCALE = SCALE_ONE / 4;
+    static const uint16_t MAX_SCALE = SCALE_ONE * 4;
+
+public:
+    MagCalibrator();
+
+    /** Restart estimation and remove correction.
+     */
+    void reset();
+
+    /** Set calibration, e.g. restored from non-volatile storage.
+     * Its quality and error are compared with the estimator's fit.
+     */
+    void set(const MagCalibration& calibration);
+
+    /** Check that all scales are within range.
+     */
+    static bool valid(const MagCalibration& calibration);
+
+    /** Check whether calibration a fits better than b.
+     *
+     * @returns true when a is not worse in coverage and error and better in one of them
+     */
+    static bool better(const MagCalibration& a, const MagCalibration& b)
+    {
+        return ((a.quality >= b.quality) && (a.error <= b.error)) &&
+               ((a.quality > b.quality) || (a.error < b.error));
+    }
+
+    /** Get current calibration.
+     */
+    const MagCalibration& get() const { return _calibration; }
+
+    /** Feed raw magnetometer sample to the estimator.
+     *
+     * @returns true when the calibration has been updated
+     */
+    bool add_sample(int16_t x, int16_t y, int16_t z);
+
+    /** Apply calibration to a raw sample.
+     */
+    void apply(int16_t &x, int16_t &y, int16_t &z) const
+    {
+        apply(_calibration, x, y, z);
+    }
+
+protected:
+    static const uint32_t NUM_PARAMS = 6;
+    static const uint32_t NUM_BINS = 24;
+
+    static int16_t correct(const MagCalibration& calibration, int16_t value, uint32_t axis)
+    {
+        int32_t v = (((int32_t)value - calibration.offset[axis]) * calibration.scale[axis]) >> 12;
+        return (v > INT16_MAX) ? INT16_MAX : (v < INT16_MIN) ? INT16_MIN : (int16_t)v;
+    }
+
+    static void apply(const MagCalibration& calibration, int16_t &x, int16_t &y, int16_t &z)
+    {
+        x = correct(calibration, x, 0);
+        y = correct(calibration, y, 1);
+        z = correct(calibration, z, 2);
+    }
+
+    bool solve();
+    void update_quality(int16_t x, int16_t y, int16_t z);
+
+protected:
+    float           _normal[NUM_PARAMS][NUM_PARAMS];    // upper triangle used
+    float           _rhs[NUM_PARAMS];
+    uint32_t        _samples;
+    uint32_t        _coverage;                          // direction bins seen, bit mask
+    float           _error;
+    float           _radius;
+    MagCalibration  _fit;                               // estimator's own solution
+    MagCalibration  _calibration;                       // in use
+    bool            _restored;                          // set from outside, not yet beaten by the fit
+};
+
+
+#endif // MAG_CALIBRATOR_H_
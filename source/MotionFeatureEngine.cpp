@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "MotionFeatureEngine.h"
+#include "FixedPoint.h"
+
+using namespace fixed_point;
+
+
+MotionFeatureEngine::MotionFeatureEngine(uint32_t window, int32_t shock_threshold, int32_t shock_release) :
+    _shock_threshold_sq((uint64_t)((int64_t)shock_threshold * shock_threshold)),
+    _shock_release_sq((uint64_t)((int64_t)shock_release * shock_release)),
+    _shock_armed(true)
+{
+    memset(&_features, 0, sizeof(_features));
+    set_window(window);
+}
+
+
+void MotionFeatureEngine::set_window(uint32_t window)
+{
+    if (window < MIN_WINDOW) {
+        window = MIN_WINDOW;
+    } else if (window > MAX_WINDOW) {
+        window = MAX_WINDOW;
+    }
+    _window = window;
+    reset();
+}
+
+
+void MotionFeatureEngine::reset()
+{
+    for (uint32_t i = 0; i < 3; ++i) {
+        _axis[i].sum = 0;
+        _axis[i].sum_sq = 0;
+        _axis[i].min = INT16_MAX;
+        _axis[i].max = INT16_MIN;
+    }
+    _count = 0;
+    _shocks = 0;
+}
+
+
+bool MotionFeatureEngine::add_sample(int16_t x, int16_t y, int16_t z)
+{
+    const int16_t sample[3] = { x, y, z };
+
+    for (uint32_t i = 0; i < 3; ++i) {
+        AxisAccumulator &a = _axis[i];
+        int32_t v = sample[i];
+
+        a.sum += v;
+        a.sum_sq += (uint32_t)(v * v);
+        if (v < a.min) {
+            a.min = v;
+        }
+        if (v > a.max) {
+            a.max = v;
+        }
+    }
+
+    // Shock detector with hysteresis, compares squared magnitudes to avoid sqrt.
+    uint64_t magnitude_sq = (uint64_t)((int32_t)x * x) + (uint32_t)((int32_t)y * y) + (uint32_t)((int32_t)z * z);
+    if (_shock_armed) {
+        if (magnitude_sq > _shock_threshold_sq) {
+            ++_shocks;
+            _shock_armed = false;
+        }
+    } else if (magnitude_sq < _shock_release_sq) {
+        _shock_armed = true;
+    }
+
+    if (++_count >= _window) {
+        calculate();
+        reset();
+        return true;
+    }
+    return false;
+}
+
+
+void MotionFeatureEngine::calculate()
+{
+    int32_t mean[3];
+
+    for (uint32_t i = 0; i < 3; ++i) {
+        AxisAccumulator &a = _axis[i];
+
+        mean[i] = a.sum / (int32_t)_count;
+
+        // AC RMS: variance around the mean, gravity does not contribute.
+        int64_t variance = (int64_t)(a.sum_sq / _count) - (int64_t)mean[i] * mean[i];
+        uint32_t rms = isqrt(variance > 0 ? (uint64_t)variance : 0);
+        _features.rms[i] = (rms > UINT16_MAX) ? UINT16_MAX : (uint16_t)rms;
+
+        _features.peak_to_peak[i] = (uint16_t)((int32_t)a.max - a.min);
+
+        int32_t peak = a.max - mean[i];
+        if ((mean[i] - a.min) > peak) {
+            peak = mean[i] - a.min;
+        }
+        uint32_t crest = rms ? (uint32_t)peak * 10 / rms : 0;
+        _features.crest[i] = (crest > UINT8_MAX) ? UINT8_MAX : (uint8_t)crest;
+    }
+
+    // Tilt is calculated from the mean (gravity) vector.
+    uint32_t yz = isqrt((uint64_t)((int64_t)mean[1] * mean[1]) + (uint64_t)((int64_t)mean[2] * mean[2]));
+    _features.pitch = atan2_cdeg(-mean[0], (int32_t)yz);
+    _features.roll = atan2_cdeg(mean[1], mean[2]);
+
+    _features.shocks = (_shocks > UINT8_MAX) ? UINT8_MAX : (uint8_t)_shocks;
+}
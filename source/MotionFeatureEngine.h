@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MOTION_FEATURE_ENGINE_H_
+#define MOTION_FEATURE_ENGINE_H_
+
+#include <stdint.h>
+
+
+/** Motion features calculated over a window of accelerometer samples.
+ *
+ * This definition does not match characteristic binary data definition
+ * and needs converter to be implemented.
+ */
+struct MotionFeatures {
+    uint16_t    rms[3];             //<! AC RMS per axis (X, Y, Z), acceleration units
+    uint16_t    peak_to_peak[3];    //<! peak-to-peak per axis, acceleration units
+    uint8_t     crest[3];           //<! crest factor per axis, 0.1 units, saturated
+    int16_t     pitch;              //<! pitch angle, 0.01 deg
+    int16_t     roll;               //<! roll angle, 0.01 deg
+    uint8_t     shocks;             //<! number of shocks detected in the window, saturated
+};
+
+
+/** Integer-only vibration and tilt feature extraction.
+ *
+ * Each sample updates running sums, extremes and the shock detector
+ * at a constant cost. Features are calculated once per window.
+ */
+class MotionFeatureEngine {
+public:
+    static const uint32_t MIN_WINDOW = 4;
+    static const uint32_t MAX_WINDOW = 65535;
+
+public:
+    /** Create feature engine.
+     *
+     * @param window number of samples in a window
+     * @param shock_threshold acceleration magnitude triggering shock detection
+     * @param shock_release acceleration magnitude below which detector re-arms
+     */
+    MotionFeatureEngine(uint32_t window, int32_t shock_threshold, int32_t shock_release);
+
+    /** Change window length. Discards partially collected window.
+     *
+     * @param window number of samples in a window
+     */
+    void set_window(uint32_t window);
+
+    /** Add accelerometer sample.
+     *
+     * @returns true when the window is complete and new features are available
+     */
+    bool add_sample(int16_t x, int16_t y, int16_t z);
+
+    /** Get features calculated over the last complete window.
+     */
+    const MotionFeatures& get_features() const { return _features; }
+
+protected:
+    struct AxisAccumulator {
+        int32_t     sum;
+        uint64_t    sum_sq;
+        int16_t     min;
+        int16_t     max;
+    };
+
+    void reset();
+    void calculate();
+
+protected:
+    AxisAccumulator _axis[3];
+    uint32_t        _window;
+    uint32_t        _count;
+    uint64_t        _shock_threshold_sq;
+    uint64_t        _shock_release_sq;
+    bool            _shock_armed;
+    uint32_t        _shocks;
+    MotionFeatures  _features;
+};
+
+
+#endif // MOTION_FEATURE_ENGINE_H_
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mbed.h>
+#include "NvStorage.h"
+
+#define NV_RECORD_MAGIC     0x5351564EUL    // 'SQVN'
+
+#define NV_STORAGE_START    MBED_CONF_APP_NV_STORAGE_START
+#define NV_STORAGE_SIZE     MBED_CONF_APP_NV_STORAGE_SIZE
+
+#if defined(MBED_APP_START) && defined(MBED_APP_SIZE)
+#if NV_STORAGE_START < (MBED_APP_START + MBED_APP_SIZE)
+#error "NvStorage region overlaps the application ROM, reduce target.mbed_app_size"
+#endif
+#endif
+
+#if defined(__GNUC__) && !defined(__ARMCC_VERSION)
+// GCC_ARM linker script symbols, initialized data image is stored after the code.
+extern uint32_t __etext;
+extern uint32_t __data_start__;
+extern uint32_t __data_end__;
+#define APP_IMAGE_END       ((uintptr_t)&__etext + ((uintptr_t)&__data_end__ - (uintptr_t)&__data_start__))
+#endif
+
+#ifdef MBED_DEBUG
+static uint32_t store_max_us_stat = 0;
+#endif // MBED_DEBUG
+
+
+static uint8_t page_buffer[NvStorage::MAX_RECORD_SIZE];
+
+
+int NvStorage::init()
+{
+    FlashIAP flash;
+    int result = -1;
+
+    if (flash.init() == 0) {
+        if (region_is_valid(flash)) {
+            result = 0;
+        }
+        flash.deinit();
+    }
+    return result;
+}
+
+
+/** CM0+ image is placed at the start of flash, before the application,
+ * so a region above the application image does not overlap either.
+ */
+bool NvStorage::region_is_valid(FlashIAP &flash)
+{
+    uint32_t flash_start = flash.get_flash_start();
+    uint32_t flash_end = flash_start + flash.get_flash_size();
+    uint32_t sector_size = flash.get_sector_size(NV_STORAGE_START);
+
+    if ((NV_STORAGE_START < flash_start) ||
+        (NV_STORAGE_SIZE > flash_end - NV_STORAGE_START) ||
+        ((NV_STORAGE_START - flash_start) % sector_size != 0) ||
+        (SLOT_NUM * sector_size > NV_STORAGE_SIZE)) {
+        return false;
+    }
+#ifdef APP_IMAGE_END
+    if (NV_STORAGE_START < APP_IMAGE_END) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+
+uint32_t NvStorage::slot_address(FlashIAP &flash, Slot slot)
+{
+    return NV_STORAGE_START + slot * flash.get_sector_size(NV_STORAGE_START);
+}
+
+
+// Fletcher-16 checksum.
+uint16_t NvStorage::checksum(const uint8_t *data, uint32_t length)
+{
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+
+    while (length--) {
+        sum1 = (sum1 + *data++) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
+
+
+int NvStorage::load(Slot slot, void *data, uint32_t length)
+{
+    FlashIAP flash;
+    Header header;
+    int result = -1;
+
+    if ((slot >= SLOT_NUM) || (length + sizeof(Header) > MAX_RECORD_SIZE)) {
+        return -1;
+    }
+
+    if (flash.init() == 0) {
+        uint32_t address = slot_address(flash, slot);
+        if (region_is_valid(flash) &&
+            (flash.read(&header, address, sizeof(header)) == 0) &&
+            (header.magic == NV_RECORD_MAGIC) &&
+            (header.length == length) &&
+            (flash.read(data, address + sizeof(header), length) == 0) &&
+            (header.checksum == checksum((const uint8_t *)data, length))) {
+            result = 0;
+        }
+        flash.deinit();
+    }
+    return result;
+}
+
+
+int NvStorage::store(Slot slot, const void *data, uint32_t length)
+{
+    FlashIAP flash;
+    Header header;
+    int result = -1;
+
+    if ((slot >= SLOT_NUM) || (length + sizeof(Header) > MAX_RECORD_SIZE)) {
+        return -1;
+    }
+
+    if (flash.init() == 0) {
+        uint32_t address = slot_address(flash, slot);
+        uint32_t page_size = flash.get_page_size();
+        uint32_t program_size = (length + sizeof(header) + page_size - 1) / page_size * page_size;
+
+        if (region_is_valid(flash) && (program_size <= MAX_RECORD_SIZE)) {
+#ifdef MBED_DEBUG
+            Timer timer;
+            timer.start();
+#endif // MBED_DEBUG
+            header.magic = NV_RECORD_MAGIC;
+            header.length = length;
+            header.checksum = checksum((const uint8_t *)data, length);
+
+            memset(page_buffer, flash.get_erase_value(), program_size);
+            memcpy(page_buffer, &header, sizeof(header));
+            memcpy(page_buffer + sizeof(header), data, length);
+
+            if ((flash.erase(address, flash.get_sector_size(address)) == 0) &&
+                (flash.program(page_buffer, address, program_size) == 0)) {
+                result = 0;
+            }
+#ifdef MBED_DEBUG
+            if ((uint32_t)timer.read_us() > store_max_us_stat) {
+                store_max_us_stat = timer.read_us();
+            }
+#endif // MBED_DEBUG
+        }
+        flash.deinit();
+    }
+    return result;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NV_STORAGE_H_
+#define NV_STORAGE_H_
+
+#include <stdint.h>
+#include <mbed.h>
+
+
+/** Non-volatile storage of small parameter records.
+ *
+ * Each slot occupies one flash sector of the region reserved by the
+ * nv-storage-start and nv-storage-size configuration options. The application
+ * ROM region (target.mbed_app_start and target.mbed_app_size) ends below it,
+ * so the linker keeps the image out of the region.
+ */
+class NvStorage {
+public:
+    enum Slot {
+        SLOT_MAG_CALIBRATION = 0,
+        SLOT_NUM
+    };
+
+    // Largest record that can be stored, including header.
+    static const uint32_t MAX_RECORD_SIZE = 512;
+
+public:
+    /** Check the reserved region. Records are neither loaded nor stored
+     * when it fails.
+     *
+     * @returns 0 when valid, (-1) when the region is outside the internal
+     *          flash, not sector aligned, too small for all slots or
+     *          overlapping the application image
+     */
+    static int init();
+
+    /** Load record from a slot.
+     *
+     * @param slot slot to read
+     * @param data buffer for the record
+     * @param length expected record length
+     * @returns 0 when valid record has been loaded, (-1) when not
+     */
+    static int load(Slot slot, void *data, uint32_t length);
+
+    /** Store record in a slot.
+     *
+     * This erases and programs one flash sector, so the calling thread
+     * (the event queue) is blocked for the flash row write time, 16 ms
+     * typical on PSoC 6. Maximum measured time is kept in debug builds.
+     *
+     * @param slot slot to write
+     * @param data record to store
+     * @param length record length
+     * @returns 0 when success, (-1) when not
+     */
+    static int store(Slot slot, const void *data, uint32_t length);
+
+protected:
+    struct Header {
+        uint32_t    magic;
+        uint16_t    length;
+        uint16_t    checksum;
+    };
+
+    static bool region_is_valid(FlashIAP &flash);
+    static uint32_t slot_address(FlashIAP &flash, Slot slot);
+    static uint16_t checksum(const uint8_t *data, uint32_t length);
+};
+
+
+#endif // NV_STORAGE_H_
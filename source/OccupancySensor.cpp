@@ -290,7 +290,7 @@ void PirDriver::_data_processing_thread_func()
 void OccupancySensor::updater()
 {
     if (_started) {
-        if (_driver.read(_value) == PirDriver::STATUS_OK) {
+        if (_driver.read(_value.level) == PirDriver::STATUS_OK) {
             update_notify();
         }
     } else {
@@ -304,6 +304,8 @@ void OccupancySensor::updater()
  */
 void OccupancySensor::start(EventQueue& ev_queue)
 {
+    // Sampling starts as soon as the queue is dispatched, not after the first period.
+    ev_queue.call(callback(this, &OccupancySensor::updater));
     ev_queue.call_every(1000, callback(this, &OccupancySensor::updater));
 }
 
@@ -21,6 +21,29 @@
 #include <mbed.h>
 #include <Sensor.h>
 
+
+namespace sequana {
+
+/** Occupancy detected by the PIR sensor.
+ */
+struct OccupancyValue {
+    uint8_t     level;          //<! detection level, 0 when no motion
+};
+
+
+/** Occupancy level is notified only when it changes.
+ */
+template <> struct NotifyFilter<OccupancyValue> {
+    static const uint32_t MAX_SILENCE_MS = 60000;
+
+    static bool changed(const OccupancyValue& value, const OccupancyValue& notified)
+    {
+        return value.level != notified.level;
+    }
+};
+
+} //namespace
+
 /** Driver and sensor implementation for PIR-based occupancy sensor.
  */
 
@@ -151,7 +174,7 @@ protected:
 
 /** Occupancy (PIR) sensor interface.
  */
-class OccupancySensor : public Sensor<uint8_t> {
+class OccupancySensor : public Sensor<sequana::OccupancyValue> {
 public:
     /** Creates and initializes sensor interface.
      *
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include "OrientationFilter.h"
+
+
+static inline void cross(const float a[3], const float b[3], float out[3])
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static inline bool normalize(float v[3])
+{
+    float norm = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    if (norm < 1e-6f) {
+        return false;
+    }
+    v[0] /= norm;
+    v[1] /= norm;
+    v[2] /= norm;
+    return true;
+}
+
+static inline int16_t to_q14(float value)
+{
+    float scaled = value * OrientationFilter::QUATERNION_ONE;
+    if (scaled > INT16_MAX) {
+        return INT16_MAX;
+    } else if (scaled < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t)lroundf(scaled);
+}
+
+
+OrientationFilter::OrientationFilter(uint32_t time_constant_ms) :
+    _time_constant_ms(time_constant_ms),
+    _alpha(1.0f),
+    _initialized(false)
+{
+}
+
+
+void OrientationFilter::set_sample_rate(uint32_t rate_mhz)
+{
+    // First order low-pass: alpha = 1 - exp(-dt / tau)
+    float dt_ms = 1000000.0f / rate_mhz;
+    _alpha = 1.0f - expf(-dt_ms / _time_constant_ms);
+}
+
+
+void OrientationFilter::add_sample(int16_t ax, int16_t ay, int16_t az, int16_t mx, int16_t my, int16_t mz)
+{
+    if (!_initialized) {
+        _gravity[0] = ax;
+        _gravity[1] = ay;
+        _gravity[2] = az;
+        _field[0] = mx;
+        _field[1] = my;
+        _field[2] = mz;
+        _initialized = true;
+        return;
+    }
+
+    _gravity[0] += _alpha * (ax - _gravity[0]);
+    _gravity[1] += _alpha * (ay - _gravity[1]);
+    _gravity[2] += _alpha * (az - _gravity[2]);
+    _field[0] += _alpha * (mx - _field[0]);
+    _field[1] += _alpha * (my - _field[1]);
+    _field[2] += _alpha * (mz - _field[2]);
+}
+
+
+// Builds NED axes in device coordinates from the filtered vectors
+// (accelerometer at rest measures the upward reaction to gravity)
+// and converts the resulting rotation matrix to a quaternion.
+bool OrientationFilter::get_orientation(Orientation &orientation) const
+{
+    float down[3] = { -_gravity[0], -_gravity[1], -_gravity[2] };
+    float field[3] = { _field[0], _field[1], _field[2] };
+    float east[3];
+    float north[3];
+
+    if (!_initialized || !normalize(down) || !normalize(field)) {
+        return false;
+    }
+    cross(down, field, east);
+    if (!normalize(east)) {
+        return false;
+    }
+    cross(east, down, north);
+
+    // Rows of the device to NED rotation matrix are north, east and down.
+    float trace = north[0] + east[1] + down[2];
+    float w, x, y, z;
+
+    if (trace > 0.0f) {
+        float s = 2.0f * sqrtf(trace + 1.0f);
+        w = 0.25f * s;
+        x = (down[1] - east[2]) / s;
+        y = (north[2] - down[0]) / s;
+        z = (east[0] - north[1]) / s;
+    } else if ((north[0] > east[1]) && (north[0] > down[2])) {
+        float s = 2.0f * sqrtf(1.0f + north[0] - east[1] - down[2]);
+        w = (down[1] - east[2]) / s;
+        x = 0.25f * s;
+        y = (north[1] + east[0]) / s;
+        z = (north[2] + down[0]) / s;
+    } else if (east[1] > down[2]) {
+        float s = 2.0f * sqrtf(1.0f + east[1] - north[0] - down[2]);
+        w = (north[2] - down[0]) / s;
+        x = (north[1] + east[0]) / s;
+        y = 0.25f * s;
+        z = (east[2] + down[1]) / s;
+    } else {
+        float s = 2.0f * sqrtf(1.0f + down[2] - north[0] - east[1]);
+        w = (east[0] - north[1]) / s;
+        x = (north[2] + down[0]) / s;
+        y = (east[2] + down[1]) / s;
+        z = 0.25f * s;
+    }
+    // Keep the scalar part positive so that the output does not flip sign.
+    if (w < 0.0f) {
+        w = -w;
+        x = -x;
+        y = -y;
+        z = -z;
+    }
+
+    orientation.quaternion[0] = to_q14(w);
+    orientation.quaternion[1] = to_q14(x);
+    orientation.quaternion[2] = to_q14(y);
+    orientation.quaternion[3] = to_q14(z);
+
+    // Device X axis expressed in NED is the first column of the rotation matrix.
+    float heading = atan2f(east[0], north[0]) * (18000.0f / (float)M_PI);
+    if (heading < 0.0f) {
+        heading += 36000.0f;
+    }
+    uint32_t cdeg = (uint32_t)lroundf(heading);
+    orientation.heading = (uint16_t)((cdeg >= 36000) ? 0 : cdeg);
+    return true;
+}
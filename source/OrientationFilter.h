@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ORIENTATION_FILTER_H_
+#define ORIENTATION_FILTER_H_
+
+#include <stdint.h>
+
+
+/** Device orientation relative to the local North-East-Down frame.
+ * When this matches format of the sensor characteristic then
+ * no conversion is needed.
+ */
+struct Orientation {
+    int16_t     quaternion[4];  //<! rotation from device to NED frame (w, x, y, z), Q14
+    uint16_t    heading;        //<! tilt-compensated heading of device X axis, 0.01 deg
+};
+
+
+/** Accelerometer and magnetometer orientation fusion.
+ *
+ * Gravity and magnetic field vectors are low-pass filtered with a common
+ * time constant at the sensor data rate, so that short accelerations and
+ * magnetic noise do not disturb the output. Orientation is calculated from
+ * the filtered vectors only when requested.
+ */
+class OrientationFilter {
+public:
+    static const int16_t QUATERNION_ONE = 16384;
+
+public:
+    /** Create orientation filter.
+     *
+     * @param time_constant_ms filter time constant
+     */
+    OrientationFilter(uint32_t time_constant_ms);
+
+    /** Set sampling rate used to calculate filter coefficient.
+     *
+     * @param rate_mhz sampling rate in samples per 1000 seconds
+     */
+    void set_sample_rate(uint32_t rate_mhz);
+
+    /** Add accelerometer and calibrated magnetometer sample.
+     */
+    void add_sample(int16_t ax, int16_t ay, int16_t az, int16_t mx, int16_t my, int16_t mz);
+
+    /** Calculate orientation from the filtered vectors.
+     *
+     * @param[out] orientation calculated orientation
+     * @returns true when success, false when vectors are degenerate
+     */
+    bool get_orientation(Orientation &orientation) const;
+
+protected:
+    uint32_t    _time_constant_ms;
+    float       _alpha;
+    bool        _initialized;
+    float       _gravity[3];
+    float       _field[3];
+};
+
+
+#endif // ORIENTATION_FILTER_H_
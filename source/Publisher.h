@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PUBLISHER_H_
+#define PUBLISHER_H_
+
+#include <mbed.h>
+
+
+/** Fixed size list of consumers of a value.
+ *
+ * Value stays owned by the producer, subscribers receive a reference
+ * to it, so it's computed once and never copied. Subscribers are called
+ * synchronously and must not keep the reference after they return.
+ *
+ * @param T type of the published value
+ * @param N maximum number of subscribers
+ */
+template <typename T, uint32_t N> class Publisher
+{
+public:
+    typedef Callback<void(const T&)> Subscriber;
+
+public:
+    Publisher() : _count(0) {}
+
+    /** Add subscriber, it's called on every publish() from now on.
+     *
+     * @param subscriber function receiving the published value
+     * @returns 0 when added, (-1) when the list is full
+     */
+    int subscribe(Subscriber subscriber)
+    {
+        if (_count >= N) {
+            return -1;
+        }
+        _subscribers[_count++] = subscriber;
+        return 0;
+    }
+
+    /** Pass value to all subscribers.
+     */
+    void publish(const T& value) const
+    {
+        for (uint32_t i = 0; i < _count; ++i) {
+            _subscribers[i](value);
+        }
+    }
+
+    /** Get number of subscribers.
+     */
+    uint32_t get_count() const { return _count; }
+
+protected:
+    Subscriber  _subscribers[N];
+    uint32_t    _count;
+};
+
+
+#endif // PUBLISHER_H_
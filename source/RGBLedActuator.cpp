@@ -38,7 +38,7 @@ void RGBLedActuator::updater()
     }
 
     if (_turning_on) {
-        current_color = get_value().color;
+        current_color = dimmed(get_value().color);
     }
 
 //    printf("RGB LED(%u): %u, %u, %u\n", _current_led, current_color.r, current_color.g, current_color.g);
@@ -54,21 +54,42 @@ void RGBLedActuator::start(EventQueue& ev_queue)
     ev_queue.call_every(400, callback(this, &RGBLedActuator::updater));
 }
 
+BGR24_color_t RGBLedActuator::dimmed(const BGR24_color_t& color) const
+{
+    return BGR24_color_t((uint8_t)((color.b * _brightness) / MAX_BRIGHTNESS),
+                         (uint8_t)((color.g * _brightness) / MAX_BRIGHTNESS),
+                         (uint8_t)((color.r * _brightness) / MAX_BRIGHTNESS));
+}
+
+
+void RGBLedActuator::set_ambient_light(const ComboEnvValue& value)
+{
+    if (value.ambient_light >= FULL_BRIGHTNESS_LUX) {
+        _brightness = MAX_BRIGHTNESS;
+    } else {
+        _brightness = MIN_BRIGHTNESS + (value.ambient_light * (MAX_BRIGHTNESS - MIN_BRIGHTNESS)) / FULL_BRIGHTNESS_LUX;
+    }
+}
+
+
 int RGBLedActuator::set_value(RGBLedValue& value)
 {
+    BGR24_color_t color;
+
     _value = value;
+    color = dimmed(value.color);
     //printf("RGB color received (R/G/B): %u, %u, %u\n", value.color.r, value.color.g, value.color.b);
 
     // Now set the new color for all LEDs that are on.
     if (_turning_on) {
         // Set color of in-phase LEDs
         for (int i = 0; i < _current_led; ++i) {
-            _leds.set_color(i, value.color);
+            _leds.set_color(i, color);
         }
     } else {
         // Set color of out-of-phase LEDs
         for (int i = _current_led; i < NUM_LEDS; ++i) {
-            _leds.set_color(i, value.color);
+            _leds.set_color(i, color);
         }
     }
     _leds.refresh();
@@ -18,6 +18,7 @@
 
 #include <mbed.h>
 #include "Actuator.h"
+#include "ComboEnvSensor.h"
 #include "BD2808.h"
 
 
@@ -42,6 +43,7 @@ struct RGBLedValue {
 /** Sequana RGB LED actuator interface.
  *
  * It allows BLE clients to manipulate the color of RGB LEDs.
+ * LEDs are dimmed in low ambient light when light level is provided.
  */
 class RGBLedActuator : public Actuator<RGBLedValue> {
 protected:
@@ -49,7 +51,8 @@ protected:
 public:
     RGBLedActuator() :
         _turning_on(false),
-        _current_led(NUM_LEDS)
+        _current_led(NUM_LEDS),
+        _brightness(MAX_BRIGHTNESS)
     {
         _leds.set_dma_usage(DMA_USAGE_ALWAYS);
     }
@@ -57,11 +60,23 @@ public:
     virtual void    start(EventQueue& ev_queue);
     virtual int     set_value(RGBLedValue& value);
 
+    /** Adjust brightness to ambient light level, applied from the next LED update.
+     * Subscriber of ComboEnvSensor light updates.
+     */
+    void set_ambient_light(const ComboEnvValue& value);
+
 protected:
+    // Full brightness from office lighting level, down to 1/8 in the dark.
+    static const uint32_t FULL_BRIGHTNESS_LUX = 500;
+    static const uint32_t MAX_BRIGHTNESS = 256;
+    static const uint32_t MIN_BRIGHTNESS = 32;
+
     void updater();
+    BGR24_color_t dimmed(const BGR24_color_t& color) const;
     BD2808  _leds;
     bool    _turning_on;
     uint8_t _current_led;
+    uint32_t _brightness;
 };
 
 
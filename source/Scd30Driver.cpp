@@ -15,175 +15,322 @@
  */
 
 #include <mbed.h>
+#include <string.h>
+#include <math.h>
 #include "Scd30Driver.h"
+#include "Crc8.h"
 
 
-#define MAX_DATA_WORDS      6
+// Measurement: CO2, temperature and humidity, each a float in two words.
+#define MEASUREMENT_WORDS   6
 
 
-/**
- * \file
- * Functions and types for CRC checks.
- *
- * Generated on Thu Jan 31 11:59:42 2019
- * by pycrc v0.9.1, https://pycrc.org
- * using the configuration:
- *  - Width         = 8
- *  - Poly          = 0x31
- *  - XorIn         = 0xff
- *  - ReflectIn     = False
- *  - XorOut        = 0x00
- *  - ReflectOut    = False
- *  - Algorithm     = table-driven
- */
-#include "Scd30_crc.h"     /* include the header file generated with pycrc */
-#include <stdlib.h>
-#include <stdint.h>
+static inline uint8_t GET_LSB(uint16_t value)
+{
+    return (uint8_t)(value & 0xff);
+}
 
+static inline uint8_t GET_MSB(uint16_t value)
+{
+    return (uint8_t)(value >> 8);
+}
 
-/**
- * Static table used for the table_driven implementation.
- */
-static const crc_t crc_table[16] = {
-    0x00, 0x31, 0x62, 0x53, 0xc4, 0xf5, 0xa6, 0x97, 0xb9, 0x88, 0xdb, 0xea, 0x7d, 0x4c, 0x1f, 0x2e
+
+// Setting commands without arguments read the current value.
+const Scd30Driver::Command Scd30Driver::CONFIG_COMMANDS[NUM_CONFIG_COMMANDS] = {
+    CMD_SET_INTERVAL,
+    CMD_SET_ASC,
+    CMD_SET_ALTITUDE,
+    CMD_SET_TEMP_OFFSET
 };
 
 
-static crc_t crc_update(crc_t crc, const void *data, size_t data_len)
+static float words_to_float(uint16_t msw, uint16_t lsw)
 {
-    const unsigned char *d = (const unsigned char *)data;
-    unsigned int tbl_idx;
+    uint32_t raw = ((uint32_t)msw << 16) | lsw;
+    float f;
 
-    while (data_len--) {
-        tbl_idx = (crc >> 4) ^ (*d >> 4);
-        crc = crc_table[tbl_idx & 0x0f] ^ (crc << 4);
-        tbl_idx = (crc >> 4) ^ (*d >> 0);
-        crc = crc_table[tbl_idx & 0x0f] ^ (crc << 4);
-        d++;
-    }
-    return crc & 0xff;
+    memcpy(&f, &raw, sizeof(f));
+    return f;
 }
 
 
-static inline uint8_t GET_LSB(uint16_t value)
+Scd30Driver::Scd30Driver(I2CBus& bus, uint8_t address, PinName rdy) :
+    _bus(bus),
+    _xfer(address, I2CBus::FREQUENCY_STANDARD),
+    _rdy(rdy),
+    _num_words(0),
+    _reading(false),
+    _job(JOB_NONE),
+    _step(0),
+    _config_items(0)
 {
-    return (uint8_t)(value & 0xff);
-}
-
-static inline uint8_t GET_MSB(uint16_t value)
-{
-    return (uint8_t)(value >> 8);
-}
+    memset(&_value, 0, sizeof(_value));
+    _xfer.done = callback(this, &Scd30Driver::on_transfer);
+};
 
 
-Scd30Driver::Status Scd30Driver::_write_command(Command command, uint16_t *args, uint8_t num_args)
+void Scd30Driver::_write_command(Command command, const uint16_t *args, uint8_t num_args, uint8_t num_words)
 {
-    MBED_ASSERT(num_args < MAX_DATA_WORDS);
+    MBED_ASSERT(num_args <= MAX_DATA_WORDS);
+    MBED_ASSERT(num_words <= MAX_DATA_WORDS);
 
     uint32_t len = 0;
 
-    char buffer[2 + 3 * MAX_DATA_WORDS];
-    buffer[len++] = GET_MSB(command);
-    buffer[len++] = GET_LSB(command);
+    _buffer[len++] = GET_MSB(command);
+    _buffer[len++] = GET_LSB(command);
 
     for (uint32_t i = 0; i < num_args; ++i) {
-        crc_t crc = crc_init();
-        buffer[len++] = GET_MSB(args[i]);
-        buffer[len++] = GET_LSB(args[i]);
-        crc = crc_update( crc, &buffer[len - 2], 2);
-        buffer[len++] = crc_finalize(crc);
+        _buffer[len++] = GET_MSB(args[i]);
+        _buffer[len++] = GET_LSB(args[i]);
+        _buffer[len] = SensirionCrc8::calculate(&_buffer[len - 2], 2);
+        ++len;
     }
 
-    return _i2c.write(_address, buffer, len)? STATUS_I2C_ERROR : STATUS_OK;
+    _xfer.tx_data = _buffer;
+    _xfer.tx_length = len;
+    _xfer.rx_length = 0;
+    _num_words = num_words;
+    _reading = false;
+    _bus.submit(_xfer);
 }
 
 
-Scd30Driver::Status Scd30Driver::_read_command(Command command, uint16_t *data, uint8_t num_words)
+void Scd30Driver::_read_response()
 {
-    MBED_ASSERT(num_words < MAX_DATA_WORDS);
-    char cmd_buffer[2];
-    char buffer[3 * MAX_DATA_WORDS] = {0xba, 0xad, 0xca, 0xfe, 0xde,0xbe, 0xce, 0xef};
-    Status status = STATUS_OK;
+    _xfer.tx_length = 0;
+    _xfer.rx_data = _buffer;
+    _xfer.rx_length = 3 * _num_words;
+    _reading = true;
+    _bus.submit(_xfer);
+}
 
-    cmd_buffer[0] = GET_MSB(command);
-    cmd_buffer[1] = GET_LSB(command);
-    int i2c_status = _i2c.write(_address, cmd_buffer, 2);
 
-    if (i2c_status == 0) {
-        i2c_status = _i2c.read(_address, buffer, 3 * num_words);
+void Scd30Driver::on_transfer(int result)
+{
+    if (result != 0) {
+        command_done(_xfer.degraded() ? STATUS_STALLED : STATUS_I2C_ERROR);
+        return;
     }
 
-    /* verify data CRC and copy over the data */
-    if (i2c_status == 0) {
-//        printf("sdc30_read (0x%04x): rcv data: ", command);
-//        for (uint32_t i = 0; i < (3 * num_words); i++) {
-//            printf(" %02x", buffer[i]);
-//        }
-//        printf("\n");
-        for (uint32_t i = 0; i < num_words; ++i) {
+    if (!_reading) {
+        if (_num_words) {
+            // Sensor does not support repeated start, response is read separately.
+            _bus.get_event_queue().call_in(RESPONSE_TIME_MS, callback(this, &Scd30Driver::_read_response));
+            return;
+        }
+    } else {
+        /* verify data CRC and copy over the data */
+        for (uint32_t i = 0; i < _num_words; ++i) {
             uint32_t base = i * 3;
-            crc_t crc = crc_init();
-            crc = crc_update( crc, &buffer[base], 2);
-            crc = crc_finalize(crc);
-            if (crc != buffer[base + 2]) {
-//                printf("scd30: crc_error: data = %02x %02x, cal = %02x, rcv = %02x\n", buffer[base], buffer[base+1], crc, buffer[base + 2]);
-                status = STATUS_CRC_ERROR;
-                break;
+            uint8_t crc = SensirionCrc8::calculate(&_buffer[base], 2);
+            if (crc != (uint8_t)_buffer[base + 2]) {
+                command_done(STATUS_CRC_ERROR);
+                return;
             }
-            *data++ = (uint16_t)((buffer[base] << 8) | (uint8_t)buffer[base + 1]);
+            _words[i] = (uint16_t)((_buffer[base] << 8) | (uint8_t)_buffer[base + 1]);
         }
-    } else {
-        status = STATUS_I2C_ERROR;
     }
+    command_done(STATUS_OK);
+}
 
-    return status;
+
+/** Called when command completes, starts the next step of the operation.
+ */
+void Scd30Driver::command_done(Status status)
+{
+    if (status != STATUS_OK) {
+        finish(status);
+        return;
+    }
+
+    switch (_job) {
+    case JOB_INIT:
+        if (_step++ == 0) {
+            _bus.get_event_queue().call_in(RESET_TIME_MS, callback(this, &Scd30Driver::start_measurement));
+        } else {
+            finish(STATUS_OK);
+        }
+        break;
+
+    case JOB_READ:
+        if (_step++ == 0) {
+            if (_words[0] != DATA_STATUS_READY) {
+                finish(STATUS_NOT_READY);
+            } else {
+                _write_command(CMD_READ_MEASUREMENT, NULL, 0, MEASUREMENT_WORDS);
+            }
+        } else {
+            float co2 = words_to_float(_words[0], _words[1]);
+            float temperature = words_to_float(_words[2], _words[3]);
+            float humidity = words_to_float(_words[4], _words[5]);
+
+            _value.co2 = (co2 > 0.0f) ? (uint32_t)(co2 + 0.5f) : 0;
+            _value.temperature = (int16_t)lroundf(temperature * 100.0f);
+            _value.humidity = (humidity > 0.0f) ? (uint16_t)(humidity * 100.0f + 0.5f) : 0;
+//            printf("scd30: co2=%lu, t=%d, rh=%u\n", _value.co2, _value.temperature, _value.humidity);
+            finish(STATUS_OK);
+        }
+        break;
+
+    case JOB_READ_CONFIG:
+        switch (_step++) {
+        case 0: _config.interval_s = _words[0]; break;
+        case 1: _config.asc = (_words[0] != 0); break;
+        case 2: _config.altitude_m = _words[0]; break;
+        default: _config.temp_offset = _words[0]; break;
+        }
+        if (_step < NUM_CONFIG_COMMANDS) {
+            _write_command(CONFIG_COMMANDS[_step], NULL, 0, 1);
+        } else {
+            _config.frc_ppm = 0;
+            finish(STATUS_OK);
+        }
+        break;
+
+    case JOB_WRITE_CONFIG:
+        // Setting just written is now in use.
+        switch (_step) {
+        case CONFIG_INTERVAL: _config.interval_s = _new_config.interval_s; break;
+        case CONFIG_ASC: _config.asc = _new_config.asc; break;
+        case CONFIG_ALTITUDE: _config.altitude_m = _new_config.altitude_m; break;
+        case CONFIG_TEMP_OFFSET: _config.temp_offset = _new_config.temp_offset; break;
+        default: break;
+        }
+        write_next_config();
+        break;
+
+    default:
+        break;
+    }
 }
 
 
-Scd30Driver::Scd30Driver(I2C& bus, uint8_t address) :
-    _i2c(bus), _address(address)
+void Scd30Driver::start_measurement()
 {
-};
+    uint16_t air_pressure = 0;
+
+    _write_command(CMD_START_MEASUREMENT, &air_pressure, 1);
+}
+
+
+void Scd30Driver::write_next_config()
+{
+    static const struct {
+        uint32_t    item;
+        Command     command;
+    } items[] = {
+        { CONFIG_INTERVAL,      CMD_SET_INTERVAL },
+        { CONFIG_ASC,           CMD_SET_ASC },
+        { CONFIG_ALTITUDE,      CMD_SET_ALTITUDE },
+        { CONFIG_TEMP_OFFSET,   CMD_SET_TEMP_OFFSET },
+        { CONFIG_FRC,           CMD_SET_FRC }
+    };
+    uint16_t arg;
+
+    for (uint32_t i = 0; i < sizeof(items) / sizeof(items[0]); ++i) {
+        if (_config_items & items[i].item) {
+            switch (items[i].item) {
+            case CONFIG_INTERVAL: arg = _new_config.interval_s; break;
+            case CONFIG_ASC: arg = _new_config.asc ? 1 : 0; break;
+            case CONFIG_ALTITUDE: arg = _new_config.altitude_m; break;
+            case CONFIG_TEMP_OFFSET: arg = _new_config.temp_offset; break;
+            default: arg = _new_config.frc_ppm; break;
+            }
+            _config_items &= ~items[i].item;
+            _step = items[i].item;
+            _write_command(items[i].command, &arg, 1);
+            return;
+        }
+    }
+    finish(STATUS_OK);
+}
+
+
+void Scd30Driver::finish(Status status)
+{
+    Completion done = _done;
+
+    if (_job == JOB_WRITE_CONFIG) {
+        // Remaining settings are dropped on error.
+        _config_items = 0;
+    }
+    _job = JOB_NONE;
+
+    // Pending configuration goes first, client callback may start a new operation.
+    if (_config_items) {
+        start_job(JOB_WRITE_CONFIG, _config_done);
+        write_next_config();
+    }
+
+    if (done) {
+        done(status);
+    }
+}
+
+
+Scd30Driver::Status Scd30Driver::start_job(Job job, Completion done)
+{
+    if (_job != JOB_NONE) {
+        return STATUS_BUSY;
+    }
+    _job = job;
+    _step = 0;
+    _done = done;
+    return STATUS_OK;
+}
 
 
-Scd30Driver::Status Scd30Driver::read(uint32_t &co2)
+Scd30Driver::Status Scd30Driver::read(Completion done)
 {
     Status status;
-    uint16_t data[2];
-    uint32_t val;
 
-    status = _read_command(CMD_GET_DATA_STATUS, data, 1);
+    if (_rdy.is_connected() && !_rdy.read()) {
+        return STATUS_NOT_READY;
+    }
 
+    status = start_job(JOB_READ, done);
     if (status == STATUS_OK) {
-        if (data[0] == DATA_STATUS_READY) {
-            status = _read_command(CMD_READ_MEASUREMENT, data, 2);
+        if (_rdy.is_connected()) {
+            _step = 1;
+            _write_command(CMD_READ_MEASUREMENT, NULL, 0, MEASUREMENT_WORDS);
         } else {
-            status = STATUS_NOT_READY;
+            _write_command(CMD_GET_DATA_STATUS, NULL, 0, 1);
         }
     }
+    return status;
+}
+
+
+Scd30Driver::Status Scd30Driver::init_chip(Completion done)
+{
+    Status status = start_job(JOB_INIT, done);
 
     if (status == STATUS_OK) {
-        val = (uint32_t)data[0] << 16 | data[1];
-        // convert from float
-        co2 = *(float *)&val;
+        _write_command(CMD_SOFT_RESET, NULL, 0);
     }
-
-//    printf("scd30: raw=%08lx, co2=%u, status = %d\n", val, co2, status);
     return status;
 }
 
 
-void Scd30Driver::init_chip(void)
+Scd30Driver::Status Scd30Driver::read_config(Completion done)
 {
-    Status status;
-    uint16_t air_preasure = 0;
+    Status status = start_job(JOB_READ_CONFIG, done);
 
-    status = _write_command(CMD_SOFT_RESET, &air_preasure, 1);
+    if (status == STATUS_OK) {
+        _write_command(CONFIG_COMMANDS[0], NULL, 0, 1);
+    }
+    return status;
+}
 
-    wait_ms(50);
 
-    status = _write_command(CMD_START_MEASUREMENT, NULL, 0);
+void Scd30Driver::write_config(const Scd30Config& config, uint32_t items, Completion done)
+{
+    _new_config = config;
+    _config_items |= items;
+    _config_done = done;
 
-//    printf("sdc30_init: status = %d\n", status);
+    if (_config_items && (start_job(JOB_WRITE_CONFIG, done) == STATUS_OK)) {
+        write_next_config();
+    }
 }
-
@@ -19,9 +19,52 @@
 
 #include <stdint.h>
 #include <Sensor.h>
+#include "I2CBus.h"
+
+
+/** Complete SCD30 measurement result.
+ */
+struct Scd30Value {
+    uint32_t    co2;            //<! CO2 concentration, ppm
+    int16_t     temperature;    //<! temperature, 0.01 deg C
+    uint16_t    humidity;       //<! relative humidity, 0.01 %
+};
+
+
+/** SCD30 settings selectable by BLE clients.
+ * When this matches format of the sensor characteristic then
+ * no conversion is needed.
+ */
+struct Scd30Config {
+    uint16_t    interval_s;         //<! measurement interval, 2..1800 s
+    uint16_t    frc_ppm;            //<! forced recalibration reference, 400..2000 ppm, 0 when not requested
+    uint16_t    altitude_m;         //<! altitude compensation, m above sea level
+    uint16_t    temp_offset;        //<! temperature offset, 0.01 K
+    uint8_t     asc;                //<! automatic self-calibration enabled
+
+    Scd30Config(const uint8_t *data) :
+        interval_s((uint16_t)(data[0] | (data[1] << 8))),
+        frc_ppm((uint16_t)(data[2] | (data[3] << 8))),
+        altitude_m((uint16_t)(data[4] | (data[5] << 8))),
+        temp_offset((uint16_t)(data[6] | (data[7] << 8))),
+        asc(data[8])
+    {}
+
+    Scd30Config() :
+        interval_s(2),
+        frc_ppm(0),
+        altitude_m(0),
+        temp_offset(0),
+        asc(0)
+    {}
+};
 
 
 /** Driver for Sensirion SCD30 CO2 sensor.
+ *
+ * All operations are asynchronous, only one of them can be in progress
+ * at a time. Configuration changes are queued and applied when the
+ * current operation completes.
  */
 class Scd30Driver {
 public:
@@ -30,24 +73,74 @@ public:
         STATUS_STALLED,
         STATUS_NOT_READY,
         STATUS_I2C_ERROR,
-        STATUS_CRC_ERROR
+        STATUS_CRC_ERROR,
+        STATUS_BUSY
+    };
+
+    /** Settings written by write_config().
+     */
+    enum ConfigItem {
+        CONFIG_INTERVAL     = 0x01,
+        CONFIG_ASC          = 0x02,
+        CONFIG_ALTITUDE     = 0x04,
+        CONFIG_TEMP_OFFSET  = 0x08,
+        CONFIG_FRC          = 0x10
     };
 
+    typedef Callback<void(Status)> Completion;
+
 public:
     /** Create and initialize driver.
      *
      * @param bus I2C bus to use for communication
      * @param address I2C address to use
+     * @param rdy data ready pin, NC when not wired
      */
-    Scd30Driver(I2C& bus, uint8_t address);
+    Scd30Driver(I2CBus& bus, uint8_t address, PinName rdy = NC);
 
-    /** Read measured value from sensor.
+    /** Read measured value from sensor, result is available using get_value().
+     *
+     * Data ready is checked using RDY pin when wired, otherwise
+     * it is polled using the data status command.
+     *
+     * @param done called when operation completes
+     * @returns STATUS_OK when started, STATUS_BUSY when other operation is in progress
      */
-    Status read(uint32_t& co2);
+    Status read(Completion done);
+
+    /** Get value read by the last successful read().
+     */
+    const Scd30Value& get_value() const { return _value; }
 
     /** Initialize chip and start measurement/ conversion cycle.
+     *
+     * @param done called when operation completes
+     * @returns STATUS_OK when started, STATUS_BUSY when other operation is in progress
+     */
+    Status init_chip(Completion done);
+
+    /** Read settings stored in the sensor, result is available using get_config().
+     *
+     * @param done called when operation completes
+     * @returns STATUS_OK when started, STATUS_BUSY when other operation is in progress
+     */
+    Status read_config(Completion done);
+
+    /** Get settings read by the last successful read_config(), frc_ppm is always 0.
      */
-    void init_chip(void);
+    const Scd30Config& get_config() const { return _config; }
+
+    /** Write selected settings, forced recalibration is applied when
+     * CONFIG_FRC is selected.
+     *
+     * When other operation is in progress write is started after it completes.
+     * Settings selected by a pending write are merged.
+     *
+     * @param config new settings
+     * @param items settings to write, combination of ConfigItem values
+     * @param done called when operation completes
+     */
+    void write_config(const Scd30Config& config, uint32_t items, Completion done);
 
 protected:
     enum Command {
@@ -69,13 +162,48 @@ protected:
         DATA_STATUS_READY       = 1
     };
 
+    enum Job {
+        JOB_NONE,
+        JOB_INIT,
+        JOB_READ,
+        JOB_READ_CONFIG,
+        JOB_WRITE_CONFIG
+    };
+
+    static const uint32_t MAX_DATA_WORDS    = 6;
+    // Sensor needs time to prepare response data and to restart after reset.
+    static const uint32_t RESPONSE_TIME_MS  = 3;
+    static const uint32_t RESET_TIME_MS     = 50;
+
+    static const uint32_t NUM_CONFIG_COMMANDS = 4;
+    static const Command CONFIG_COMMANDS[NUM_CONFIG_COMMANDS];
+
 protected:
-    Status _write_command(Command command, uint16_t *args, uint8_t num_args);
-    Status _read_command(Command command, uint16_t *data, uint8_t num_words);
+    Status start_job(Job job, Completion done);
+    void _write_command(Command command, const uint16_t *args, uint8_t num_args, uint8_t num_words = 0);
+    void _read_response();
+    void on_transfer(int result);
+    void command_done(Status status);
+    void start_measurement();
+    void write_next_config();
+    void finish(Status status);
 
 protected:
-    I2C&        _i2c;
-    uint8_t     _address;
+    I2CBus&         _bus;
+    I2CTransaction  _xfer;
+    DigitalIn       _rdy;
+    char            _buffer[2 + 3 * MAX_DATA_WORDS];
+    uint16_t        _words[MAX_DATA_WORDS];
+    uint8_t         _num_words;
+    bool            _reading;
+    Job             _job;
+    uint32_t        _step;
+    Completion      _done;
+    Scd30Value      _value;
+    Scd30Config     _config;
+    Scd30Config     _new_config;
+    uint32_t        _config_items;
+    Completion      _config_done;
 };
 
 
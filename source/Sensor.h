@@ -18,20 +18,79 @@
 #define SENSOR_H_
 
 #include "mbed.h"
+#include "Publisher.h"
+
+namespace sequana {
+
+/** Notification filter traits of a sensor value type.
+ *
+ * By default every update is notified. Specialize for a value type
+ * to suppress updates which don't change the value significantly:
+ * they are not notified until a significant change or until
+ * MAX_SILENCE_MS passes since the last notification.
+ */
+template <typename ValueT> struct NotifyFilter {
+    static const uint32_t MAX_SILENCE_MS = 0;
+
+    /** Check whether value changed significantly since the last notification.
+     */
+    static bool changed(const ValueT&, const ValueT&) { return true; }
+};
+
+
+/** Check whether a field changed by at least both the absolute and
+ * the relative (to the notified value) threshold.
+ *
+ * @param value current field value
+ * @param notified field value sent by the last notification
+ * @param min_change absolute threshold, field units
+ * @param min_change_permille relative threshold, 0.1 %
+ */
+template <typename T> inline bool outside_deadband(T value, T notified, uint32_t min_change,
+                                                   uint32_t min_change_permille = 0)
+{
+    int64_t change = (int64_t)value - (int64_t)notified;
+    int64_t magnitude = (int64_t)notified;
+
+    if (change < 0) {
+        change = -change;
+    }
+    if (magnitude < 0) {
+        magnitude = -magnitude;
+    }
+    return (change >= min_change) && (change * 1000 >= magnitude * min_change_permille);
+}
+
+} //namespace
 
 /** Sensor interface linking sensor BLE characteristic and sensor
  * implementation (driver).
  *
+ * Besides the characteristic, other consumers (loggers, local indication)
+ * can subscribe to value updates. They all receive a reference to the
+ * sensor value, nothing is copied or allocated.
+ *
  * @param ValueT Type representing sensor value. Generally should match
  *               characteristic value data, but conversion can also be
  *               implemented.
  */
 template <typename ValueT> class Sensor
 {
+public:
+    // Characteristic and up to two other consumers.
+    static const uint32_t MAX_SUBSCRIBERS = 3;
+    typedef typename Publisher<ValueT, MAX_SUBSCRIBERS>::Subscriber Subscriber;
+
 public:
     /** Create and initialize sensor interface.
      */
-    Sensor() {}
+    Sensor() :
+        _updater_subscribed(false),
+        _notified(false),
+        _notify_ms(0),
+        _sent_count(0),
+        _suppressed_count(0)
+    {}
 
     /** Get current value of the sensor.
      *
@@ -40,7 +99,7 @@ public:
      *
      * @returns Current sensor value.
      */
-    const ValueT& get_value()
+    const ValueT& get_value() const
     {
         return _value;
     }
@@ -51,13 +110,31 @@ public:
      * and it's supposed to update the BEL characteristic based
      * on the current sensor value.
      *
+     * Characteristic is one of the sensor subscribers.
+     *
      * @param func Callback function called by sensor to update its characteristic value.
      */
     void register_updater(Callback<void()> func)
     {
+        if (!_updater_subscribed && (_subscribers.subscribe(callback(this, &Sensor::call_updater)) == 0)) {
+            _updater_subscribed = true;
+        }
         _on_update = func;
     }
 
+    /** Subscribe to value updates.
+     *
+     * Subscriber is called from the sensor context each time an update
+     * passes the notification filter, it must not keep the reference.
+     *
+     * @param subscriber function receiving the current value
+     * @returns 0 when subscribed, (-1) when there are too many subscribers
+     */
+    int subscribe(Subscriber subscriber)
+    {
+        return _subscribers.subscribe(subscriber);
+    }
+
     /** Start sensor updates.
      *
      * This method is supposed to create and start sensor updating
@@ -67,9 +144,36 @@ public:
      */
     virtual void start(EventQueue& ev_queue) = 0;
 
+    /** Get number of updates passed to subscribers.
+     */
+    uint32_t get_sent_count() const { return _sent_count; }
+
+    /** Get number of updates suppressed by the value type notification filter.
+     */
+    uint32_t get_suppressed_count() const { return _suppressed_count; }
+
 protected:
     void update_notify()
     {
+        typedef sequana::NotifyFilter<ValueT> Filter;
+        uint32_t now_ms = (uint32_t)rtos::Kernel::get_ms_count();
+
+        if (_notified && ((now_ms - _notify_ms) < Filter::MAX_SILENCE_MS) &&
+            !Filter::changed(_value, _notified_value)) {
+            ++_suppressed_count;
+            return;
+        }
+
+        _notified_value = _value;
+        _notified = true;
+        _notify_ms = now_ms;
+        ++_sent_count;
+        _subscribers.publish(_value);
+    }
+
+    void call_updater(const ValueT&)
+    {
+        // Updater may be cleared after subscribing by registering an empty callback.
         if (_on_update) {
             _on_update();
         }
@@ -78,6 +182,13 @@ protected:
 protected:
     ValueT              _value;
     Callback<void()>    _on_update;
+    bool                _updater_subscribed;
+    Publisher<ValueT, MAX_SUBSCRIBERS> _subscribers;
+    ValueT              _notified_value;
+    bool                _notified;
+    uint32_t            _notify_ms;
+    uint32_t            _sent_count;
+    uint32_t            _suppressed_count;
 };
 
 
@@ -38,6 +38,23 @@ static inline uint32_t get_char_id(GattCharacteristic& characteristic)
 #endif // ENABLE_CHAR_TEMPLATE_DEBUG
 
 
+#ifdef MBED_DEBUG
+/** Report time from reset to the first characteristic notification.
+ *
+ * Used to measure startup latency together with the advertising start time.
+ */
+inline void debug_report_first_notification()
+{
+    static bool reported = false;
+
+    if (!reported) {
+        reported = true;
+        printf("First notification at %lu ms\n", (uint32_t)rtos::Kernel::get_ms_count());
+    }
+}
+#endif // MBED_DEBUG
+
+
 /** Public interface to buffer holding characteristic binary value.
  *
  * Default implementation is valid only for constant data length characteristics,
@@ -140,6 +157,9 @@ protected:
             _ble.gattServer().write(get_characteristic()->getValueHandle(),
                                     _buffer.get_ptr(),
                                     _buffer.get_length());
+#ifdef MBED_DEBUG
+            debug_report_first_notification();
+#endif // MBED_DEBUG
         }
     }
 
@@ -286,6 +306,9 @@ protected:
                                        _buffer.get_ptr() + p.offset,
                                        p.length);
             }
+#ifdef MBED_DEBUG
+            debug_report_first_notification();
+#endif // MBED_DEBUG
         }
     }
 
@@ -35,6 +35,16 @@ UUID UUID_PARTICULATE_MATTER_CHAR("F79B4EBB-1B6B-41F2-8D65-D346B4EF5685");
 UUID UUID_OTHER_ENV_CHAR("F79B4EBC-1B6E-41F2-8D65-D346B4EF5685");
 UUID UUID_SEQUANA_INFO_CHAR("F79B4EB9-1B6E-41F2-8D65-D346B4EF5685");
 UUID UUID_OCCUPANCY_CHAR("F79B4EBE-1B6E-41F2-8D65-D346B4EF5685");
+UUID UUID_ACCMAG_CONFIG_CHAR("F79B4EC0-1B6E-41F2-8D65-D346B4EF5685");
+UUID UUID_MOTION_FEATURES_CHAR("F79B4EC1-1B6E-41F2-8D65-D346B4EF5685");
+UUID UUID_VIBRATION_SPECTRUM_CHAR("F79B4EC2-1B6E-41F2-8D65-D346B4EF5685");
+UUID UUID_MAG_CALIBRATION_CHAR("F79B4EC3-1B6E-41F2-8D65-D346B4EF5685");
+UUID UUID_ORIENTATION_CHAR("F79B4EC4-1B6E-41F2-8D65-D346B4EF5685");
+UUID UUID_PARTICULATE_MATTER_EXT_CHAR("F79B4EC5-1B6E-41F2-8D65-D346B4EF5685");
+UUID UUID_PARTICULATE_MATTER_CONFIG_CHAR("F79B4EC6-1B6E-41F2-8D65-D346B4EF5685");
+UUID UUID_AIR_QUALITY_CLIMATE_CHAR("F79B4EC7-1B6E-41F2-8D65-D346B4EF5685");
+UUID UUID_AIR_QUALITY_SCD30_CONFIG_CHAR("F79B4EC8-1B6E-41F2-8D65-D346B4EF5685");
+UUID UUID_LIGHT_COLOR_CHAR("F79B4EC9-1B6E-41F2-8D65-D346B4EF5685");
 
 
 SingleCharParams accMagSensorCharacteristics[2] = {
@@ -62,8 +72,18 @@ static const char version_info[] =
 
 static const char initial_info[SEQUANA_INFO_MAX_LEN] = "";
 
+// Characteristics added by the constructor when every device is present.
+#ifdef TARGET_FUTURE_SEQUANA
+#define ONBOARD_CHARACTERISTICS 8       // KX64 (7), RGB LED
+#else
+#define ONBOARD_CHARACTERISTICS 0
+#endif // TARGET_FUTURE_SEQUANA
+#define SHIELD_CHARACTERISTICS  10      // SPS30 (3), combo (2), light color, air quality, SCD30 (2), occupancy
+#define MAX_CHARACTERISTICS     (ONBOARD_CHARACTERISTICS + SHIELD_CHARACTERISTICS + 1)    // and information
+
 
 PrimaryService::PrimaryService(BLE &ble,
+                               uint32_t devices,
 #ifdef TARGET_FUTURE_SEQUANA
                                Kx64Sensor &kx64,
 #endif //TARGET_FUTURE_SEQUANA
@@ -81,19 +101,31 @@ PrimaryService::PrimaryService(BLE &ble,
         _accMagSensorMeasurement(ble,
                                 accMagSensorCharacteristics,
                                 kx64),
+        _accMagConfig(ble,
+                      UUID_ACCMAG_CONFIG_CHAR,
+                      kx64.get_config()),
+        _motionFeatures(ble,
+                        UUID_MOTION_FEATURES_CHAR,
+                        kx64.get_features()),
+        _vibrationSpectrum(ble,
+                           UUID_VIBRATION_SPECTRUM_CHAR,
+                           kx64.get_spectrum()),
+        _magCalibration(ble,
+                        UUID_MAG_CALIBRATION_CHAR,
+                        kx64.get_mag_calibration()),
+        _orientation(ble,
+                     UUID_ORIENTATION_CHAR,
+                     kx64.get_orientation()),
 #endif //TARGET_FUTURE_SEQUANA
-        _particulateMatterMeasurement(ble,
-                                      UUID_PARTICULATE_MATTER_CHAR,
-                                      sps30),
-        _comboEnvMeasurement(ble,
-                             comboEnvSensorCharacteristics,
-                             combo),
-        _airQMeasurement(ble,
-                         UUID_AIR_QUALITY_CHAR,
-                         airq),
-        _occupancyDetection(ble,
-                            UUID_OCCUPANCY_CHAR,
-                            occupancy),
+        _particulateMatterMeasurement(NULL),
+        _particulateMatterExtended(NULL),
+        _particulateMatterConfig(NULL),
+        _comboEnvMeasurement(NULL),
+        _lightColor(NULL),
+        _airQMeasurement(NULL),
+        _airQClimate(NULL),
+        _airQScd30Config(NULL),
+        _occupancyDetection(NULL),
 #ifdef TARGET_FUTURE_SEQUANA
         _ledState(ble,
                   UUID_RGB_LED_CHAR,
@@ -101,38 +133,96 @@ PrimaryService::PrimaryService(BLE &ble,
 #endif // TARGET_FUTURE_SEQUANA
         _info(UUID_SEQUANA_INFO_CHAR, (char*)initial_info)
 {
-        GattCharacteristic *sequanaChars[] = {
+        GattCharacteristic *sequanaChars[MAX_CHARACTERISTICS];
+        uint32_t count = 0;
+
 #ifdef TARGET_FUTURE_SEQUANA
-             _accMagSensorMeasurement.get_characteristic(0),
-             _accMagSensorMeasurement.get_characteristic(1),
+        sequanaChars[count++] = _accMagSensorMeasurement.get_characteristic(0);
+        sequanaChars[count++] = _accMagSensorMeasurement.get_characteristic(1);
+        sequanaChars[count++] = _accMagConfig.get_characteristic();
+        sequanaChars[count++] = _motionFeatures.get_characteristic();
+        sequanaChars[count++] = _vibrationSpectrum.get_characteristic();
+        sequanaChars[count++] = _magCalibration.get_characteristic();
+        sequanaChars[count++] = _orientation.get_characteristic();
 #endif //TARGET_FUTURE_SEQUANA
-             _particulateMatterMeasurement.get_characteristic(),
-             _comboEnvMeasurement.get_characteristic(0),
-             _comboEnvMeasurement.get_characteristic(1),
-             _airQMeasurement.get_characteristic(),
-             _occupancyDetection.get_characteristic(),
+        if (devices & ShieldProbe::DEVICE_SPS30) {
+            _particulateMatterMeasurement = new SensorCharacteristic<Sps30CharBuffer, Sps30Value>(
+                ble, UUID_PARTICULATE_MATTER_CHAR, sps30);
+            _particulateMatterExtended = new SensorCharacteristic<Sps30ExtendedCharBuffer, Sps30ExtendedValue>(
+                ble, UUID_PARTICULATE_MATTER_EXT_CHAR, sps30.get_extended());
+            _particulateMatterConfig = new ActuatorCharacteristic<Sps30ConfigCharBuffer, Sps30Config>(
+                ble, UUID_PARTICULATE_MATTER_CONFIG_CHAR, sps30.get_config());
+            sequanaChars[count++] = _particulateMatterMeasurement->get_characteristic();
+            sequanaChars[count++] = _particulateMatterExtended->get_characteristic();
+            sequanaChars[count++] = _particulateMatterConfig->get_characteristic();
+        }
+        if (devices & ShieldProbe::COMBO_ENV_DEVICES) {
+            _comboEnvMeasurement = new SensorMultiCharacteristic<2, ComboEnvCharBuffer, ComboEnvValue>(
+                ble, comboEnvSensorCharacteristics, combo);
+            sequanaChars[count++] = _comboEnvMeasurement->get_characteristic(0);
+            sequanaChars[count++] = _comboEnvMeasurement->get_characteristic(1);
+        }
+        if (devices & ShieldProbe::DEVICE_AS7261) {
+            _lightColor = new SensorCharacteristic<LightColorCharBuffer, LightColorValue>(
+                ble, UUID_LIGHT_COLOR_CHAR, combo.get_color());
+            sequanaChars[count++] = _lightColor->get_characteristic();
+        }
+        if (devices & ShieldProbe::AIR_QUALITY_DEVICES) {
+            _airQMeasurement = new SensorCharacteristic<AirQCharBuffer, AirQValue>(
+                ble, UUID_AIR_QUALITY_CHAR, airq);
+            sequanaChars[count++] = _airQMeasurement->get_characteristic();
+        }
+        if (devices & ShieldProbe::DEVICE_SCD30) {
+            _airQClimate = new SensorCharacteristic<AirQClimateCharBuffer, AirQClimateValue>(
+                ble, UUID_AIR_QUALITY_CLIMATE_CHAR, airq.get_climate());
+            _airQScd30Config = new ActuatorCharacteristic<Scd30ConfigCharBuffer, Scd30Config>(
+                ble, UUID_AIR_QUALITY_SCD30_CONFIG_CHAR, airq.get_scd30_config());
+            sequanaChars[count++] = _airQClimate->get_characteristic();
+            sequanaChars[count++] = _airQScd30Config->get_characteristic();
+        }
+        if (devices & ShieldProbe::SHIELD_DEVICES) {
+            _occupancyDetection = new SensorCharacteristic<OccupancyCharBuffer, OccupancyValue>(
+                ble, UUID_OCCUPANCY_CHAR, occupancy);
+            sequanaChars[count++] = _occupancyDetection->get_characteristic();
+        }
 #ifdef TARGET_FUTURE_SEQUANA
-             _ledState.get_characteristic(),
-#endif // TARGET_FUTURE_SEQUANA            ,
-             &_info
-        };
+        sequanaChars[count++] = _ledState.get_characteristic();
+#endif // TARGET_FUTURE_SEQUANA
+        sequanaChars[count++] = &_info;
+        MBED_ASSERT(count <= MAX_CHARACTERISTICS);
 
-        GattService sequanaService(UUID_SEQUANA_PRIMARY_SERVICE, sequanaChars, sizeof(sequanaChars) / sizeof(GattCharacteristic *));
+        GattService sequanaService(UUID_SEQUANA_PRIMARY_SERVICE, sequanaChars, count);
 
         _ble.gattServer().addService(sequanaService);
 
         set_information(version_info, strlen(version_info));
 }
 
-#ifdef TARGET_FUTURE_SEQUANA
 void PrimaryService::on_data_written(const GattWriteCallbackParams *params)
 {
-    if ((params->handle == _ledState.get_characteristic()->getValueHandle()) && (params->len == 6)) {
+    if (_particulateMatterConfig &&
+        (params->handle == _particulateMatterConfig->get_characteristic()->getValueHandle()) && (params->len == 6)) {
+        Sps30Config value(params->data);
+        _particulateMatterConfig->set_actuator(value);
+    } else if (_airQScd30Config &&
+               (params->handle == _airQScd30Config->get_characteristic()->getValueHandle()) && (params->len == 9)) {
+        Scd30Config value(params->data);
+        _airQScd30Config->set_actuator(value);
+    }
+#ifdef TARGET_FUTURE_SEQUANA
+    else if ((params->handle == _ledState.get_characteristic()->getValueHandle()) && (params->len == 6)) {
         RGBLedValue value(params->data);
         _ledState.set_actuator(value);
+    } else if ((params->handle == _accMagConfig.get_characteristic()->getValueHandle()) && (params->len == 3)) {
+        Kx64Config value(params->data);
+        _accMagConfig.set_actuator(value);
+    } else if ((params->handle == _magCalibration.get_characteristic()->getValueHandle()) && (params->len == sizeof(MagCalibration))) {
+        MagCalibration value;
+        memcpy(&value, params->data, sizeof(value));
+        _magCalibration.set_actuator(value);
     }
-}
 #endif // TARGET_FUTURE_SEQUANA
+}
 
 void PrimaryService::set_information(const char* info, size_t length)
 {
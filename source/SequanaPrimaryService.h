@@ -28,15 +28,32 @@
 #include "AirQSensor.h"
 #include "RGBLedActuator.h"
 #include "OccupancySensor.h"
+#include "ShieldProbe.h"
 
 namespace sequana {
 
 /* Instantiation of binary buffers for characteristics values */
 typedef CharBuffer<Kx64Value, 12>   Kx64CharBuffer;
 
+typedef CharBuffer<Kx64Config, 3>   Kx64ConfigCharBuffer;
+
+typedef CharBuffer<SpectrumPeaks, 4 * SPECTRUM_NUM_PEAKS> SpectrumCharBuffer;
+
+typedef CharBuffer<MagCalibration, 14> MagCalibrationCharBuffer;
+
+typedef CharBuffer<Orientation, 10> OrientationCharBuffer;
+
 typedef CharBuffer<Sps30Value, 12>  Sps30CharBuffer;
 
-typedef CharBuffer<uint8_t, 1>      OccupancyCharBuffer;
+typedef CharBuffer<Sps30ExtendedValue, 20> Sps30ExtendedCharBuffer;
+
+typedef CharBuffer<Sps30Config, 6>  Sps30ConfigCharBuffer;
+
+typedef CharBuffer<AirQClimateValue, 4> AirQClimateCharBuffer;
+
+typedef CharBuffer<Scd30Config, 9>  Scd30ConfigCharBuffer;
+
+typedef CharBuffer<LightColorValue, 16> LightColorCharBuffer;
 
 
 #define SEQUANA_INFO_MAX_LEN        250
@@ -71,6 +88,33 @@ public:
     }
 };
 
+/** Converter to create BLE characteristic data from occupancy level.
+ */
+class OccupancyCharBuffer : public CharBuffer<OccupancyValue, 1> {
+public:
+    OccupancyCharBuffer& operator= (const OccupancyValue &val)
+    {
+        _bytes[0] = val.level;
+        return *this;
+    }
+};
+
+/** Converter to create BLE characteristic data from motion features.
+ */
+class MotionFeaturesCharBuffer : public CharBuffer<MotionFeatures, 20> {
+public:
+    MotionFeaturesCharBuffer& operator= (const MotionFeatures &val)
+    {
+        memcpy(_bytes, val.rms, 6);
+        memcpy(_bytes+6, val.peak_to_peak, 6);
+        memcpy(_bytes+12, val.crest, 3);
+        memcpy(_bytes+15, &val.pitch, 2);
+        memcpy(_bytes+17, &val.roll, 2);
+        _bytes[19] = val.shocks;
+        return *this;
+    }
+};
+
 #ifdef TARGET_FUTURE_SEQUANA
 /** Converter to create BLE characteristic data from RGB Led data.
  */
@@ -98,13 +142,16 @@ public:
     static const UUID UUID_SEQUANA_PRIMARY_SERVICE;
 
 public:
-    /** Add Sequana Primary Service to an existing BLE object, initializing it with all characteristics.
+    /** Add Sequana Primary Service to an existing BLE object, initializing it with characteristics
+     * of the sensors found.
      * @param ble                   Reference to the BLE device.
+     * @param devices               Shield devices found, mask of ShieldProbe::Device values.
      * @param accmag_sensor         Reference to KX64 sensor.
      * @param partmatter_sensor     Reference to PSP30 sensor.
      * @param combo_env_sensor      Reference to combined parameters sensor.
      */
     PrimaryService(BLE &ble,
+                   uint32_t devices,
 #ifdef TARGET_FUTURE_SEQUANA
                    Kx64Sensor &accmag_sensor,
 #endif //TARGET_FUTURE_SEQUANA
@@ -118,20 +165,29 @@ public:
 #endif //TARGET_FUTURE_SEQUANA
                    );
 
-#ifdef TARGET_FUTURE_SEQUANA
     void on_data_written(const GattWriteCallbackParams *params);
-#endif //TARGET_FUTURE_SEQUANA
     void set_information(const char* info, size_t length);
 
 protected:
     BLE &_ble;
 #ifdef TARGET_FUTURE_SEQUANA
     SensorMultiCharacteristic<2, Kx64CharBuffer, Kx64Value>         _accMagSensorMeasurement;
+    ActuatorCharacteristic<Kx64ConfigCharBuffer, Kx64Config>        _accMagConfig;
+    SensorCharacteristic<MotionFeaturesCharBuffer, MotionFeatures>  _motionFeatures;
+    SensorCharacteristic<SpectrumCharBuffer, SpectrumPeaks>         _vibrationSpectrum;
+    ActuatorCharacteristic<MagCalibrationCharBuffer, MagCalibration> _magCalibration;
+    SensorCharacteristic<OrientationCharBuffer, Orientation>        _orientation;
 #endif //TARGET_FUTURE_SEQUANA
-    SensorCharacteristic<Sps30CharBuffer, Sps30Value>               _particulateMatterMeasurement;
-    SensorMultiCharacteristic<2, ComboEnvCharBuffer, ComboEnvValue> _comboEnvMeasurement;
-    SensorCharacteristic<AirQCharBuffer, AirQValue>                 _airQMeasurement;
-    SensorCharacteristic<OccupancyCharBuffer, uint8_t>              _occupancyDetection;
+    // Shield sensor characteristics exist only when the sensor is found.
+    SensorCharacteristic<Sps30CharBuffer, Sps30Value>               *_particulateMatterMeasurement;
+    SensorCharacteristic<Sps30ExtendedCharBuffer, Sps30ExtendedValue> *_particulateMatterExtended;
+    ActuatorCharacteristic<Sps30ConfigCharBuffer, Sps30Config>      *_particulateMatterConfig;
+    SensorMultiCharacteristic<2, ComboEnvCharBuffer, ComboEnvValue> *_comboEnvMeasurement;
+    SensorCharacteristic<LightColorCharBuffer, LightColorValue>     *_lightColor;
+    SensorCharacteristic<AirQCharBuffer, AirQValue>                 *_airQMeasurement;
+    SensorCharacteristic<AirQClimateCharBuffer, AirQClimateValue>   *_airQClimate;
+    ActuatorCharacteristic<Scd30ConfigCharBuffer, Scd30Config>      *_airQScd30Config;
+    SensorCharacteristic<OccupancyCharBuffer, OccupancyValue>       *_occupancyDetection;
 #ifdef TARGET_FUTURE_SEQUANA
     ActuatorCharacteristic<RGBLedCharBuffer, RGBLedValue>           _ledState;
 #endif //TARGET_FUTURE_SEQUANA
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "Shdlc.h"
+
+
+const uint8_t Shdlc::CLASS_TABLE[256] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x08, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x08, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x03, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+
+void ShdlcDecoder::reset()
+{
+    _state = SEARCH;
+    _length = 0;
+    _sum = 0;
+}
+
+
+void ShdlcDecoder::error()
+{
+    ++_errors;
+    reset();
+}
+
+
+bool ShdlcDecoder::frame_is_valid() const
+{
+    // Header + checksum, length must be consistent.
+    if ((_length < Shdlc::HDR_LENGTH + 1) || (_length != _frame.f.len + Shdlc::HDR_LENGTH + 1)) {
+        return false;
+    }
+
+    // Running sum includes the checksum byte itself.
+    uint8_t chk = _frame.raw[_length - 1];
+    return chk == (uint8_t)~(uint8_t)(_sum - chk);
+}
+
+
+size_t ShdlcDecoder::decode(const uint8_t *data, size_t length)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = data + length;
+
+    if (_state == READY) {
+        reset();
+    }
+
+    while (p < end) {
+        switch (_state) {
+            case SEARCH: {
+                const uint8_t *start = (const uint8_t *)memchr(p, Shdlc::START_SYMBOL, end - p);
+                if (start == NULL) {
+                    return length;
+                }
+                p = start + 1;
+                _length = 0;
+                _sum = 0;
+                _state = GET;
+                break;
+            }
+
+            case GET: {
+                // Fast path: copy ordinary bytes, bounded by the input and the frame buffer.
+                const uint8_t *limit = ((size_t)(end - p) > FRAME_MAX_SIZE - _length) ? p + (FRAME_MAX_SIZE - _length) : end;
+                uint8_t *dst = &_frame.raw[_length];
+                const uint8_t *run = p;
+                uint32_t sum = _sum;
+                while ((p < limit) && (Shdlc::CLASS_TABLE[*p] & (Shdlc::START | Shdlc::ESCAPE)) == 0) {
+                    sum += *p;
+                    *dst++ = *p++;
+                }
+                _sum = sum;
+                _length += p - run;
+                if (p == end) {
+                    break;
+                }
+                if ((p == limit) && (Shdlc::CLASS_TABLE[*p] & (Shdlc::START | Shdlc::ESCAPE)) == 0) {
+                    // Data byte beyond the longest frame, delimiter may still follow a full buffer.
+                    error();
+                    break;
+                }
+                if (*p++ == Shdlc::STUFF_SYMBOL) {
+                    _state = STUFF;
+                } else if (_length != 0) {
+                    // End of frame.
+                    if (frame_is_valid()) {
+                        _state = READY;
+                        return p - data;
+                    }
+                    // Treat the delimiter as the start of the next frame.
+                    ++_errors;
+                    _length = 0;
+                    _sum = 0;
+                }
+                // Repeated start symbols may fill inter-frame space.
+                break;
+            }
+
+            case STUFF:
+                if ((Shdlc::CLASS_TABLE[*p] & Shdlc::ESCAPED_CODE) && (_length < FRAME_MAX_SIZE)) {
+                    uint8_t value = *p++ ^ Shdlc::STUFF_MASK;
+                    _frame.raw[_length++] = value;
+                    _sum += value;
+                    _state = GET;
+                } else {
+                    error();
+                }
+                break;
+
+            case READY:
+                break;
+        }
+    }
+    return length;
+}
+
+
+static inline uint8_t *put_stuffed(uint8_t *out, uint8_t value)
+{
+    if (Shdlc::CLASS_TABLE[value] & Shdlc::NEEDS_STUFFING) {
+        *out++ = Shdlc::STUFF_SYMBOL;
+        *out++ = value ^ Shdlc::STUFF_MASK;
+    } else {
+        *out++ = value;
+    }
+    return out;
+}
+
+
+size_t ShdlcEncoder::encode(uint8_t addr, uint8_t cmd, const uint8_t *data, uint8_t len,
+                            uint8_t *out, size_t out_size)
+{
+    // Worst case size check keeps the encoding loop free of bounds checks.
+    if (out_size < 2 + 2 * (3 + (size_t)len + 1)) {
+        return 0;
+    }
+
+    uint8_t *p = out;
+    uint32_t chk = addr + cmd + len;
+
+    *p++ = Shdlc::START_SYMBOL;
+    p = put_stuffed(p, addr);
+    p = put_stuffed(p, cmd);
+    p = put_stuffed(p, len);
+    for (uint32_t i = 0; i < len; ++i) {
+        chk += data[i];
+        p = put_stuffed(p, data[i]);
+    }
+    p = put_stuffed(p, (uint8_t)~chk);
+    *p++ = Shdlc::START_SYMBOL;
+
+    return p - out;
+}
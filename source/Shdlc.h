@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SHDLC_H_
+#define SHDLC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/** Constants and byte classification shared by the SHDLC encoder and decoder.
+ */
+struct Shdlc {
+    static const uint8_t START_SYMBOL   = 0x7E;
+    static const uint8_t STUFF_SYMBOL   = 0x7D;
+    static const uint8_t STUFF_MASK     = 0x20;
+
+    static const uint32_t DATA_MAX_LEN  = 255;
+    static const uint32_t HDR_LENGTH    = 4;    // MISO header: address, command, state, length
+
+    /** Byte class flags, see CLASS_TABLE.
+     */
+    enum ByteClass {
+        NEEDS_STUFFING  = 0x01,     // byte must be escaped in a frame
+        START           = 0x02,     // frame delimiter
+        ESCAPE          = 0x04,     // escape symbol
+        ESCAPED_CODE    = 0x08      // valid byte following escape symbol
+    };
+
+    static const uint8_t CLASS_TABLE[256];
+};
+
+
+/** SHDLC MISO frame as received from a device, unstuffed.
+ */
+struct ShdlcFrame {
+    uint8_t     addr;
+    uint8_t     cmd;
+    uint8_t     state;
+    uint8_t     len;
+    uint8_t     data[Shdlc::DATA_MAX_LEN + 1];   // data followed by checksum
+};
+
+
+/** Bulk SHDLC frame decoder.
+ *
+ * Consumes a span of received bytes per call. Runs of ordinary bytes are
+ * copied in a tight loop, delimiter and escape handling is table-driven.
+ */
+class ShdlcDecoder {
+public:
+    ShdlcDecoder() : _errors(0) { reset(); }
+
+    /** Discard any partially received frame and search for the next one.
+     */
+    void reset();
+
+    /** Decode received bytes.
+     *
+     * Decoding stops after a complete valid frame, so that it can be
+     * processed before the following bytes overwrite it.
+     *
+     * @param data received bytes
+     * @param length number of received bytes
+     * @returns number of bytes consumed
+     */
+    size_t decode(const uint8_t *data, size_t length);
+
+    /** Check whether the last decode() call completed a valid frame.
+     */
+    bool frame_ready() const { return _state == READY; }
+
+    /** Get the last complete frame, valid only when frame_ready().
+     */
+    const ShdlcFrame& get_frame() const { return _frame.f; }
+
+    /** Number of framing and checksum errors since creation.
+     */
+    uint32_t get_errors() const { return _errors; }
+
+protected:
+    static const uint32_t FRAME_MAX_SIZE = Shdlc::HDR_LENGTH + Shdlc::DATA_MAX_LEN + 1;
+
+    enum State {
+        SEARCH = 0,
+        GET,
+        STUFF,
+        READY
+    };
+
+    union RawFrame {
+        ShdlcFrame  f;
+        uint8_t     raw[FRAME_MAX_SIZE];
+    };
+
+    bool frame_is_valid() const;
+    void error();
+
+protected:
+    State       _state;
+    uint32_t    _length;
+    uint32_t    _sum;       // running sum of frame bytes
+    uint32_t    _errors;
+    RawFrame    _frame;
+};
+
+
+/** SHDLC MOSI frame encoder.
+ */
+class ShdlcEncoder {
+public:
+    // Delimiters plus fully stuffed address, command, length, data and checksum.
+    static const uint32_t FRAME_MAX_SIZE = 2 + 2 * (3 + Shdlc::DATA_MAX_LEN + 1);
+
+    /** Build a complete stuffed frame with checksum.
+     *
+     * @param addr device address
+     * @param cmd command
+     * @param data command data, may be NULL when len is 0
+     * @param len command data length
+     * @param[out] out output buffer
+     * @param out_size output buffer size
+     * @returns frame size, 0 when the output buffer is too small
+     */
+    static size_t encode(uint8_t addr, uint8_t cmd, const uint8_t *data, uint8_t len,
+                         uint8_t *out, size_t out_size);
+};
+
+
+#endif // SHDLC_H_
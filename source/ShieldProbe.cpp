@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mbed.h>
+#include "ShieldProbe.h"
+
+
+ShieldProbe::ShieldProbe(I2CBus& bus, uint8_t as_addr, uint8_t hs_addr, uint8_t zmod_addr, uint8_t scd_addr, Sps30Sensor& sps30) :
+    _bus(bus),
+    _sps30(sps30),
+    _xfer(0, I2CBus::FREQUENCY_STANDARD),
+    _index(0),
+    _devices(0),
+    _sps30_done(false)
+{
+    // Status register address, measurement request, status register
+    // address and 'read firmware version' command respectively.
+    const I2CProbe probes[NUM_I2C_DEVICES] = {
+        { as_addr,   DEVICE_AS7261,   { 0x00 },       1 },
+        { hs_addr,   DEVICE_HS3001,   { 0x00 },       1 },
+        { zmod_addr, DEVICE_ZMOD4410, { 0x94 },       1 },
+        { scd_addr,  DEVICE_SCD30,    { 0xD1, 0x00 }, 2 }
+    };
+
+    memcpy(_probes, probes, sizeof(_probes));
+    _xfer.done = callback(this, &ShieldProbe::on_transfer);
+}
+
+
+void ShieldProbe::start(EventQueue& ev_queue, Callback<void()> done)
+{
+    _done = done;
+    _index = 0;
+    _devices = 0;
+    _sps30_done = false;
+    _sps30.probe(ev_queue, callback(this, &ShieldProbe::on_sps30));
+    probe_next();
+}
+
+
+void ShieldProbe::probe_next()
+{
+    const I2CProbe& probe = _probes[_index];
+
+    _xfer.address = probe.address;
+    _xfer.tx_data = probe.command;
+    _xfer.tx_length = probe.length;
+    _xfer.rx_length = 0;
+    _bus.submit(_xfer);
+}
+
+
+void ShieldProbe::on_transfer(int result)
+{
+    if (result == 0) {
+        _devices |= _probes[_index].device;
+    }
+    if (++_index < NUM_I2C_DEVICES) {
+        probe_next();
+    } else {
+        check_done();
+    }
+}
+
+
+void ShieldProbe::on_sps30(bool present)
+{
+    if (present) {
+        _devices |= DEVICE_SPS30;
+    }
+    _sps30_done = true;
+    check_done();
+}
+
+
+void ShieldProbe::check_done()
+{
+    if ((_index >= NUM_I2C_DEVICES) && _sps30_done && _done) {
+        _done();
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SHIELD_PROBE_H_
+#define SHIELD_PROBE_H_
+
+#include <mbed.h>
+#include "I2CBus.h"
+#include "Sps30.h"
+
+
+/** Detection of the environmental shield sensors at boot.
+ *
+ * Each I2C device is addressed with a harmless command and is present
+ * when it acknowledges, particulate matter sensor is present when it answers
+ * a request on the UART. Only the devices found are started later.
+ */
+class ShieldProbe {
+public:
+    enum Device {
+        DEVICE_AS7261   = 0x01,
+        DEVICE_HS3001   = 0x02,
+        DEVICE_ZMOD4410 = 0x04,
+        DEVICE_SCD30    = 0x08,
+        DEVICE_SPS30    = 0x10
+    };
+
+    // Sensor interfaces are used when any of their devices is found,
+    // occupancy sensor when any shield device is found.
+    static const uint32_t COMBO_ENV_DEVICES     = DEVICE_AS7261 | DEVICE_HS3001;
+    static const uint32_t AIR_QUALITY_DEVICES   = DEVICE_ZMOD4410 | DEVICE_SCD30;
+    static const uint32_t SHIELD_DEVICES        = COMBO_ENV_DEVICES | AIR_QUALITY_DEVICES | DEVICE_SPS30;
+
+public:
+    /** Create probe.
+     *
+     * @param bus I2C bus the shield sensors are connected to
+     * @param as_addr light sensor I2C address
+     * @param hs_addr humidity sensor I2C address
+     * @param zmod_addr gas sensor I2C address
+     * @param scd_addr CO2 sensor I2C address
+     * @param sps30 particulate matter sensor
+     */
+    ShieldProbe(I2CBus& bus, uint8_t as_addr, uint8_t hs_addr, uint8_t zmod_addr, uint8_t scd_addr, Sps30Sensor& sps30);
+
+    /** Start probing all devices.
+     *
+     * @param ev_queue event queue to run the probe on
+     * @param done called when all devices have been probed
+     */
+    void start(EventQueue& ev_queue, Callback<void()> done);
+
+    /** Get devices found.
+     *
+     * @returns mask of Device values
+     */
+    uint32_t get_devices() const { return _devices; }
+
+protected:
+    static const uint32_t NUM_I2C_DEVICES = 4;
+    static const uint32_t MAX_PROBE_SIZE = 2;
+
+    struct I2CProbe {
+        uint8_t     address;
+        Device      device;
+        char        command[MAX_PROBE_SIZE];
+        uint8_t     length;
+    };
+
+    void probe_next();
+    void on_transfer(int result);
+    void on_sps30(bool present);
+    void check_done();
+
+protected:
+    I2CBus&         _bus;
+    Sps30Sensor&    _sps30;
+    I2CTransaction  _xfer;
+    I2CProbe        _probes[NUM_I2C_DEVICES];
+    uint32_t        _index;
+    uint32_t        _devices;
+    bool            _sps30_done;
+    Callback<void()> _done;
+};
+
+
+#endif // SHIELD_PROBE_H_
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "SpectrumAnalyzer.h"
+#include "FixedPoint.h"
+
+using namespace fixed_point;
+
+// Smallest magnitude (in FFT output units) considered a peak.
+#define MIN_PEAK_MAGNITUDE      2
+
+// FFT output is scaled by 1/N and the input is pre-scaled by 1/2 to avoid
+// overflow; Hann window coherent gain is 1/2. Sine amplitude is then
+// four times the bin magnitude.
+#define AMPLITUDE_SCALE         4
+
+
+SpectrumAnalyzer::SpectrumAnalyzer() :
+    _count(0),
+    _rate_mhz(0)
+{
+    // Tables are generated once at startup, processing itself is integer-only.
+    for (uint32_t k = 0; k < HALF_SIZE; ++k) {
+        double phase = 2.0 * M_PI * k / SPECTRUM_FFT_SIZE;
+        _arena.cos_table[k] = (int16_t)lround(cos(phase) * 32767.0);
+        _arena.sin_table[k] = (int16_t)lround(sin(phase) * 32767.0);
+        _arena.window[k] = (int16_t)lround((0.5 - 0.5 * cos(phase)) * 32767.0);
+    }
+    memset(&_peaks, 0, sizeof(_peaks));
+}
+
+
+bool SpectrumAnalyzer::add_sample(int16_t sample)
+{
+    _arena.data[_count] = sample;
+    if (++_count >= SPECTRUM_FFT_SIZE) {
+        analyze();
+        _count = 0;
+        return true;
+    }
+    return false;
+}
+
+
+void SpectrumAnalyzer::analyze()
+{
+    apply_window();
+    fft();
+    split();
+    find_peaks();
+}
+
+
+// Removes DC offset (gravity) and applies Hann window.
+// Samples are halved so that butterflies cannot overflow.
+void SpectrumAnalyzer::apply_window()
+{
+    int16_t *d = _arena.data;
+    int32_t sum = 0;
+
+    for (uint32_t i = 0; i < SPECTRUM_FFT_SIZE; ++i) {
+        sum += d[i];
+    }
+    int32_t mean = sum / (int32_t)SPECTRUM_FFT_SIZE;
+
+    for (uint32_t i = 0; i < HALF_SIZE; ++i) {
+        int32_t w = _arena.window[i];
+        int32_t head = d[i] - mean;
+        int32_t tail = d[SPECTRUM_FFT_SIZE - 1 - i] - mean;
+        if (head > INT16_MAX) head = INT16_MAX; else if (head < INT16_MIN) head = INT16_MIN;
+        if (tail > INT16_MAX) tail = INT16_MAX; else if (tail < INT16_MIN) tail = INT16_MIN;
+        d[i] = (int16_t)(mul_q15(head, w) >> 1);
+        d[SPECTRUM_FFT_SIZE - 1 - i] = (int16_t)(mul_q15(tail, w) >> 1);
+    }
+}
+
+
+// In-place radix-2 complex FFT over HALF_SIZE points stored as (re, im) pairs.
+// Each stage scales by 1/2, the result is scaled by 1/HALF_SIZE.
+void SpectrumAnalyzer::fft()
+{
+    int16_t *d = _arena.data;
+    const uint32_t n = HALF_SIZE;
+
+    // Bit reversal permutation.
+    for (uint32_t i = 0, j = 0; i < n; ++i) {
+        if (i < j) {
+            int16_t tr = d[2 * i];
+            int16_t ti = d[2 * i + 1];
+            d[2 * i] = d[2 * j];
+            d[2 * i + 1] = d[2 * j + 1];
+            d[2 * j] = tr;
+            d[2 * j + 1] = ti;
+        }
+        uint32_t bit = n >> 1;
+        while (j & bit) {
+            j ^= bit;
+            bit >>= 1;
+        }
+        j |= bit;
+    }
+
+    for (uint32_t size = 2; size <= n; size <<= 1) {
+        uint32_t half = size >> 1;
+        uint32_t step = SPECTRUM_FFT_SIZE / size;
+
+        for (uint32_t start = 0; start < n; start += size) {
+            for (uint32_t k = 0; k < half; ++k) {
+                int32_t c = _arena.cos_table[k * step];
+                int32_t s = _arena.sin_table[k * step];
+                uint32_t i = 2 * (start + k);
+                uint32_t j = i + 2 * half;
+
+                // t = x[j] * e^(-j*phase)
+                int32_t tr = (d[j] * c + d[j + 1] * s) >> 15;
+                int32_t ti = (d[j + 1] * c - d[j] * s) >> 15;
+                int32_t ar = d[i];
+                int32_t ai = d[i + 1];
+
+                d[i] = (int16_t)((ar + tr) >> 1);
+                d[i + 1] = (int16_t)((ai + ti) >> 1);
+                d[j] = (int16_t)((ar - tr) >> 1);
+                d[j + 1] = (int16_t)((ai - ti) >> 1);
+            }
+        }
+    }
+}
+
+
+// Recovers the real input spectrum from the half size complex FFT
+// and calculates one-sided magnitude spectrum.
+void SpectrumAnalyzer::split()
+{
+    const int16_t *d = _arena.data;
+    const uint32_t n = HALF_SIZE;
+
+    for (uint32_t k = 0; k <= n / 2; ++k) {
+        uint32_t m = (n - k) % n;
+        int32_t a = d[2 * k];
+        int32_t b = d[2 * k + 1];
+        int32_t c = d[2 * m];
+        int32_t e = d[2 * m + 1];
+
+        // Even and odd sample spectra.
+        int32_t er = (a + c) >> 1;
+        int32_t ei = (b - e) >> 1;
+        int32_t or_ = (b + e) >> 1;
+        int32_t oi = (c - a) >> 1;
+
+        // Odd spectrum rotated by e^(-j*2*pi*k/N)
+        int32_t cs = _arena.cos_table[k];
+        int32_t sn = _arena.sin_table[k];
+        int32_t wr = (or_ * cs + oi * sn) >> 15;
+        int32_t wi = (oi * cs - or_ * sn) >> 15;
+
+        int32_t xr = er + wr;
+        int32_t xi = ei + wi;
+        _arena.magnitude[k] = (uint16_t)isqrt((uint64_t)((int64_t)xr * xr) + (uint64_t)((int64_t)xi * xi));
+        xr = er - wr;
+        xi = ei - wi;
+        _arena.magnitude[n - k] = (uint16_t)isqrt((uint64_t)((int64_t)xr * xr) + (uint64_t)((int64_t)xi * xi));
+    }
+}
+
+
+// Keeps the largest local maxima, frequency is refined by parabolic interpolation.
+void SpectrumAnalyzer::find_peaks()
+{
+    const uint16_t *mag = _arena.magnitude;
+    uint16_t peak_mag[SPECTRUM_NUM_PEAKS];
+
+    memset(&_peaks, 0, sizeof(_peaks));
+    memset(peak_mag, 0, sizeof(peak_mag));
+
+    for (uint32_t k = 1; k < HALF_SIZE; ++k) {
+        uint16_t c = mag[k];
+        if ((c < MIN_PEAK_MAGNITUDE) || (c <= mag[k - 1]) || (c < mag[k + 1])) {
+            continue;
+        }
+        if (c <= peak_mag[SPECTRUM_NUM_PEAKS - 1]) {
+            continue;
+        }
+
+        // Parabolic interpolation, offset from bin k in 1/256 bin units.
+        int32_t l = mag[k - 1];
+        int32_t r = mag[k + 1];
+        int32_t den = l - 2 * (int32_t)c + r;
+        int32_t delta = den ? (128 * (l - r)) / den : 0;
+        if (delta > 128) {
+            delta = 128;
+        } else if (delta < -128) {
+            delta = -128;
+        }
+        uint32_t frequency = (uint32_t)(((uint64_t)((k << 8) + delta) * _rate_mhz) /
+                                        (100ULL * 256 * SPECTRUM_FFT_SIZE));
+        uint32_t amplitude = (uint32_t)c * AMPLITUDE_SCALE;
+
+        // Insert into the list sorted by magnitude.
+        uint32_t pos = SPECTRUM_NUM_PEAKS - 1;
+        while ((pos > 0) && (peak_mag[pos - 1] < c)) {
+            peak_mag[pos] = peak_mag[pos - 1];
+            _peaks.peak[pos] = _peaks.peak[pos - 1];
+            --pos;
+        }
+        peak_mag[pos] = c;
+        _peaks.peak[pos].frequency = (frequency > UINT16_MAX) ? UINT16_MAX : (uint16_t)frequency;
+        _peaks.peak[pos].amplitude = (amplitude > UINT16_MAX) ? UINT16_MAX : (uint16_t)amplitude;
+    }
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SPECTRUM_ANALYZER_H_
+#define SPECTRUM_ANALYZER_H_
+
+#include <stdint.h>
+
+// Number of samples in a single FFT block.
+#define SPECTRUM_FFT_SIZE       256
+#define SPECTRUM_FFT_LOG2       8
+
+// Number of dominant frequencies reported.
+#define SPECTRUM_NUM_PEAKS      4
+
+
+/** Dominant vibration frequencies found in a block of samples.
+ * When this matches format of the sensor characteristic then
+ * no conversion is needed.
+ */
+struct SpectrumPeaks {
+    struct {
+        uint16_t    frequency;  //<! peak frequency, 0.1 Hz
+        uint16_t    amplitude;  //<! peak amplitude, acceleration units
+    } peak[SPECTRUM_NUM_PEAKS];
+};
+
+
+/** Windowed fixed-point real FFT and spectral peak search.
+ *
+ * The real input block is transformed by a half size complex FFT
+ * followed by a split step. All processing happens in place in
+ * a pre-allocated arena, no memory is allocated at runtime.
+ */
+class SpectrumAnalyzer {
+public:
+    SpectrumAnalyzer();
+
+    /** Set sampling rate used to calculate peak frequencies.
+     *
+     * @param rate_mhz sampling rate in samples per 1000 seconds
+     */
+    void set_sample_rate(uint32_t rate_mhz) { _rate_mhz = rate_mhz; }
+
+    /** Add a sample to the current block.
+     *
+     * @returns true when the block is full and has been analyzed
+     */
+    bool add_sample(int16_t sample);
+
+    /** Discard partially collected block.
+     */
+    void reset() { _count = 0; }
+
+    /** Get peaks found in the last analyzed block.
+     */
+    const SpectrumPeaks& get_peaks() const { return _peaks; }
+
+    /** Analyze block of samples stored in the arena.
+     */
+    void analyze();
+
+protected:
+    static const uint32_t HALF_SIZE = SPECTRUM_FFT_SIZE / 2;
+
+    /** Scratch memory used by the analysis.
+     */
+    struct Arena {
+        int16_t     data[SPECTRUM_FFT_SIZE];        // input samples, then complex FFT result (re, im)
+        uint16_t    magnitude[HALF_SIZE + 1];       // one-sided magnitude spectrum
+        int16_t     window[HALF_SIZE];              // Hann window, Q15, symmetrical half
+        int16_t     cos_table[HALF_SIZE];           // cos(2*pi*k/N), Q15
+        int16_t     sin_table[HALF_SIZE];           // sin(2*pi*k/N), Q15
+    };
+
+    void apply_window();
+    void fft();
+    void split();
+    void find_peaks();
+
+protected:
+    Arena           _arena;
+    uint32_t        _count;
+    uint32_t        _rate_mhz;
+    SpectrumPeaks   _peaks;
+};
+
+
+#endif // SPECTRUM_ANALYZER_H_
@@ -18,328 +18,565 @@
 #include "Sps30.h"
 #include "Callback.h"
 
-static uint8_t sps30_command_start_bytes[] = {0x7E, 0x00, 0x00, 0x02, 0x01, 0x03, 0xF9, 0x7E}; //start
-static uint8_t sps30_command_read_bytes[] = {0x7E, 0x00, 0x03, 0x00, 0xFC, 0x7E}; //read
-static uint8_t sps30_command_clean_bytes[] = {0x7E, 0x00, 0x80, 0x05, 0x00, 0x00, 0x00, 0x00, 0xff, 0x7B, 0x7E}; //auto-clean
-static uint8_t sps30_command_reset_bytes[] = {0x7E, 0x00, 0xD3, 0x00, 0x2C, 0x7E}; //reset
-
-#define PM_1_0_OFFSET       0
-#define PM_2_5_OFFSET       4
-#define PM_10_OFFSET        12
-#define SPS30_DATA_SIZE     40
+static const uint8_t sps30_start_data[] = {0x01, 0x03};   // measurement output format: big-endian float
+
+// Measurement record: ten big-endian floats.
+enum Sps30Field {
+    MASS_PM_1_0 = 0,
+    MASS_PM_2_5,
+    MASS_PM_4_0,
+    MASS_PM_10,
+    NUM_PM_0_5,
+    NUM_PM_1_0,
+    NUM_PM_2_5,
+    NUM_PM_4_0,
+    NUM_PM_10,
+    TYPICAL_SIZE,
+    SPS30_NUM_FIELDS
+};
+
+#define SPS30_DATA_SIZE     (SPS30_NUM_FIELDS * 4)
 
 #ifdef MBED_DEBUG
-static uint32_t rx_rq_stat = 0;
-static uint32_t rx_done_stat = 0;
+static uint32_t rx_irq_stat = 0;
+static uint32_t rx_process_stat = 0;
 static uint32_t tx_done_stat = 0;
-static uint32_t stuff_stat = 0;
 static uint32_t total_bytes_stat = 0;
 #endif // MBED_DEBUG
 
 
-static void copy_uint32_be(uint32_t &d, uint8_t *src)
+static float get_float_be(const uint8_t *src)
 {
+    uint32_t raw = ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
     float f;
-    uint8_t *dest = (uint8_t *)&f;
-    int i;
 
-    for (i = 3; i >= 0; --i)
-    {
-        dest[i] = *src++;
-    }
+    memcpy(&f, &raw, sizeof(f));
+    return f;
+}
+
 
-    d = f; // conversion float->uint
+// Convert to fixed point, saturated to 16 bits.
+static uint16_t to_fixed(float value, float scale)
+{
+    float scaled = value * scale + 0.5f;
+
+    if (!(scaled > 0.0f)) {
+        return 0;
+    } else if (scaled >= UINT16_MAX) {
+        return UINT16_MAX;
+    }
+    return (uint16_t)scaled;
 }
 
 
-void Sps30Driver::shdlc_state_machine(uint8_t data)
+void Sps30Driver::retrieve_data()
+{
+    const ShdlcFrame &frame = _decoder.get_frame();
+
+    // Other frames (e.g. command acknowledges) are ignored.
+    if (frame.cmd != READ_MEASURED_VALUE) {
+        return;
+    }
+    if ((frame.state != 0) || ((frame.len != 0) && (frame.len != SPS30_DATA_SIZE))) {
+        _status = STATUS_PROTOCOL_ERROR;
+    } else if (frame.len == 0) {
+        // No new measurement available yet.
+        _status = STATUS_NOT_READY;
+    } else {
+        float f[SPS30_NUM_FIELDS];
+
+        for (uint32_t i = 0; i < SPS30_NUM_FIELDS; ++i) {
+            f[i] = get_float_be(&frame.data[i * 4]);
+        }
+
+        // Integer values are kept for the original characteristic.
+        _value.pm_1_0 = f[MASS_PM_1_0];
+        _value.pm_2_5 = f[MASS_PM_2_5];
+        _value.pm_10 = f[MASS_PM_10];
+
+        _extended_value.mass_pm_1_0 = to_fixed(f[MASS_PM_1_0], 10.0f);
+        _extended_value.mass_pm_2_5 = to_fixed(f[MASS_PM_2_5], 10.0f);
+        _extended_value.mass_pm_4_0 = to_fixed(f[MASS_PM_4_0], 10.0f);
+        _extended_value.mass_pm_10 = to_fixed(f[MASS_PM_10], 10.0f);
+        _extended_value.num_pm_0_5 = to_fixed(f[NUM_PM_0_5], 10.0f);
+        _extended_value.num_pm_1_0 = to_fixed(f[NUM_PM_1_0], 10.0f);
+        _extended_value.num_pm_2_5 = to_fixed(f[NUM_PM_2_5], 10.0f);
+        _extended_value.num_pm_4_0 = to_fixed(f[NUM_PM_4_0], 10.0f);
+        _extended_value.num_pm_10 = to_fixed(f[NUM_PM_10], 10.0f);
+        _extended_value.typical_size = to_fixed(f[TYPICAL_SIZE], 1000.0f);
+        _status = STATUS_OK;
+    }
+    if (_response_cb) {
+        _response_cb(_status);
+    }
+}
+
+/** Drain UART receive FIFO into the ring buffer.
+ * Frame processing is scheduled once per frame, on the closing
+ * start symbol, rather than once per received byte.
+ */
+void Sps30Driver::rx_irq()
 {
 #ifdef MBED_DEBUG
-    ++total_bytes_stat;
+    ++rx_irq_stat;
 #endif // MBED_DEBUG
+    while (_serial.readable()) {
+        uint8_t data = (uint8_t)_serial.getc();
+        _rx_buffer.push(data);
+        if ((data == Shdlc::START_SYMBOL) && (_rx_last != Shdlc::START_SYMBOL) && !_rx_pending) {
+            _rx_pending = true;
+            _ev_queue->call(callback(this, &Sps30Driver::process_rx));
+        }
+        _rx_last = data;
+    }
+}
 
-    switch (_shdlc_state) {
-        case ERROR:
-        case READY:
-        case SEARCH:
-            if (data == SHDLC_FRAME_START_SYMBOL) {
-                _shdlc_length = 0;
-                _shdlc_state = GET;
-            }
-            break;
 
-        case STUFF:
-            if(data == 0x5E) {
-                data = 0x7E;
-            } else if(data == 0x5D) {
-                data = 0x7D;
-            } else if(data == 0x31) {
-                data = 0x11;
-            } else if(data == 0x33) {
-                data = 0x13;
-            } else {
-                error_recovery();
-                break;
-            }
-            if (_shdlc_length < SHDLC_MISO_FRAME_MAX_SIZE) {
-                _frame.raw[_shdlc_length++] = data;
-            } else {
-                error_recovery();
-                break;
-            }
-            _shdlc_state = GET;
-            break;
+/** Decode all buffered bytes.
+ */
+void Sps30Driver::process_rx()
+{
+    uint8_t chunk[RX_CHUNK_SIZE];
+    uint32_t count;
 
-        case GET:
-            if (data == SHDLC_FRAME_STUFF_SYMBOL) {
 #ifdef MBED_DEBUG
-                ++stuff_stat;
+    ++rx_process_stat;
 #endif // MBED_DEBUG
-                _shdlc_state = STUFF;
-            } else if (data == SHDLC_FRAME_START_SYMBOL) {
-                if (_shdlc_length == 0) {
-                    // assume multiple start symbols may fill inter-frame space
-                    // or may have get lost of sync - just ignore extra start symbol
-                    break;
-                }
-                // End of Frame
-                if (_shdlc_length < SHDLC_MISO_FRAME_MAX_SIZE) {
-                    _frame.raw[_shdlc_length] = data;    // To support frame validation.
-                    if (shdlc_frame_is_valid())
-                    {
-                        _shdlc_state = READY;
-                    }
-                } else {
-                    error_recovery();
-                }
-            } else {
-                if (_shdlc_length < SHDLC_MISO_FRAME_MAX_SIZE) {
-                    _frame.raw[_shdlc_length++] = data;
-                } else {
-                    error_recovery();
-                }
+    _rx_pending = false;
+    do {
+        count = 0;
+        while ((count < RX_CHUNK_SIZE) && _rx_buffer.pop(chunk[count])) {
+            ++count;
+        }
+#ifdef MBED_DEBUG
+        total_bytes_stat += count;
+#endif // MBED_DEBUG
+        uint32_t offset = 0;
+        while (offset < count) {
+            offset += _decoder.decode(&chunk[offset], count - offset);
+            if (_decoder.frame_ready()) {
+                retrieve_data();
             }
-            break;
-    }
+        }
+    } while (count == RX_CHUNK_SIZE);
 }
 
-// Validate incoming frame.
-bool Sps30Driver::shdlc_frame_is_valid()
+
+void Sps30Driver::tx_done(int event)
 {
-    bool valid = false;
+#ifdef MBED_DEBUG
+    ++tx_done_stat;
+#endif // MBED_DEBUG
+    if (event & SERIAL_EVENT_ERROR) {
+        // error
+        _status = STATUS_TX_ERROR;
+    }
+}
+
 
-    // Minimum frame length must be considered.
-    valid = (_shdlc_length >= (SHDLC_MISO_HDR_LENGTH + 1)); // header + checksum
-    if (valid) {
-        // Frame length must be consistent.
-        valid = (_shdlc_length == (_frame.f.len + SHDLC_MISO_HDR_LENGTH + 1));
+/** Encode and send command frame in the background.
+ * Commands are spaced by the sensor scheduler, so transmission of the previous
+ * frame is always complete, a busy transmitter is reported as an error.
+ */
+Sps30Driver::Status Sps30Driver::send_command(Command cmd, const uint8_t *data, uint8_t len, bool wake_up)
+{
+    // Low pulse on RX activates the interface, then the command wakes the sensor.
+    size_t offset = 0;
+    if (wake_up) {
+        _tx_buffer[offset++] = WAKE_UP_BYTE;
     }
-    if (valid) {
-        // Frame end must be clearly marked.
-        valid = _frame.raw[_shdlc_length] == SHDLC_FRAME_START_SYMBOL;
+
+    size_t size = ShdlcEncoder::encode(SHDLC_ADDRESS, cmd, data, len, &_tx_buffer[offset], sizeof(_tx_buffer) - offset);
+
+    if (size == 0) {
+        return STATUS_TX_ERROR;
     }
-    if (valid) {
-        // Checksum must be correct.
-        valid = (_frame.raw[_shdlc_length - 1] == shdlc_frame_checksum());
-        if (!valid) {
-            printf("SPS30 frame checksum error!\n");
-        }
+    if (_serial.write(_tx_buffer, offset + size, callback(this, &Sps30Driver::tx_done)) != 0) {
+        return STATUS_TX_ERROR;
     }
-    return valid;
+    return STATUS_OK;
 }
 
 
-uint8_t Sps30Driver::shdlc_frame_checksum()
+Sps30Driver::Status Sps30Driver::request_new_frame()
 {
-    uint32_t i, chk;
+    _status = STATUS_NOT_READY;
+    return send_command(READ_MEASURED_VALUE, NULL, 0);
+}
 
-    chk = 0;
-    for (i = 0; i < (_shdlc_length - 1); ++i) {
-        chk += _frame.raw[i];
-    }
 
-    return (uint8_t)(~(chk & 0xFF));
+Sps30Driver::Status Sps30Driver::send_reset()
+{
+    return send_command(RESET, NULL, 0);
 }
 
 
-void Sps30Driver::error_recovery()
+Sps30Driver::Status Sps30Driver::send_start()
 {
-    _shdlc_state = ERROR;
-    _shdlc_length = 0;
-    _status = STATUS_PROTOCOL_ERROR;
+    return send_command(START_MEASUREMENT, sps30_start_data, sizeof(sps30_start_data));
 }
 
 
-uint32_t Sps30Driver::num_bytes_needed()
+Sps30Driver::Status Sps30Driver::send_stop()
 {
-    uint32_t bytes = SHDLC_MISO_FRAME_MIN_SIZE + 1; // need also first start symbol
+    return send_command(STOP_MEASUREMENT, NULL, 0);
+}
 
-    switch (_shdlc_state) {
-        case ERROR:
-        case READY:
-        case SEARCH:
-            // We are starting anew, already has right value;
-            break;
 
-        case STUFF:
-        case GET:
-            if (_shdlc_length < SHDLC_MISO_HDR_LENGTH) {
-                // need at least to complete header + checksum + start symbol
-                bytes = SHDLC_MISO_HDR_LENGTH + 2 - _shdlc_length;
-            } else {
-                bytes = _frame.f.len + SHDLC_MISO_HDR_LENGTH + 2 - _shdlc_length;
-            }
-            break;
-    }
-    return bytes;
+Sps30Driver::Status Sps30Driver::send_sleep()
+{
+    return send_command(SLEEP, NULL, 0);
+}
+
+
+Sps30Driver::Status Sps30Driver::send_wake_up()
+{
+    return send_command(WAKE_UP, NULL, 0, true);
+}
+
+
+Sps30Driver::Status Sps30Driver::send_fan_cleaning()
+{
+    return send_command(START_FAN_CLEANING, NULL, 0);
+}
+
+
+Sps30Driver::Status Sps30Driver::send_auto_clean_interval(uint32_t interval_s)
+{
+    const uint8_t data[] = {
+        0x00,   // sub-command: interval
+        (uint8_t)(interval_s >> 24),
+        (uint8_t)(interval_s >> 16),
+        (uint8_t)(interval_s >> 8),
+        (uint8_t)interval_s
+    };
+
+    return send_command(AUTO_CLEAN_INTERVAL, data, sizeof(data));
 }
 
 
-void Sps30Driver::start_reading()
+Sps30Driver::Status Sps30Driver::read(Sps30Value& value)
 {
-    if (!_read_in_progress) {
-        _read_in_progress = true;
-        _serial_size = num_bytes_needed();
-        _serial.read(_serial_buf, _serial_size, callback(this, &Sps30Driver::rx_done));
 #ifdef MBED_DEBUG
-        ++rx_rq_stat;
+//    printf("SPS30 read: stat=%d, rxi= %lu, rxp=%lu, txd=%lu, err=%lu, bcnt=%lu\n", _status, rx_irq_stat, rx_process_stat, tx_done_stat, _decoder.get_errors(), total_bytes_stat);
+//    printf("PM1.0 = %lu, PM2.5 = %lu, PM10 = %lu\n", _value.pm_1_0, _value.pm_2_5, _value.pm_10);
 #endif // MBED_DEBUG
+    if (_status == STATUS_OK) {
+        value = _value;
     }
+    return _status;
 }
 
 
-void Sps30Driver::reset_frame()
+Sps30Driver::Status Sps30Driver::read(Sps30ExtendedValue& value)
 {
-    _serial.abort_read();
-    _read_in_progress = false;
-    _shdlc_length = 0;
-    _shdlc_state = SEARCH;
-    _status = STATUS_NOT_READY;
+    if (_status == STATUS_OK) {
+        value = _extended_value;
+    }
+    return _status;
 }
 
 
-void Sps30Driver::retrieve_data()
+Sps30Driver::Sps30Driver(RawSerial &serial) :
+    _serial(serial),
+    _ev_queue(NULL),
+    _rx_pending(false),
+    _rx_last(0),
+    _status(STATUS_NOT_READY)
 {
-    MBED_ASSERT(_shdlc_state == READY);
-    if (_frame.f.len == SPS30_DATA_SIZE) {
-        copy_uint32_be(_value.pm_1_0, &_frame.f.data[PM_1_0_OFFSET]);
-        copy_uint32_be(_value.pm_2_5, &_frame.f.data[PM_2_5_OFFSET]);
-        copy_uint32_be(_value.pm_10, &_frame.f.data[PM_10_OFFSET]);
-        _status = STATUS_OK;
-   } else {
-       // may got wrong (previous) frame, continue reading
-        _shdlc_length = 0;
-        _shdlc_state = SEARCH;
-        start_reading();
+}
+
+
+void Sps30Driver::start_reception(EventQueue& ev_queue)
+{
+    _ev_queue = &ev_queue;
+    _serial.attach(callback(this, &Sps30Driver::rx_irq), SerialBase::RxIrq);
+}
+
+
+int Sps30ConfigActuator::set_value(Sps30Config& value)
+{
+    int result = _sensor.configure(value);
+    if (result == 0) {
+        _value = value;
     }
+    // Let the client see the configuration actually in use.
+    update_notify();
+    return result;
 }
 
-void Sps30Driver::rx_done(int event)
+
+void Sps30Sensor::set_state(State state)
 {
-#ifdef MBED_DEBUG
-    ++rx_done_stat;
-#endif // MBED_DEBUG
-    if (event == SERIAL_EVENT_RX_COMPLETE) {
-        uint32_t index = 0;
-        while (index < _serial_size) {
-            shdlc_state_machine(_serial_buf[index++]);
-        }
-        _read_in_progress = false;
-        if (_shdlc_state == READY) {
-                retrieve_data();
-        } else {
-            // need more data
-            start_reading();
-        }
+    cancel_retry();
+    _state = state;
+    _state_time_ms = 0;
+}
+
+
+/** Start the fan, waking the sensor up first when needed.
+ */
+void Sps30Sensor::begin_measurement()
+{
+    _cycle_time_ms = 0;
+    if (_state == STATE_OFF) {
+        // Cleaning is scheduled here, disable sensor internal auto-cleaning.
+        _driver.send_auto_clean_interval(0);
     } else {
-        // error
-        _shdlc_state = ERROR;
-        _status = STATUS_RX_ERROR;
-        _read_in_progress = false;
+        _driver.send_wake_up();
     }
+    set_state(STATE_SPIN_UP);
+    _ev_queue->call_in(COMMAND_DELAY_MS, callback(this, &Sps30Sensor::start_fan));
 }
 
 
-void Sps30Driver::tx_done(int event)
+void Sps30Sensor::start_fan()
 {
-#ifdef MBED_DEBUG
-    ++tx_done_stat;
-#endif // MBED_DEBUG
-    if (event & SERIAL_EVENT_ERROR) {
-        // error
-        _shdlc_state = ERROR;
-        _status = STATUS_TX_ERROR;
+    _driver.send_start();
+    if (_spin_up_id) {
+        _ev_queue->cancel(_spin_up_id);
     }
+    _spin_up_id = _ev_queue->call_in(duty_cycled() ? SPIN_UP_MS : START_DELAY_MS,
+                                     callback(this, &Sps30Sensor::spin_up_done));
 }
 
 
-Sps30Driver::Status Sps30Driver::request_new_frame()
+void Sps30Sensor::spin_up_done()
 {
-#ifdef MBED_DEBUG
-    stuff_stat = 0;
-#endif // MBED_DEBUG
-    reset_frame();
-    start_reading();
-    _serial.write(sps30_command_read_bytes, sizeof(sps30_command_read_bytes), callback(this, &Sps30Driver::tx_done));
-    return STATUS_OK;
+    _spin_up_id = 0;
+    if (_state == STATE_SPIN_UP) {
+        set_state(STATE_MEASURING);
+        _retries = 0;
+        send_request();
+    }
 }
 
 
-Sps30Driver::Status Sps30Driver::send_start()
+/** Stop the fan and put the sensor to sleep.
+ */
+void Sps30Sensor::end_measurement()
 {
-    _serial.write(sps30_command_start_bytes, sizeof(sps30_command_start_bytes),NULL);
-    return STATUS_OK;
+    _waiting = false;
+    if (_timeout_id) {
+        _ev_queue->cancel(_timeout_id);
+        _timeout_id = 0;
+    }
+    _driver.send_stop();
+    set_state(STATE_SLEEPING);
+    _ev_queue->call_in(COMMAND_DELAY_MS, callback(this, &Sps30Sensor::go_sleep));
 }
 
 
-
-Sps30Driver::Status Sps30Driver::read(Sps30Value& value)
+void Sps30Sensor::go_sleep()
 {
-#ifdef MBED_DEBUG
-//    printf("SPS30 read: shdlc=%d, stat=%d, rxq= %lu, rxd=%lu, txd=%lu, stuff=%lu, bcnt=%lu\n", _shdlc_state, _status, rx_rq_stat, rx_done_stat, tx_done_stat, stuff_stat, total_bytes_stat);
-//    printf("PM1.0 = %lu, PM2.5 = %lu, PM10 = %lu\n", _value.pm_1_0, _value.pm_2_5, _value.pm_10);
-#endif // MBED_DEBUG
-    if (_status == STATUS_OK) {
-        value = _value;
+    if (_state == STATE_SLEEPING) {
+        _driver.send_sleep();
     }
-    return _status;
 }
 
 
-Sps30Driver::Sps30Driver(RawSerial &serial) :
-    _serial(serial),
-    _read_in_progress(false),
-    _shdlc_state(ERROR),
-    _shdlc_length(0),
-    _status(STATUS_NOT_READY)
+int Sps30Sensor::configure(const Sps30Config& config)
 {
-    for (uint32_t i = 0; i < sizeof(sps30_command_reset_bytes); ++i) {
-        _serial.putc(sps30_command_reset_bytes[i]);
+    if ((config.period_s != 0) &&
+        ((config.active_s < MIN_ACTIVE_S) || (config.active_s >= config.period_s))) {
+        return -1;
     }
+    _config = config;
+    // Start a new cycle.
+    _cycle_time_ms = 0;
+    if (_state == STATE_SLEEPING) {
+        begin_measurement();
+    }
+    return 0;
 }
 
 
-/** Callback function periodically updating sensor value.
+/** Callback function periodically updating sensor value and running the schedule.
  */
 void Sps30Sensor::updater()
 {
-    if (_started) {
-        if (_driver.read(_value) == Sps30Driver::STATUS_OK) {
-            update_notify();
-        }
-        _driver.request_new_frame();
+    _state_time_ms += MEASUREMENT_PERIOD_MS;
+    _cycle_time_ms += MEASUREMENT_PERIOD_MS;
+    if ((_state != STATE_OFF) && (_state != STATE_SLEEPING)) {
+        _fan_time_s += MEASUREMENT_PERIOD_MS / 1000;
+    }
+
+    switch (_state) {
+        case STATE_OFF:
+            begin_measurement();
+            break;
+
+        case STATE_SLEEPING:
+            if (_cycle_time_ms >= _config.period_s * 1000UL) {
+                begin_measurement();
+            }
+            break;
+
+        case STATE_SPIN_UP:
+            // Ends by spin_up_done()
+            break;
+
+        case STATE_MEASURING:
+            if (duty_cycled() && (_cycle_time_ms >= _config.active_s * 1000UL)) {
+                end_measurement();
+            } else if ((_config.clean_interval_h != 0) && (_fan_time_s >= _config.clean_interval_h * 3600UL)) {
+                _waiting = false;
+                _driver.send_fan_cleaning();
+                _fan_time_s = 0;
+                set_state(STATE_CLEANING);
+            } else {
+                _retries = 0;
+                send_request();
+            }
+            break;
+
+        case STATE_CLEANING:
+            if (_state_time_ms >= CLEANING_TIME_MS) {
+                set_state(STATE_MEASURING);
+                _retries = 0;
+                send_request();
+            }
+            break;
+    }
+}
+
+
+void Sps30Sensor::send_request()
+{
+    // Pending retries are dropped when measurement has been stopped.
+    if (_state != STATE_MEASURING) {
+        return;
+    }
+    // Periodic request supersedes a scheduled retry.
+    cancel_retry();
+    if (_timeout_id) {
+        _ev_queue->cancel(_timeout_id);
+    }
+    _waiting = true;
+    _driver.request_new_frame();
+    _timeout_id = _ev_queue->call_in(RESPONSE_TIMEOUT_MS, callback(this, &Sps30Sensor::on_timeout));
+}
+
+
+void Sps30Sensor::retry()
+{
+    _waiting = false;
+    if (_retries < MAX_RETRIES) {
+        ++_retries;
+        cancel_retry();
+        _retry_id = _ev_queue->call_in(RETRY_DELAY_MS, callback(this, &Sps30Sensor::retry_request));
+    }
+}
+
+
+void Sps30Sensor::retry_request()
+{
+    _retry_id = 0;
+    send_request();
+}
+
+
+void Sps30Sensor::cancel_retry()
+{
+    if (_retry_id) {
+        _ev_queue->cancel(_retry_id);
+        _retry_id = 0;
+    }
+}
+
+
+/** Response from the driver, values are published as soon as they arrive.
+ */
+void Sps30Sensor::on_response(Sps30Driver::Status status)
+{
+    if (!_waiting) {
+        return;
+    }
+    if (_timeout_id) {
+        _ev_queue->cancel(_timeout_id);
+        _timeout_id = 0;
+    }
+    if (status == Sps30Driver::STATUS_OK) {
+        Sps30ExtendedValue extended;
+
+        _waiting = false;
+        cancel_retry();
+        _driver.read(_value);
+        update_notify();
+        _driver.read(extended);
+        _extended.update(extended);
     } else {
-        _driver.send_start();
-        _started = true;
+        retry();
     }
 }
 
 
-/** Initialize driver and setup periodic sensor updates.
+void Sps30Sensor::on_timeout()
+{
+    _timeout_id = 0;
+    if (_waiting) {
+        retry();
+    }
+}
+
+
+/** Sleeping sensor does not answer, it is woken up before the request.
  */
-void Sps30Sensor::start(EventQueue& ev_queue)
+void Sps30Sensor::probe(EventQueue& ev_queue, Callback<void(bool)> done)
+{
+    _ev_queue = &ev_queue;
+    _probe_done = done;
+    _driver.attach(callback(this, &Sps30Sensor::on_probe_response));
+    _driver.start_reception(ev_queue);
+    _driver.send_wake_up();
+    _ev_queue->call_in(COMMAND_DELAY_MS, callback(this, &Sps30Sensor::probe_request));
+}
+
+
+void Sps30Sensor::probe_request()
 {
-    ev_queue.call_every(5000, callback(this, &Sps30Sensor::updater));
+    _driver.request_new_frame();
+    _timeout_id = _ev_queue->call_in(PROBE_TIMEOUT_MS, callback(this, &Sps30Sensor::on_probe_timeout));
+}
+
+
+void Sps30Sensor::on_probe_response(Sps30Driver::Status status)
+{
+    // Only measurement responses are reported, the Wake-up acknowledge is not.
+    if (_timeout_id) {
+        _ev_queue->cancel(_timeout_id);
+        _timeout_id = 0;
+        _probe_done(true);
+    }
 }
 
 
+void Sps30Sensor::on_probe_timeout()
+{
+    _timeout_id = 0;
+    _probe_done(false);
+}
+
+
+void Sps30Sensor::reset_sensor()
+{
+    _driver.send_reset();
+    _ev_queue->call_in(RESET_TIME_MS, callback(this, &Sps30Sensor::begin_measurement));
+}
+
+
+/** Initialize driver and setup periodic sensor updates.
+ * Sensor is reset in the background, measurement starts as soon
+ * as the reset is complete rather than on the first scheduler step.
+ * The sensor keeps sleeping over a reset of the board with its serial
+ * interface off, so it is woken up before the reset command.
+ */
+void Sps30Sensor::start(EventQueue& ev_queue)
+{
+    _ev_queue = &ev_queue;
+    _driver.attach(callback(this, &Sps30Sensor::on_response));
+    _driver.start_reception(ev_queue);
+    _driver.send_wake_up();
+    ev_queue.call_in(COMMAND_DELAY_MS, callback(this, &Sps30Sensor::reset_sensor));
+    ev_queue.call_every(MEASUREMENT_PERIOD_MS, callback(this, &Sps30Sensor::updater));
+}
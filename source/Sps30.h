@@ -20,6 +20,8 @@
 #include <stdint.h>
 #include <mbed.h>
 #include "Sensor.h"
+#include "Actuator.h"
+#include "Shdlc.h"
 
 
 /** Represents measurement result received from SPS30 particulate matter sensor.
@@ -33,6 +35,85 @@ struct Sps30Value {
 };
 
 
+/** Complete SPS30 measurement record in fixed-point units.
+ * When this matches format of the sensor characteristic then
+ * no conversion is needed.
+ */
+struct Sps30ExtendedValue {
+    uint16_t    mass_pm_1_0;    //<! mass concentration PM1.0, 0.1 ug/m3
+    uint16_t    mass_pm_2_5;    //<! mass concentration PM2.5, 0.1 ug/m3
+    uint16_t    mass_pm_4_0;    //<! mass concentration PM4.0, 0.1 ug/m3
+    uint16_t    mass_pm_10;     //<! mass concentration PM10, 0.1 ug/m3
+    uint16_t    num_pm_0_5;     //<! number concentration PM0.5, 0.1 #/cm3
+    uint16_t    num_pm_1_0;     //<! number concentration PM1.0, 0.1 #/cm3
+    uint16_t    num_pm_2_5;     //<! number concentration PM2.5, 0.1 #/cm3
+    uint16_t    num_pm_4_0;     //<! number concentration PM4.0, 0.1 #/cm3
+    uint16_t    num_pm_10;      //<! number concentration PM10, 0.1 #/cm3
+    uint16_t    typical_size;   //<! typical particle size, nm
+};
+
+
+namespace sequana {
+
+/** Notified on change of 5 % of any concentration (at least 1 ug/m3).
+ */
+template <> struct NotifyFilter<Sps30Value> {
+    static const uint32_t MAX_SILENCE_MS = 60000;
+
+    static bool changed(const Sps30Value& value, const Sps30Value& notified)
+    {
+        return outside_deadband(value.pm_1_0, notified.pm_1_0, 1, 50) ||
+               outside_deadband(value.pm_2_5, notified.pm_2_5, 1, 50) ||
+               outside_deadband(value.pm_10, notified.pm_10, 1, 50);
+    }
+};
+
+
+/** Notified on change of 5 % of any concentration (at least 0.5 units)
+ * or typical particle size (at least 20 nm).
+ */
+template <> struct NotifyFilter<Sps30ExtendedValue> {
+    static const uint32_t MAX_SILENCE_MS = 60000;
+
+    static bool changed(const Sps30ExtendedValue& value, const Sps30ExtendedValue& notified)
+    {
+        return outside_deadband(value.mass_pm_1_0, notified.mass_pm_1_0, 5, 50) ||
+               outside_deadband(value.mass_pm_2_5, notified.mass_pm_2_5, 5, 50) ||
+               outside_deadband(value.mass_pm_4_0, notified.mass_pm_4_0, 5, 50) ||
+               outside_deadband(value.mass_pm_10, notified.mass_pm_10, 5, 50) ||
+               outside_deadband(value.num_pm_0_5, notified.num_pm_0_5, 5, 50) ||
+               outside_deadband(value.num_pm_1_0, notified.num_pm_1_0, 5, 50) ||
+               outside_deadband(value.num_pm_2_5, notified.num_pm_2_5, 5, 50) ||
+               outside_deadband(value.num_pm_4_0, notified.num_pm_4_0, 5, 50) ||
+               outside_deadband(value.num_pm_10, notified.num_pm_10, 5, 50) ||
+               outside_deadband(value.typical_size, notified.typical_size, 20, 50);
+    }
+};
+
+} //namespace
+
+
+/** Represents SPS30 power and maintenance schedule selectable by BLE clients.
+ */
+struct Sps30Config {
+    uint16_t    period_s;           //<! measurement cycle period, 0 for continuous measurement
+    uint16_t    active_s;           //<! fan running time per cycle, including spin-up
+    uint16_t    clean_interval_h;   //<! fan cleaning interval in fan running hours, 0 disables cleaning
+
+    Sps30Config(const uint8_t *data) :
+        period_s((uint16_t)(data[0] | (data[1] << 8))),
+        active_s((uint16_t)(data[2] | (data[3] << 8))),
+        clean_interval_h((uint16_t)(data[4] | (data[5] << 8)))
+    {}
+
+    Sps30Config() :
+        period_s(0),
+        active_s(0),
+        clean_interval_h(168)
+    {}
+};
+
+
 /** Driver for SPS30 sensor.
  */
 class Sps30Driver {
@@ -54,12 +135,23 @@ public:
     Sps30Driver(RawSerial &serial);
 
     /** Request new measurement result.
-     * Result of the measurement is stored internally.
+     * Result of the measurement is stored internally and the response
+     * callback is called when the response arrives.
      *
      * @returns operation status
      */
     Status request_new_frame();
 
+    /** Register response callback.
+     *
+     * Called from the event queue when a measurement response has been
+     * received: STATUS_OK with a new result, STATUS_NOT_READY when the
+     * sensor has no new result yet or STATUS_PROTOCOL_ERROR.
+     *
+     * @param func callback function
+     */
+    void attach(Callback<void(Status)> func) { _response_cb = func; }
+
     /** Read the last obtained measurement result.
      *
      * @param value measurement result
@@ -67,12 +159,65 @@ public:
      */
     Status read(Sps30Value& value);
 
+    /** Read the last obtained complete measurement record.
+     *
+     * @param value measurement result
+     * @returns operation status
+     */
+    Status read(Sps30ExtendedValue& value);
+
+    /** Send 'reset' command to the sensor.
+     *
+     * @returns operation status
+     */
+    Status send_reset();
+
     /** Send 'start measurement' command to the sensor..
      *
      * @returns operation status
      */
     Status send_start();
 
+    /** Send 'stop measurement' command to the sensor.
+     *
+     * @returns operation status
+     */
+    Status send_stop();
+
+    /** Send 'sleep' command to the sensor, allowed only when measurement is stopped.
+     *
+     * @returns operation status
+     */
+    Status send_sleep();
+
+    /** Wake the sensor up from sleep mode.
+     *
+     * @returns operation status
+     */
+    Status send_wake_up();
+
+    /** Start fan cleaning, allowed only when measuring.
+     *
+     * @returns operation status
+     */
+    Status send_fan_cleaning();
+
+    /** Set sensor internal fan auto-cleaning interval.
+     *
+     * @param interval_s interval in seconds, 0 disables auto-cleaning
+     * @returns operation status
+     */
+    Status send_auto_clean_interval(uint32_t interval_s);
+
+    /** Start continuous reception.
+     *
+     * Received bytes are buffered in interrupt context,
+     * frames are decoded on the event queue.
+     *
+     * @param ev_queue event queue used to process received data
+     */
+    void start_reception(EventQueue& ev_queue);
+
 protected:
     /** SPS30 commands.
      */
@@ -80,66 +225,84 @@ protected:
         START_MEASUREMENT   = 0x00,
         STOP_MEASUREMENT    = 0x01,
         READ_MEASURED_VALUE = 0x03,
+        SLEEP               = 0x10,
+        WAKE_UP             = 0x11,
+        START_FAN_CLEANING  = 0x56,
         AUTO_CLEAN_INTERVAL = 0x80,
         DEVICE_INFORMATION  = 0xd0,
         RESET               = 0xd3
     };
 
-    static const uint8_t SHDLC_FRAME_START_SYMBOL = 0x7E;
-    static const uint8_t SHDLC_FRAME_STUFF_SYMBOL = 0x7D;
+    static const uint8_t SHDLC_ADDRESS              = 0x00;
 
-    static const size_t SHDLC_DATA_MAX_LEN          = 255;
-    static const size_t SHDLC_MISO_HDR_LENGTH       = 4;
-    static const size_t SHDLC_MISO_FRAME_MAX_SIZE   = SHDLC_MISO_HDR_LENGTH + SHDLC_DATA_MAX_LEN + 2;
-    static const size_t SHDLC_MISO_FRAME_MIN_SIZE   = SHDLC_MISO_HDR_LENGTH + 2; // header + checksum + (ending)start symbol
+    // Holds at least one fully stuffed frame of maximum length.
+    static const uint32_t RX_BUFFER_SIZE            = 1024;
+    static const uint32_t RX_CHUNK_SIZE             = 64;
 
-    struct SHDLCFrame {
-        uint8_t addr;
-        uint8_t cmd;
-        uint8_t state;
-        uint8_t len;
-        uint8_t data[SHDLC_DATA_MAX_LEN];
-    };
-
-    union SHDLCRawFrame {
-        struct SHDLCFrame   f;
-        uint8_t             raw[SHDLC_MISO_FRAME_MAX_SIZE];
-    };
-
-    enum SHDLCState {
-        ERROR = 0,
-        READY,
-        SEARCH,
-        STUFF,
-        GET
-    };
+    // Largest command frame sent, stuffed, preceded by the wake-up byte.
+    static const uint32_t TX_BUFFER_SIZE            = 33;
+    static const uint8_t WAKE_UP_BYTE               = 0xFF;
 
 protected:
-    void    shdlc_state_machine(uint8_t data);
-    bool    shdlc_frame_is_valid();
-    uint8_t shdlc_frame_checksum();
-    uint32_t num_bytes_needed();
-    void    error_recovery();
+    Status  send_command(Command cmd, const uint8_t *data, uint8_t len, bool wake_up = false);
     void    retrieve_data();
-    void    reset_frame();
-    void    start_reading();
-    void    rx_done(int event);
+    void    rx_irq();
+    void    process_rx();
     void    tx_done(int event);
 
 protected:
     Sps30Value      _value;
+    Sps30ExtendedValue _extended_value;
+    Callback<void(Status)> _response_cb;
     RawSerial       &_serial;
-    bool            _read_in_progress;
-    SHDLCState      _shdlc_state;
-    uint32_t        _shdlc_length;
+    EventQueue      *_ev_queue;
+    volatile bool   _rx_pending;
+    uint8_t         _rx_last;
     Status          _status;
-    size_t          _serial_size;
-    SHDLCRawFrame   _frame;
-    uint8_t         _serial_buf[SHDLC_MISO_FRAME_MAX_SIZE + 1];
+    ShdlcDecoder    _decoder;
+    CircularBuffer<uint8_t, RX_BUFFER_SIZE> _rx_buffer;
+    uint8_t         _tx_buffer[TX_BUFFER_SIZE];
+
+};
 
+/** SPS30 complete measurement record interface.
+ * Updated together with the main particulate matter sensor.
+ */
+class Sps30ExtendedSensor : public Sensor<Sps30ExtendedValue> {
+public:
+    virtual void start(EventQueue& ev_queue) {}
+
+    /** Publish new value.
+     */
+    void update(const Sps30ExtendedValue& value)
+    {
+        _value = value;
+        update_notify();
+    }
 };
 
+
+class Sps30Sensor;
+
+/** SPS30 schedule configuration interface.
+ */
+class Sps30ConfigActuator : public Actuator<Sps30Config> {
+public:
+    Sps30ConfigActuator(Sps30Sensor &sensor) : _sensor(sensor) {}
+
+    virtual void    start(EventQueue& ev_queue) {}
+    virtual int     set_value(Sps30Config& value);
+
+protected:
+    Sps30Sensor &_sensor;
+};
+
+
 /** SPS30 particulate matter sensor interface.
+ *
+ * Besides measurement, the sensor interface schedules power and maintenance:
+ * the sensor can sleep between measurement windows and the fan is cleaned
+ * periodically.
  */
 class Sps30Sensor : public Sensor<Sps30Value> {
 public:
@@ -147,16 +310,115 @@ public:
      *
      * @param serial RawSerial interface to use for communication.
      */
-    Sps30Sensor(RawSerial &serial) : _driver(serial), _started(false) {}
+    Sps30Sensor(RawSerial &serial) :
+        _driver(serial),
+        _config_actuator(*this),
+        _state(STATE_OFF),
+        _state_time_ms(0),
+        _cycle_time_ms(0),
+        _fan_time_s(0),
+        _ev_queue(NULL),
+        _spin_up_id(0),
+        _timeout_id(0),
+        _retry_id(0),
+        _retries(0),
+        _waiting(false)
+    {}
 
     /** Schedule measurement process.
      */
     virtual void start(EventQueue& ev_queue);
 
+    /** Check whether the sensor answers on the serial line.
+     *
+     * Sensor is woken up first, then any response to a measurement
+     * request, including an error reported by an idle sensor, means
+     * it is present.
+     *
+     * @param ev_queue event queue used to process received data
+     * @param done called with the result
+     */
+    void probe(EventQueue& ev_queue, Callback<void(bool)> done);
+
+    /** Get complete measurement record interface.
+     */
+    Sensor<Sps30ExtendedValue>& get_extended() { return _extended; }
+
+    /** Get schedule configuration interface.
+     */
+    Actuator<Sps30Config>& get_config() { return _config_actuator; }
+
+    /** Change power and maintenance schedule.
+     *
+     * @param config new schedule
+     * @returns 0 when success, (-1) when configuration is invalid
+     */
+    int configure(const Sps30Config& config);
+
 protected:
+    enum State {
+        STATE_OFF = 0,
+        STATE_SLEEPING,
+        STATE_SPIN_UP,
+        STATE_MEASURING,
+        STATE_CLEANING
+    };
+
+    // Measurement period, also scheduler time step.
+    static const uint32_t MEASUREMENT_PERIOD_MS = 5000;
+    // Delay from measurement start to the first result in continuous mode.
+    static const uint32_t START_DELAY_MS        = 1000;
+    // Delay from measurement start to stable results when waking up.
+    static const uint32_t SPIN_UP_MS            = 30000;
+    // Fan cleaning takes 10 s, results are not published meanwhile.
+    static const uint32_t CLEANING_TIME_MS      = 15000;
+    // Delay between consecutive control commands.
+    static const uint32_t COMMAND_DELAY_MS      = 50;
+    // Delay from reset to the first command.
+    static const uint32_t RESET_TIME_MS         = 100;
+    // Active window must allow spin-up and at least one measurement.
+    static const uint32_t MIN_ACTIVE_S          = (SPIN_UP_MS + MEASUREMENT_PERIOD_MS) / 1000;
+    // Response is expected within a few frame times.
+    static const uint32_t RESPONSE_TIMEOUT_MS   = 100;
+    static const uint32_t RETRY_DELAY_MS        = 200;
+    static const uint32_t MAX_RETRIES           = 3;
+    // Allows for the sensor start-up after power on.
+    static const uint32_t PROBE_TIMEOUT_MS      = 200;
+
     void updater();
+    void reset_sensor();
+    bool duty_cycled() const { return _config.period_s != 0; }
+    void set_state(State state);
+    void begin_measurement();
+    void start_fan();
+    void spin_up_done();
+    void end_measurement();
+    void go_sleep();
+    void send_request();
+    void on_response(Sps30Driver::Status status);
+    void on_timeout();
+    void retry();
+    void retry_request();
+    void cancel_retry();
+    void probe_request();
+    void on_probe_response(Sps30Driver::Status status);
+    void on_probe_timeout();
+
     Sps30Driver _driver;
-    bool _started;
+    Sps30ExtendedSensor _extended;
+    Sps30ConfigActuator _config_actuator;
+    Sps30Config _config;
+    State _state;
+    uint32_t _state_time_ms;
+    uint32_t _cycle_time_ms;
+    uint32_t _fan_time_s;
+    EventQueue *_ev_queue;
+    int _spin_up_id;
+    int _timeout_id;
+    int _retry_id;
+    uint32_t _retries;
+    bool _waiting;
+    Callback<void(bool)> _probe_done;
 };
 
 
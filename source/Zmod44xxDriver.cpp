@@ -17,18 +17,260 @@
 #include <mbed.h>
 #include "Zmod44xxDriver.h"
 
-// This is just a temporary stub driver.
+
+// Initialization sequence measures ADC range limits.
+const Zmod44xxDriver::Profile Zmod44xxDriver::INIT_PROFILE = {
+    80,
+    { 0x00, 0x28 }, 2,
+    { 0xC3, 0xE3 }, 2,
+    { 0x00, 0x00, 0x80, 0x40 }, 4,
+    REG_INIT_RESULT, 4
+};
+
+// Continuous IAQ measurement, single heater step.
+const Zmod44xxDriver::Profile Zmod44xxDriver::MEASUREMENT_PROFILE = {
+    -600,
+    { 0x20, 0x04, 0x20, 0x04 }, 4,
+    { 0x03 }, 1,
+    { 0x00, 0x00, 0x80, 0x08 }, 4,
+    REG_RESULT, 2
+};
+
+
+Zmod44xxDriver::Zmod44xxDriver(I2CBus& bus, uint8_t addr, DigitalOut &reset_pin, uint32_t sample_period_ms) :
+    _bus(bus),
+    _xfer(addr, I2CBus::FREQUENCY_FAST),
+    _reset(reset_pin),
+    _estimator(sample_period_ms),
+    _profile(NULL),
+    _state(STATE_IDLE),
+    _status(STATUS_NOT_READY),
+    _step(0),
+    _adc_low(0),
+    _adc_high(0)
+{
+    memset(_config, 0, sizeof(_config));
+    _xfer.tx_data = _buffer;
+    _xfer.done = callback(this, &Zmod44xxDriver::on_transfer);
+}
+
 
 Zmod44xxDriver::Status Zmod44xxDriver::read(uint32_t &tvoc, uint32_t &eco2, uint8_t &iaq)
 {
-    tvoc = 1.0;
-    eco2 = 200;
-    iaq = 1;
+    Status status = _status;
 
-    return STATUS_OK;
+    if (_xfer.degraded()) {
+        // Device stopped responding, cycles are still started so it can come back.
+        return STATUS_STALLED;
+    }
+
+    if (status == STATUS_OK) {
+        const IaqEstimate& estimate = _estimator.get_estimate();
+        tvoc = estimate.tvoc;
+        eco2 = estimate.eco2;
+        iaq = estimate.iaq;
+        _status = STATUS_NOT_READY;
+    }
+    return status;
 }
 
+
 void Zmod44xxDriver::init_chip(void)
 {
+    _estimator.reset();
+    _profile = NULL;
+    _status = STATUS_NOT_READY;
+    _state = STATE_RESET;
+    _reset = 0;
+    _bus.get_event_queue().call_in(RESET_TIME_MS, callback(this, &Zmod44xxDriver::reset_done));
+}
+
+
+void Zmod44xxDriver::reset_done()
+{
+    _reset = 1;
+    _bus.get_event_queue().call_in(STARTUP_TIME_MS, callback(this, &Zmod44xxDriver::startup_done));
+}
+
+
+void Zmod44xxDriver::startup_done()
+{
+    _buffer[0] = REG_PID;
+    _xfer.tx_length = 1;
+    _xfer.rx_data = &_buffer[1];
+    _xfer.rx_length = 2;
+    _state = STATE_PID;
+    _bus.submit(_xfer);
+}
+
+
+void Zmod44xxDriver::start_measurement(void)
+{
+    if (_state == STATE_IDLE) {
+        start_sequence();
+    }
 }
 
+
+/** Write heater, delay, measurement and sequencer blocks of the profile.
+ */
+void Zmod44xxDriver::program(const Profile& profile)
+{
+    _profile = &profile;
+    _step = 0;
+    _state = STATE_PROGRAM;
+    program_next();
+}
+
+
+void Zmod44xxDriver::program_next()
+{
+    const uint8_t *data;
+    uint32_t length;
+
+    switch (_step++) {
+        case 0: {
+            // Heater set point is scaled by sensor specific calibration.
+            int64_t hsp = (-((int64_t)_config[2] * 256 + _config[3]) *
+                           (((int64_t)_config[4] + 640) * ((int64_t)_config[5] + _profile->heater) - 512000)) / 12288000;
+            _buffer[0] = REG_HEATER;
+            _buffer[1] = (char)(hsp >> 8);
+            _buffer[2] = (char)hsp;
+            _xfer.tx_length = 3;
+            _xfer.rx_length = 0;
+            _bus.submit(_xfer);
+            return;
+        }
+        case 1:
+            _buffer[0] = REG_DELAY;
+            data = _profile->delay;
+            length = _profile->delay_length;
+            break;
+        case 2:
+            _buffer[0] = REG_MEASUREMENT;
+            data = _profile->measurement;
+            length = _profile->measurement_length;
+            break;
+        case 3:
+            _buffer[0] = REG_SEQUENCER;
+            data = _profile->sequencer;
+            length = _profile->sequencer_length;
+            break;
+        default:
+            // Initialization runs right away, measurements are started by the user.
+            if (_profile == &INIT_PROFILE) {
+                start_sequence();
+            } else {
+                _state = STATE_IDLE;
+            }
+            return;
+    }
+    memcpy(&_buffer[1], data, length);
+    _xfer.tx_length = 1 + length;
+    _xfer.rx_length = 0;
+    _bus.submit(_xfer);
+}
+
+
+void Zmod44xxDriver::start_sequence()
+{
+    _buffer[0] = REG_COMMAND;
+    _buffer[1] = COMMAND_START;
+    _xfer.tx_length = 2;
+    _xfer.rx_length = 0;
+    _state = STATE_START;
+    _bus.submit(_xfer);
+}
+
+
+void Zmod44xxDriver::check_status()
+{
+    _buffer[0] = REG_STATUS;
+    _xfer.tx_length = 1;
+    _xfer.rx_data = &_buffer[1];
+    _xfer.rx_length = 1;
+    _state = STATE_STATUS;
+    _bus.submit(_xfer);
+}
+
+
+void Zmod44xxDriver::on_transfer(int result)
+{
+    if (result != 0) {
+        // Sensor that does not initialize is reported as stalled.
+        if (_profile != &MEASUREMENT_PROFILE) {
+            _state = STATE_FAILED;
+            _status = STATUS_STALLED;
+        } else {
+            _state = STATE_IDLE;
+            _status = STATUS_NOT_READY;
+        }
+        return;
+    }
+
+    switch (_state) {
+        case STATE_PID:
+            if ((((uint16_t)(uint8_t)_buffer[1] << 8) | (uint8_t)_buffer[2]) != ZMOD4410_PID) {
+                _state = STATE_FAILED;
+                _status = STATUS_STALLED;
+                return;
+            }
+            _buffer[0] = REG_CONFIG;
+            _xfer.tx_length = 1;
+            _xfer.rx_data = (char *)_config;
+            _xfer.rx_length = CONFIG_SIZE;
+            _state = STATE_CONFIG;
+            _bus.submit(_xfer);
+            break;
+
+        case STATE_CONFIG:
+            program(INIT_PROFILE);
+            break;
+
+        case STATE_PROGRAM:
+            program_next();
+            break;
+
+        case STATE_START:
+            _state = STATE_SEQUENCE;
+            _bus.get_event_queue().call_in(SEQUENCE_TIME_MS, callback(this, &Zmod44xxDriver::check_status));
+            break;
+
+        case STATE_STATUS:
+            if (_buffer[1] & STATUS_SEQUENCER_RUNNING) {
+                _state = STATE_SEQUENCE;
+                _bus.get_event_queue().call_in(STATUS_POLL_MS, callback(this, &Zmod44xxDriver::check_status));
+                break;
+            }
+            _buffer[0] = _profile->result;
+            _xfer.rx_length = _profile->result_length;
+            _state = STATE_RESULT;
+            _bus.submit(_xfer);
+            break;
+
+        case STATE_RESULT:
+            on_result();
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+void Zmod44xxDriver::on_result()
+{
+    const uint8_t *data = (const uint8_t *)&_buffer[1];
+    uint16_t adc = ((uint16_t)data[0] << 8) | data[1];
+
+    if (_profile == &INIT_PROFILE) {
+        _adc_low = adc;
+        _adc_high = ((uint16_t)data[2] << 8) | data[3];
+        program(MEASUREMENT_PROFILE);
+        return;
+    }
+
+    _state = STATE_IDLE;
+    float rmox = IaqEstimator::resistance(adc, _adc_low, _adc_high, _config[0]);
+    _status = _estimator.add_sample(rmox) ? STATUS_OK : STATUS_NOT_READY;
+}
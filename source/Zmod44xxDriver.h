@@ -18,7 +18,15 @@
 #define ZMOD44XX_DRIVER_H_
 
 #include <mbed.h>
+#include "I2CBus.h"
+#include "IaqEstimator.h"
 
+/** Driver for ZMOD4410 gas sensor.
+ *
+ * Heater profile is programmed into the sensor sequencer at initialization,
+ * each measurement runs the sequence once. All steps are driven by bus
+ * completions and event queue timers, nothing blocks.
+ */
 class Zmod44xxDriver {
 public:
     enum Status {
@@ -28,16 +36,126 @@ public:
     };
 
 public:
-    Zmod44xxDriver(I2C& bus, uint8_t addr, DigitalOut &reset_pin) : _i2c(bus), _addr(addr), _reset(reset_pin) {};
+    /** Create driver.
+     *
+     * @param bus I2C bus to use for communication
+     * @param addr I2C address to use
+     * @param reset_pin sensor reset pin
+     * @param sample_period_ms interval at which measurements are started
+     */
+    Zmod44xxDriver(I2CBus& bus, uint8_t addr, DigitalOut &reset_pin, uint32_t sample_period_ms);
 
+    /** Read values estimated from the last measurement.
+     *
+     * Each result is returned only once. STATUS_NOT_READY is returned until
+     * the next measurement completes or while the estimator warms up,
+     * STATUS_STALLED when the sensor failed to initialize or does not
+     * respond on the bus.
+     *
+     * @param tvoc total volatile organic compounds, 0.01 mg/m3
+     * @param eco2 estimated CO2 level, ppm
+     * @param iaq indoor air quality rating, 0.1 units
+     */
     Status read(uint32_t &tvoc, uint32_t &eco2, uint8_t &iaq);
 
+    /** Reset the sensor, check its identity and program heater profile.
+     */
     void init_chip(void);
 
+    /** Set ambient conditions for compensation of the following measurements.
+     *
+     * @param temperature temperature, 0.01 deg C
+     * @param humidity relative humidity, %
+     */
+    void set_ambient(int16_t temperature, uint16_t humidity)
+    {
+        _estimator.set_ambient(temperature / 100.0f, humidity);
+    }
+
+    /** Start next measurement.
+     * Result is fetched automatically when the sequence completes.
+     */
+    void start_measurement(void);
+
+protected:
+    enum Register {
+        REG_PID             = 0x00,
+        REG_CONFIG          = 0x20,
+        REG_HEATER          = 0x40,
+        REG_DELAY           = 0x50,
+        REG_MEASUREMENT     = 0x60,
+        REG_SEQUENCER       = 0x68,
+        REG_COMMAND         = 0x93,
+        REG_STATUS          = 0x94,
+        REG_INIT_RESULT     = 0x97,
+        REG_RESULT          = 0x99
+    };
+
+    static const uint16_t ZMOD4410_PID          = 0x2310;
+    static const uint8_t STATUS_SEQUENCER_RUNNING = 0x80;
+    static const uint8_t COMMAND_START          = 0x80;
+    static const uint32_t CONFIG_SIZE           = 6;
+    static const uint32_t MAX_BLOCK_SIZE        = 4;
+
+    // Reset pulse and start-up, timer resolution.
+    static const uint32_t RESET_TIME_MS         = 1;
+    static const uint32_t STARTUP_TIME_MS       = 2;
+    // First status check after sequence start, then poll interval.
+    static const uint32_t SEQUENCE_TIME_MS      = 50;
+    static const uint32_t STATUS_POLL_MS        = 10;
+
+    /** Sensor sequencer program.
+     */
+    struct Profile {
+        int16_t         heater;         // heater set point before calibration
+        uint8_t         delay[MAX_BLOCK_SIZE];
+        uint8_t         delay_length;
+        uint8_t         measurement[MAX_BLOCK_SIZE];
+        uint8_t         measurement_length;
+        uint8_t         sequencer[MAX_BLOCK_SIZE];
+        uint8_t         sequencer_length;
+        uint8_t         result;         // result register
+        uint8_t         result_length;
+    };
+
+    static const Profile INIT_PROFILE;
+    static const Profile MEASUREMENT_PROFILE;
+
+    enum State {
+        STATE_IDLE,
+        STATE_RESET,
+        STATE_PID,
+        STATE_CONFIG,
+        STATE_PROGRAM,
+        STATE_START,
+        STATE_SEQUENCE,
+        STATE_STATUS,
+        STATE_RESULT,
+        STATE_FAILED
+    };
+
+    void reset_done();
+    void startup_done();
+    void program(const Profile& profile);
+    void program_next();
+    void start_sequence();
+    void check_status();
+    void on_transfer(int result);
+    void on_result();
+
 protected:
-    I2C&        _i2c;
-    uint8_t     _addr;
-    DigitalOut& _reset;
+    I2CBus&         _bus;
+    I2CTransaction  _xfer;
+    DigitalOut&     _reset;
+    IaqEstimator    _estimator;
+    const Profile   *_profile;
+    char            _buffer[MAX_BLOCK_SIZE + 1];
+    uint8_t         _config[CONFIG_SIZE];
+    State           _state;
+    Status          _status;
+    uint32_t        _step;
+    uint16_t        _adc_low;
+    uint16_t        _adc_high;
 };
 
 
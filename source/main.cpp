@@ -31,6 +31,8 @@
 #include "ComboEnvSensor.h"
 #include "AirQSensor.h"
 #include "OccupancySensor.h"
+#include "ShieldProbe.h"
+#include "NvStorage.h"
 
 #ifndef MCU_PSoC6_M0
 
@@ -42,10 +44,9 @@ static const uint8_t ZMOD44XX_ADDR = 0x64;
 static const uint8_t SCD30_ADDR = 0xc2;
 
 
-I2C i2c1(I2C_SDA, I2C_SCL);
 SPI spi1(SPI_MOSI, SPI_MISO, SPI_CLK);
 RawSerial uart1(D1, D0);
-DigitalOut zmod1_reset(D3);
+DigitalOut zmod1_reset(D3, 1);
 
 #ifdef TARGET_FUTURE_SEQUANA
 const static char     DEVICE_NAME[] = "Sequana";
@@ -53,30 +54,36 @@ const static char     DEVICE_NAME[] = "Sequana";
 const static char     DEVICE_NAME[] = "SequanaEnvShield";
 #endif  //TARGET_FUTURE_SEQUANA
 
-static sequana::PrimaryService *sequana_service_ptr;
-
 static EventQueue event_queue(/* event count */ 64 * EVENTS_EVENT_SIZE);
 
+// Shared by all I2C sensor drivers, bus speed is set per device.
+I2CBus          i2c_bus(I2C_SDA, I2C_SCL, event_queue);
+
 
 #ifdef TARGET_FUTURE_SEQUANA
 Kx64Sensor      kx64(spi1, P9_5);
 #endif //TARGET_FUTURE_SEQUANA
 
 Sps30Sensor     sps30(uart1);
-ComboEnvSensor  combo(i2c1, AS7261_ADDR, HS3001_ADDR, P10_5, P10_4);
-AirQSensor      airq(i2c1, ZMOD44XX_ADDR, zmod1_reset, SCD30_ADDR);
+ComboEnvSensor  combo(i2c_bus, AS7261_ADDR, HS3001_ADDR, P10_5, P10_4, MBED_CONF_APP_AS7261_INT_PIN,
+                      (Hs3001Driver::Resolution)MBED_CONF_APP_HS3001_RESOLUTION);
+AirQSensor      airq(i2c_bus, ZMOD44XX_ADDR, zmod1_reset, SCD30_ADDR, MBED_CONF_APP_SCD30_RDY_PIN);
 RGBLedActuator  led_rgb;
 OccupancySensor occupancy(A2, A3);
+ShieldProbe     shield_probe(i2c_bus, AS7261_ADDR, HS3001_ADDR, ZMOD44XX_ADDR, SCD30_ADDR, sps30);
 
 class SequanaDemo : ble::Gap::EventHandler {
 public:
-    SequanaDemo(BLE &ble, events::EventQueue &event_queue, sequana::PrimaryService& primary_service) :
+    SequanaDemo(BLE &ble, events::EventQueue &event_queue) :
         _ble(ble),
         _event_queue(event_queue),
         _led1(LED1, 1),
         _connected(false),
+        _initialized(false),
+        _probed(false),
+        _devices(0),
         _primary_uuid(sequana::PrimaryService::UUID_SEQUANA_PRIMARY_SERVICE),
-        _primary_service(primary_service),
+        _primary_service(NULL),
         _adv_data_builder(_adv_buffer) { }
 
     void start() {
@@ -87,6 +94,16 @@ public:
         _event_queue.call_every(500, this, &SequanaDemo::blink);
     }
 
+    /** Shield devices found, the service is set up as soon as BLE is initialized.
+     */
+    void set_devices(uint32_t devices) {
+        _devices = devices;
+        _probed = true;
+        if (_initialized) {
+            setup_service();
+        }
+    }
+
 private:
     /** Callback triggered when the ble initialization process has finished */
     void on_init_complete(BLE::InitializationCompleteCallbackContext *params) {
@@ -95,10 +112,31 @@ private:
             return;
         }
 
-        _ble.gattServer().onDataWritten(this, &SequanaDemo::on_data_written);
-
         print_mac_address();
 
+        _initialized = true;
+        if (_probed) {
+            setup_service();
+        }
+    }
+
+    /** Primary service is registered once both BLE and the shield probe are done,
+     * clients never see the device without its characteristics.
+     */
+    void setup_service() {
+        _primary_service = new sequana::PrimaryService(_ble,
+                                                       _devices,
+#ifdef TARGET_FUTURE_SEQUANA
+                                                       kx64,
+#endif //TARGET_FUTURE_SEQUANA
+                                                       sps30,
+                                                       combo,
+                                                       airq,
+                                                       occupancy,
+                                                       led_rgb);
+
+        _ble.gattServer().onDataWritten(this, &SequanaDemo::on_data_written);
+
         start_advertising();
     }
 
@@ -152,6 +190,9 @@ private:
             printf("_ble.gap().startAdvertising() failed\r\n");
             return;
         }
+#ifdef MBED_DEBUG
+        printf("Advertising started at %lu ms\n", (uint32_t)rtos::Kernel::get_ms_count());
+#endif // MBED_DEBUG
     }
 
     /**
@@ -160,7 +201,7 @@ private:
      * @param[in] params Information about the characterisitc being updated.
      */
     void on_data_written(const GattWriteCallbackParams *params) {
-        _primary_service.on_data_written(params);
+        _primary_service->on_data_written(params);
     }
 
     void blink(void) {
@@ -192,58 +233,136 @@ private:
     DigitalOut _led1;
 
     bool _connected;
+    bool _initialized;
+    bool _probed;
+    uint32_t _devices;
 
     UUID _primary_uuid;
 
     uint8_t _hr_counter;
-    sequana::PrimaryService& _primary_service;
+    sequana::PrimaryService *_primary_service;
 
     uint8_t _adv_buffer[ble::LEGACY_ADVERTISING_MAX_SIZE];
     ble::AdvertisingDataBuilder _adv_data_builder;
 };
 
 
+static SequanaDemo *demo_ptr;
+
+#ifdef MBED_DEBUG
+// BLE event dispatch latency, from the stack request to processEvents() on the queue.
+static uint32_t ble_dispatch_stat = 0;
+static uint32_t ble_dispatch_max_us_stat = 0;
+static uint64_t ble_dispatch_total_us_stat = 0;
+
+
+static void process_ble_events(BLE *ble, uint32_t requested_us)
+{
+    uint32_t latency_us = us_ticker_read() - requested_us;
+
+    ++ble_dispatch_stat;
+    ble_dispatch_total_us_stat += latency_us;
+    if (latency_us > ble_dispatch_max_us_stat) {
+        ble_dispatch_max_us_stat = latency_us;
+    }
+    ble->processEvents();
+}
+
+
+static void print_ble_dispatch_stat()
+{
+    if (ble_dispatch_stat) {
+        printf("BLE dispatch latency: max %lu us, mean %lu us, %lu events\n",
+               ble_dispatch_max_us_stat, (uint32_t)(ble_dispatch_total_us_stat / ble_dispatch_stat),
+               ble_dispatch_stat);
+    }
+}
+#endif // MBED_DEBUG
+
+
 /** Schedule processing of events from the BLE middleware in the event queue. */
 void schedule_ble_events(BLE::OnEventsToProcessCallbackContext *context) {
+#ifdef MBED_DEBUG
+    event_queue.call(process_ble_events, &context->ble, us_ticker_read());
+#else
     event_queue.call(Callback<void()>(&context->ble, &BLE::processEvents));
+#endif // MBED_DEBUG
 }
 
+
+/** Shield devices are known, only those found are started.
+ */
+static void on_probe_done()
+{
+    uint32_t devices = shield_probe.get_devices();
+    printf("Shield devices found: 0x%02lx\n\n", devices);
+    combo.set_devices(devices & ShieldProbe::DEVICE_AS7261, devices & ShieldProbe::DEVICE_HS3001);
+    airq.set_devices(devices & ShieldProbe::DEVICE_ZMOD4410, devices & ShieldProbe::DEVICE_SCD30);
+
+    // Readings shared between sensors, compensation inputs are never read twice.
+    combo.subscribe_climate(callback(&airq, &AirQSensor::set_ambient));
+    combo.subscribe_light(callback(&led_rgb, &RGBLedActuator::set_ambient_light));
+
+    demo_ptr->set_devices(devices);
+
+#ifdef TARGET_FUTURE_SEQUANA
+    kx64.start(event_queue);
+#endif //TARGET_FUTURE_SEQUANA
+    if (devices & ShieldProbe::DEVICE_SPS30) {
+        sps30.start(event_queue);
+    }
+    if (devices & ShieldProbe::COMBO_ENV_DEVICES) {
+        combo.start(event_queue);
+    }
+    if (devices & ShieldProbe::AIR_QUALITY_DEVICES) {
+        airq.start(event_queue);
+    }
+    if (devices & ShieldProbe::SHIELD_DEVICES) {
+        occupancy.start(event_queue);
+    }
+    led_rgb.start(event_queue);
+}
+
+
+/** HS3001 has left programming mode, shield sensors can be addressed.
+ */
+static void on_humidity_programmed()
+{
+    shield_probe.start(event_queue, callback(on_probe_done));
+}
+
+
 int main()
 {
+    // HS3001 accepts programming mode only within 10 ms of power-up and before
+    // any measurement request, so its resolution is set first and the probe
+    // follows. Without power gating this is still best effort. Both run on the
+    // event queue in parallel with the BLE initialization.
+    combo.program_humidity_resolution(callback(on_humidity_programmed));
+
     printf("Application processor started.\n\n");
 
+    if (NvStorage::init() != 0) {
+        printf("Non-volatile storage region is invalid, calibration will not be kept.\n\n");
+    }
+
     // Initialize buses.
-    i2c1.frequency(100000);
     spi1.format(8, 0);
     spi1.frequency(1000000);
 
     BLE &ble = BLE::Instance();
     ble.onEventsToProcess(schedule_ble_events);
 
-    /* Setup primary service. */
-    sequana_service_ptr = new sequana::PrimaryService(ble,
-#ifdef TARGET_FUTURE_SEQUANA
-                                                      kx64,
-#endif //TARGET_FUTURE_SEQUANA
-                                                      sps30,
-                                                      combo,
-                                                      airq,
-                                                      occupancy,
-                                                      led_rgb);
-
-    SequanaDemo demo(ble, event_queue, *sequana_service_ptr);
+    SequanaDemo demo(ble, event_queue);
+    demo_ptr = &demo;
     demo.start();
 
     printf("BLE started.\n\n");
 
-#ifdef TARGET_FUTURE_SEQUANA
-    kx64.start(event_queue);
-#endif //TARGET_FUTURE_SEQUANA
-    sps30.start(event_queue);
-    combo.start(event_queue);
-    airq.start(event_queue);
-    occupancy.start(event_queue);
-    led_rgb.start(event_queue);
+#ifdef MBED_DEBUG
+    event_queue.call_every(10000, print_ble_dispatch_stat);
+#endif // MBED_DEBUG
+
     event_queue.dispatch_forever();
 
     return 0;
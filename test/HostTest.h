@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_TEST_H_
+#define HOST_TEST_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/** Minimal checks for host tests, failures are counted and reported
+ * by test_result() which is the test exit code.
+ */
+static int test_failures = 0;
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);     \
+            ++test_failures;                                                    \
+        }                                                                       \
+    } while (0)
+
+static inline int test_result()
+{
+    if (test_failures) {
+        printf("FAILED: %d check(s)\n", test_failures);
+        return 1;
+    }
+    printf("PASSED\n");
+    return 0;
+}
+
+/** Wall clock time for benchmarks, ns.
+ */
+static inline double test_time_ns()
+{
+    return std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Time stamp counter for benchmarks, cycles at the nominal clock.
+ * Zero when the host has no such counter.
+ */
+static inline uint64_t test_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/** Deterministic pseudo-random numbers, same sequence on every host.
+ */
+static inline uint32_t test_random(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+#endif // HOST_TEST_H_
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "HostTest.h"
+#include "Crc8.h"
+
+#define RANDOM_SIZE     65536
+#define BENCH_REPEAT    200
+
+static const char CHECK_STRING[] = "123456789";
+
+/** Bit-by-bit reference implementation.
+ */
+static uint8_t reference_crc(uint8_t poly, uint8_t init, uint8_t xor_out, const uint8_t *data, size_t length)
+{
+    uint8_t crc = init;
+
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; ++b) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ poly) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc ^ xor_out;
+}
+
+/** Nibble table implementation generated by pycrc, previously used by the
+ * SCD30 driver. Reference for the table driven version.
+ */
+static const uint8_t nibble_table[16] = {
+    0x00, 0x31, 0x62, 0x53, 0xc4, 0xf5, 0xa6, 0x97, 0xb9, 0x88, 0xdb, 0xea, 0x7d, 0x4c, 0x1f, 0x2e
+};
+
+static uint8_t nibble_crc_update(uint8_t crc, const uint8_t *data, size_t length)
+{
+    unsigned int tbl_idx;
+
+    while (length--) {
+        tbl_idx = (crc >> 4) ^ (*data >> 4);
+        crc = nibble_table[tbl_idx & 0x0f] ^ (crc << 4);
+        tbl_idx = (crc >> 4) ^ (*data >> 0);
+        crc = nibble_table[tbl_idx & 0x0f] ^ (crc << 4);
+        data++;
+    }
+    return crc & 0xff;
+}
+
+/** Check values from the CRC catalogue and the Sensirion datasheets.
+ */
+static void test_check_vectors()
+{
+    static const uint8_t beef[] = {0xBE, 0xEF};
+
+    CHECK(SensirionCrc8::calculate(beef, sizeof(beef)) == 0x92);
+    CHECK(SensirionCrc8::calculate(CHECK_STRING, 9) == 0xF7);                   // CRC-8/NRSC-5
+    CHECK((Crc8<0x07, 0x00>::calculate(CHECK_STRING, 9) == 0xF4));              // CRC-8/SMBUS
+    CHECK((Crc8<0x07, 0x00, 0x55>::calculate(CHECK_STRING, 9) == 0xA1));        // CRC-8/I-432-1
+    CHECK((Crc8<0x2F, 0xFF, 0xFF>::calculate(CHECK_STRING, 9) == 0xDF));        // CRC-8/AUTOSAR
+}
+
+/** Table driven result matches the reference, also when calculated in parts.
+ */
+static void test_random_data(uint8_t *data)
+{
+    size_t split = RANDOM_SIZE / 3;
+    uint8_t crc = SensirionCrc8::init();
+
+    crc = SensirionCrc8::update(crc, data, split);
+    crc = SensirionCrc8::update(crc, data + split, RANDOM_SIZE - split);
+    CHECK(SensirionCrc8::finalize(crc) == reference_crc(0x31, 0xFF, 0x00, data, RANDOM_SIZE));
+    CHECK(SensirionCrc8::calculate(data, RANDOM_SIZE) == reference_crc(0x31, 0xFF, 0x00, data, RANDOM_SIZE));
+}
+
+/** Table driven result matches the nibble table version it replaced, for
+ * every length of SCD30 and SPS30 words and for the whole random block.
+ */
+static void test_nibble_reference(uint8_t *data)
+{
+    for (size_t length = 0; length <= 64; ++length) {
+        CHECK(SensirionCrc8::calculate(data, length) == nibble_crc_update(0xFF, data, length));
+    }
+    CHECK(SensirionCrc8::calculate(data, RANDOM_SIZE) == nibble_crc_update(0xFF, data, RANDOM_SIZE));
+}
+
+static void bench(uint8_t *data)
+{
+    volatile uint8_t sink = 0;
+    double bytes = (double)BENCH_REPEAT * RANDOM_SIZE;
+    uint64_t table_cycles = test_cycles();
+    double start = test_time_ns();
+    for (int r = 0; r < BENCH_REPEAT; ++r) {
+        sink = sink ^ SensirionCrc8::calculate(data, RANDOM_SIZE);
+    }
+    double table_ns = (test_time_ns() - start) / bytes;
+    table_cycles = test_cycles() - table_cycles;
+
+    uint64_t nibble_cycles = test_cycles();
+    start = test_time_ns();
+    for (int r = 0; r < BENCH_REPEAT; ++r) {
+        sink = sink ^ nibble_crc_update(0xFF, data, RANDOM_SIZE);
+    }
+    double nibble_ns = (test_time_ns() - start) / bytes;
+    nibble_cycles = test_cycles() - nibble_cycles;
+
+    start = test_time_ns();
+    for (int r = 0; r < BENCH_REPEAT; ++r) {
+        sink = sink ^ reference_crc(0x31, 0xFF, 0x00, data, RANDOM_SIZE);
+    }
+    double bit_ns = (test_time_ns() - start) / bytes;
+    printf("bench: %.2f ns per byte table driven, %.2f ns nibble table, %.2f ns bitwise (host)\n",
+           table_ns, nibble_ns, bit_ns);
+    if (table_cycles && nibble_cycles) {
+        printf("bench: %.2f cycles per byte table driven, %.2f cycles nibble table\n",
+               table_cycles / bytes, nibble_cycles / bytes);
+    }
+}
+
+int main()
+{
+    static uint8_t data[RANDOM_SIZE];
+    uint32_t seed = 11;
+
+    for (size_t i = 0; i < RANDOM_SIZE; ++i) {
+        data[i] = (uint8_t)test_random(seed);
+    }
+
+    test_check_vectors();
+    test_random_data(data);
+    test_nibble_reference(data);
+    bench(data);
+    return test_result();
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mbed.h>
+#include "HostTest.h"
+#include "I2CBus.h"
+#include "Hs3001Driver.h"
+
+#define HS3001_ADDRESS      0x88
+#define ABSENT_ADDRESS      0x64
+
+// Programming mode is accepted within 10 ms of power-up, simulated time 0.
+#define PROGRAM_WINDOW_MS   10
+#define RESOLUTION_MASK     0x0C00
+#define RESOLUTION_14_BIT   0x0C00
+// Other bits of the resolution registers must be preserved.
+#define REG_OTHER_BITS      0x2012
+
+
+/** HS3001 model: programming mode, resolution registers and conversions.
+ */
+struct Hs3001Model : sim::Device {
+    uint16_t    regs[2];        // humidity and temperature resolution
+    bool        programming;
+    bool        measured;       // measurement request received since power-up
+    int         reg_writes;
+    char        response[3];
+    uint64_t    request_ms;
+    uint64_t    fetch_ms;
+
+    Hs3001Model() : programming(false), measured(false), reg_writes(0), request_ms(0), fetch_ms(0)
+    {
+        regs[0] = REG_OTHER_BITS | RESOLUTION_14_BIT;
+        regs[1] = REG_OTHER_BITS | RESOLUTION_14_BIT;
+    }
+
+    static int reg_index(uint8_t cmd) { return ((cmd & 0x3F) == 0x06) ? 0 : 1; }
+
+    virtual int transfer(const char *tx, int tx_length, char *rx, int rx_length)
+    {
+        uint64_t now = sim::queue->tick();
+        uint8_t cmd = (tx_length > 0) ? (uint8_t)tx[0] : 0;
+
+        if (tx_length == 1) {
+            // Measurement request.
+            measured = true;
+            request_ms = now;
+        } else if (tx_length == 3) {
+            if (cmd == 0xA0) {
+                programming = !measured && (now < PROGRAM_WINDOW_MS);
+            } else if (cmd == 0x80) {
+                programming = false;
+            } else if (programming && ((cmd == 0x06) || (cmd == 0x11))) {
+                response[0] = (char)0x81;
+                response[1] = (char)(regs[reg_index(cmd)] >> 8);
+                response[2] = (char)regs[reg_index(cmd)];
+            } else if (programming && ((cmd == 0x46) || (cmd == 0x51))) {
+                regs[reg_index(cmd)] = ((uint8_t)tx[1] << 8) | (uint8_t)tx[2];
+                ++reg_writes;
+            }
+        } else if (rx_length == 3) {
+            if (programming) {
+                memcpy(rx, response, 3);
+            } else {
+                // Outside programming mode the sensor returns measurement data.
+                rx[0] = 0x1F;
+                rx[1] = 0;
+                rx[2] = 0;
+            }
+        } else if (rx_length == 4) {
+            // 50 %RH, 25 deg C.
+            fetch_ms = now;
+            rx[0] = 0x1F;
+            rx[1] = (char)0xFF;
+            rx[2] = 0x64;
+            rx[3] = (char)0xD8;
+        }
+        return I2C_EVENT_TRANSFER_COMPLETE;
+    }
+};
+
+
+struct Done {
+    int         count;
+    uint64_t    ms;
+
+    Done() : count(0), ms(0) {}
+    void call() { ++count; ms = sim::queue->tick(); }
+};
+
+
+/** Time from measurement request to result fetch, includes the 1 ms transfer.
+ */
+static uint64_t conversion_time(EventQueue &queue, Hs3001Driver &driver, Hs3001Model &model)
+{
+    uint16_t humidity;
+    int16_t temperature;
+
+    driver.start_conversion();
+    queue.dispatch(100);
+    CHECK(driver.read(humidity, temperature) == Hs3001Driver::STATUS_OK);
+    CHECK(humidity == 50);
+    CHECK((temperature > 2490) && (temperature < 2510));
+    return model.fetch_ms - model.request_ms;
+}
+
+
+/** Resolution programmed as the first access right after power-up,
+ * the order used by main().
+ */
+static void test_program_at_boot()
+{
+    EventQueue queue;
+    Hs3001Model model;
+    sim::reset();
+    sim::queue = &queue;
+    sim::device = &model;
+    sim::present_address = HS3001_ADDRESS;
+    I2CBus bus(sim::sda_pin, sim::scl_pin, queue);
+    Hs3001Driver driver(bus, HS3001_ADDRESS, Hs3001Driver::RESOLUTION_8_BIT);
+    Done done;
+
+    driver.program_resolution(callback(&done, &Done::call));
+    queue.dispatch(100);
+    CHECK(done.count == 1);
+    CHECK(model.reg_writes == 2);
+    CHECK(model.regs[0] == REG_OTHER_BITS);
+    CHECK(model.regs[1] == REG_OTHER_BITS);
+    CHECK(!model.programming);
+    printf("8-bit programmed at boot: done after %u ms\n", (unsigned)done.ms);
+    CHECK(conversion_time(queue, driver, model) == 3);
+
+    // Already programmed: registers are only read.
+    Hs3001Model programmed;
+    programmed.regs[0] = programmed.regs[1] = REG_OTHER_BITS;
+    EventQueue queue2;
+    sim::reset();
+    sim::queue = &queue2;
+    sim::device = &programmed;
+    I2CBus bus2(sim::sda_pin, sim::scl_pin, queue2);
+    Hs3001Driver driver2(bus2, HS3001_ADDRESS, Hs3001Driver::RESOLUTION_8_BIT);
+    driver2.program_resolution(callback(&done, &Done::call));
+    queue2.dispatch(100);
+    CHECK(done.count == 2);
+    CHECK(programmed.reg_writes == 0);
+    CHECK(conversion_time(queue2, driver2, programmed) == 3);
+}
+
+
+/** Measurement request before programming (the shield probe used to run
+ * first) or a late start lose the window, the driver keeps default timing.
+ */
+static void test_window_missed()
+{
+    for (int late = 0; late < 2; ++late) {
+        EventQueue queue;
+        Hs3001Model model;
+        sim::reset();
+        sim::queue = &queue;
+        sim::device = &model;
+        sim::present_address = HS3001_ADDRESS;
+        I2CBus bus(sim::sda_pin, sim::scl_pin, queue);
+        Hs3001Driver driver(bus, HS3001_ADDRESS, Hs3001Driver::RESOLUTION_8_BIT);
+        Done done;
+
+        if (late) {
+            queue.dispatch(PROGRAM_WINDOW_MS);
+        } else {
+            static const char request[1] = { 0 };
+            I2CTransaction probe(HS3001_ADDRESS, I2CBus::FREQUENCY_STANDARD);
+            probe.tx_data = request;
+            probe.tx_length = 1;
+            bus.submit(probe);
+        }
+        driver.program_resolution(callback(&done, &Done::call));
+        queue.dispatch(100);
+        CHECK(done.count == 1);
+        CHECK(model.reg_writes == 0);
+        CHECK((model.regs[0] & RESOLUTION_MASK) == RESOLUTION_14_BIT);
+        CHECK(conversion_time(queue, driver, model) == 41);
+    }
+}
+
+
+/** Missing sensor still completes, boot is not blocked.
+ */
+static void test_absent()
+{
+    EventQueue queue;
+    sim::reset();
+    sim::queue = &queue;
+    sim::present_address = ABSENT_ADDRESS;
+    I2CBus bus(sim::sda_pin, sim::scl_pin, queue);
+    Hs3001Driver driver(bus, HS3001_ADDRESS, Hs3001Driver::RESOLUTION_8_BIT);
+    Done done;
+
+    driver.program_resolution(callback(&done, &Done::call));
+    queue.dispatch(100);
+    CHECK(done.count == 1);
+    CHECK(done.ms < 5);
+}
+
+
+int main()
+{
+    test_program_at_boot();
+    test_window_missed();
+    test_absent();
+    return test_result();
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mbed.h>
+#include "HostTest.h"
+#include "I2CBus.h"
+
+#define DEVICE_ADDRESS  0x88
+#define ABSENT_ADDRESS  0x64
+
+// Transfer of 3 bytes at 400 kHz takes under 1 ms, plus clock stretching margin.
+#define TIMEOUT_MS      201
+#define RETRY_MS        1000
+
+
+/** Driver side of a transaction, records completions.
+ */
+struct Client {
+    I2CTransaction  x;
+    char            rx[3];
+    int             ok;
+    int             failed;
+    uint64_t        done_ms;
+
+    Client(uint8_t address) : x(address, I2CBus::FREQUENCY_FAST), ok(0), failed(0), done_ms(0)
+    {
+        x.rx_data = rx;
+        x.rx_length = sizeof(rx);
+        x.done = callback(this, &Client::done);
+    }
+
+    void done(int result)
+    {
+        result ? ++failed : ++ok;
+        done_ms = sim::queue->tick();
+    }
+};
+
+
+/** Every test starts from power-on, the bus is initialized once.
+ */
+static void reset_lines()
+{
+    sim::reset();
+    sim::present_address = DEVICE_ADDRESS;
+}
+
+
+/** Slave hanging mid-read is clocked out after the timeout, the bus is
+ * usable again without any retry delay.
+ */
+static void test_timeout_and_release()
+{
+    EventQueue queue;
+    sim::queue = &queue;
+    reset_lines();
+    I2CBus bus(sim::sda_pin, sim::scl_pin, queue);
+    Client client(DEVICE_ADDRESS);
+
+    bus.submit(client.x);
+    queue.dispatch(10);
+    CHECK(client.ok == 1);
+
+    // Slave releases SDA within the 9 recovery clocks.
+    for (int release = 1; release <= 9; ++release) {
+        sim::hang_next = true;
+        sim::release_after = release;
+        int aborts = sim::aborts;
+        uint64_t start = queue.tick();
+        bus.submit(client.x);
+        queue.dispatch(TIMEOUT_MS + 10);
+        CHECK(client.failed == release);
+        CHECK(client.done_ms - start == TIMEOUT_MS);
+        CHECK(sim::aborts == aborts + 1);
+        CHECK(sim::clocks == release);
+        CHECK(!sim::sda_held);
+        CHECK(!bus.is_stuck());
+
+        bus.submit(client.x);
+        queue.dispatch(10);
+        CHECK(client.ok == 1 + release);
+    }
+    CHECK(client.x.timeouts == 9);
+    CHECK(!client.x.degraded());
+    // Controller is kept, pins are routed back to it after each recovery.
+    CHECK(sim::inits == 1);
+    CHECK(sim::sda_function == sim::FUNCTION_I2C);
+    CHECK(sim::scl_function == sim::FUNCTION_I2C);
+}
+
+
+/** Slave holding SDA through recovery: transactions fail without touching
+ * the controller, recovery is retried every second until SDA is released.
+ */
+static void test_stuck_bus()
+{
+    EventQueue queue;
+    sim::queue = &queue;
+    reset_lines();
+    I2CBus bus(sim::sda_pin, sim::scl_pin, queue);
+    Client client(DEVICE_ADDRESS);
+
+    sim::hang_next = true;
+    sim::release_after = 1000;
+    bus.submit(client.x);
+    queue.dispatch(TIMEOUT_MS + 10);
+    CHECK(client.failed == 1);
+    // Nine recovery clocks, the tenth falling edge belongs to the STOP condition.
+    CHECK(sim::clocks == 10);
+    CHECK(bus.is_stuck());
+
+    // Fail fast, no transfer is started and no timeout is awaited.
+    int transfers = sim::transfers;
+    for (int i = 0; i < 2; ++i) {
+        uint64_t start = queue.tick();
+        bus.submit(client.x);
+        queue.dispatch(0);
+        CHECK(client.done_ms == start);
+    }
+    CHECK(client.failed == 3);
+    CHECK(sim::transfers == transfers);
+    CHECK(client.x.degraded());
+
+    // Recovery retried once per second.
+    queue.dispatch(RETRY_MS);
+    CHECK(sim::clocks == 20);
+    CHECK(bus.is_stuck());
+
+    // Slave released, next retry clears the stuck state.
+    sim::sda_held = false;
+    queue.dispatch(RETRY_MS);
+    CHECK(!bus.is_stuck());
+
+    bus.submit(client.x);
+    queue.dispatch(10);
+    CHECK(client.ok == 1);
+    CHECK(sim::transfers == transfers + 1);
+    CHECK(client.x.failures == 0);
+    CHECK(!client.x.degraded());
+    CHECK(client.x.errors == 3);
+}
+
+
+/** Interrupt of an aborted transfer arriving after the timeout must not
+ * complete the transaction started next.
+ */
+static void test_late_interrupt()
+{
+    EventQueue queue;
+    sim::queue = &queue;
+    reset_lines();
+    I2CBus bus(sim::sda_pin, sim::scl_pin, queue);
+    Client hung(DEVICE_ADDRESS);
+    Client absent(ABSENT_ADDRESS);
+
+    sim::hang_next = true;
+    sim::release_after = 1;
+    bus.submit(hung.x);
+    queue.dispatch(TIMEOUT_MS + 10);
+    CHECK(hung.failed == 1);
+
+    // Before the next transfer.
+    event_callback_t stale_irq = sim::last_irq;
+    stale_irq(I2C_EVENT_TRANSFER_COMPLETE);
+    bus.submit(absent.x);
+    queue.dispatch(10);
+    CHECK(absent.ok == 0);
+    CHECK(absent.failed == 1);
+
+    // After the next transfer has started, before it completes.
+    sim::hang_next = true;
+    bus.submit(hung.x);
+    queue.dispatch(TIMEOUT_MS + 10);
+    CHECK(hung.failed == 2);
+    stale_irq = sim::last_irq;
+    bus.submit(absent.x);
+    stale_irq(I2C_EVENT_TRANSFER_COMPLETE);
+    queue.dispatch(0);
+    CHECK(absent.ok == 0);
+    CHECK(absent.failed == 1);
+    queue.dispatch(10);
+    CHECK(absent.ok == 0);
+    CHECK(absent.failed == 2);
+}
+
+
+/** Degraded state follows consecutive failures of a single device only.
+ */
+static void test_degraded()
+{
+    EventQueue queue;
+    sim::queue = &queue;
+    reset_lines();
+    I2CBus bus(sim::sda_pin, sim::scl_pin, queue);
+    Client present(DEVICE_ADDRESS);
+    Client absent(ABSENT_ADDRESS);
+
+    for (uint32_t i = 0; i < I2CTransaction::DEGRADED_FAILURES; ++i) {
+        CHECK(!absent.x.degraded());
+        bus.submit(absent.x);
+        bus.submit(present.x);
+        queue.dispatch(10);
+    }
+    CHECK(absent.x.degraded());
+    CHECK(!present.x.degraded());
+    CHECK(present.ok == (int)I2CTransaction::DEGRADED_FAILURES);
+
+    sim::present_address = ABSENT_ADDRESS;
+    bus.submit(absent.x);
+    queue.dispatch(10);
+    CHECK(!absent.x.degraded());
+}
+
+
+int main()
+{
+    test_timeout_and_release();
+    test_stuck_bus();
+    test_late_interrupt();
+    test_degraded();
+    return test_result();
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "HostTest.h"
+#include "IaqEstimator.h"
+
+// ZMOD4410 sample period used by AirQSensor.
+#define SAMPLE_PERIOD_MS    2400
+#define WARMUP_SAMPLES      100
+
+// ADC range limits and gain as read from a typical sensor.
+#define ADC_LOW             1000
+#define ADC_HIGH            60000
+#define GAIN_KOHM           10
+#define CLEAN_AIR_OHM       100e3
+
+/** ADC result the sensor reports for a resistance.
+ */
+static uint16_t adc_for(double r)
+{
+    double k = GAIN_KOHM * 1e3;
+    return (uint16_t)((r * ADC_HIGH + k * ADC_LOW) / (r + k));
+}
+
+/** MOx resistance at VOC concentration, C^-0.5 law with slow drift.
+ */
+static double resistance_at(double t_s, double tvoc_mg)
+{
+    double r = CLEAN_AIR_OHM * (1 + 0.05 * sin(t_s / 3600));
+    return r / sqrt(tvoc_mg / 0.1);
+}
+
+static bool add_adc(IaqEstimator &estimator, double r)
+{
+    return estimator.add_sample(IaqEstimator::resistance(adc_for(r), ADC_LOW, ADC_HIGH, GAIN_KOHM));
+}
+
+static bool near(uint32_t value, double expected, double tolerance)
+{
+    return fabs(value - expected) <= tolerance;
+}
+
+/** 3 h ADC trace at 2.4 s with drift, 3 mg/m3 and 20 mg/m3 events.
+ */
+static void test_trace()
+{
+    IaqEstimator estimator(SAMPLE_PERIOD_MS);
+    int samples = 3 * 3600 * 1000 / SAMPLE_PERIOD_MS;
+    bool warmup_ok = true;
+    bool clean_ok = true;
+
+    for (int i = 0; i < samples; ++i) {
+        double t = i * SAMPLE_PERIOD_MS / 1000.0;
+        double tvoc = 0.1;
+        if ((t > 3600) && (t < 4200)) {
+            tvoc = 3.0;
+        } else if ((t > 7200) && (t < 7500)) {
+            tvoc = 20.0;
+        }
+
+        bool valid = add_adc(estimator, resistance_at(t, tvoc));
+        const IaqEstimate &e = estimator.get_estimate();
+        warmup_ok &= (valid == (i >= WARMUP_SAMPLES));
+
+        if (valid && (tvoc == 0.1) && !((t >= 4200) && (t < 4200 + SAMPLE_PERIOD_MS / 1000.0)) &&
+            !((t >= 7500) && (t < 7500 + SAMPLE_PERIOD_MS / 1000.0))) {
+            // Clean air, also right after the events: baseline is not dragged down.
+            clean_ok &= near(e.tvoc, 10, 2) && (e.eco2 < 410) && (e.iaq == 10);
+        }
+        if ((t > 4190) && (t < 4192.4)) {
+            printf("3 mg/m3 event: tvoc %u, eco2 %u, iaq %u\n", e.tvoc, e.eco2, e.iaq);
+            CHECK(near(e.tvoc, 300, 30));
+            CHECK(near(e.eco2, 400 + 4 * (e.tvoc - 10), 5));
+            CHECK(near(e.iaq, 30, 1));
+        }
+        if ((t > 7490) && (t < 7492.4)) {
+            printf("20 mg/m3 event: tvoc %u, eco2 %u, iaq %u\n", e.tvoc, e.eco2, e.iaq);
+            CHECK(near(e.tvoc, 2000, 200));
+            CHECK(e.eco2 == 5000);
+            CHECK(near(e.iaq, 46, 1));
+        }
+    }
+    CHECK(warmup_ok);
+    CHECK(clean_ok);
+}
+
+/** Humidity step with the matching resistance drop leaves TVOC unchanged
+ * when ambient conditions are provided.
+ */
+static void test_humidity_compensation()
+{
+    IaqEstimator compensated(SAMPLE_PERIOD_MS);
+    IaqEstimator plain(SAMPLE_PERIOD_MS);
+    double ah50 = 216.7 * 0.5 * 6.112 * exp(17.62 * 22 / (243.12 + 22)) / (273.15 + 22);
+    double r_humid = CLEAN_AIR_OHM * exp(-0.02 * (1.6 * ah50 - ah50));
+
+    compensated.set_ambient(22, 50);
+    for (int i = 0; i < 2 * WARMUP_SAMPLES; ++i) {
+        add_adc(compensated, CLEAN_AIR_OHM);
+        add_adc(plain, CLEAN_AIR_OHM);
+    }
+    compensated.set_ambient(22, 80);
+    for (int i = 0; i < 20; ++i) {
+        add_adc(compensated, r_humid);
+        add_adc(plain, r_humid);
+    }
+    printf("humidity 50 -> 80 %%: tvoc %u compensated, %u plain\n",
+           compensated.get_estimate().tvoc, plain.get_estimate().tvoc);
+    CHECK(near(compensated.get_estimate().tvoc, 10, 1));
+    CHECK(plain.get_estimate().tvoc > 11);
+}
+
+static void bench_sample()
+{
+    IaqEstimator estimator(SAMPLE_PERIOD_MS);
+    std::vector<double> ns;
+    uint32_t seed = 9;
+
+    for (int i = 0; i < 20000; ++i) {
+        float r = (float)(CLEAN_AIR_OHM * (0.5 + (test_random(seed) % 1000) / 1000.0));
+        double start = test_time_ns();
+        estimator.add_sample(r);
+        ns.push_back(test_time_ns() - start);
+    }
+    std::sort(ns.begin(), ns.end());
+    printf("bench: per sample %.0f ns median, %.0f ns p99 (host)\n", ns[ns.size() / 2], ns[ns.size() * 99 / 100]);
+}
+
+int main()
+{
+    test_trace();
+    test_humidity_compensation();
+    bench_sample();
+    return test_result();
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "PeripheralPins.h"
+
+
+namespace sim {
+EventQueue *queue = NULL;
+PinName sda_pin = 1;
+PinName scl_pin = 2;
+int present_address = 0;
+Device *device = NULL;
+bool hang_next = false;
+bool sda_held = false;
+int release_after = 0;
+int clocks = 0;
+int scl_level = 1;
+int sda_level = 1;
+int transfers = 0;
+int aborts = 0;
+int inits = 0;
+bool pins_reserved = false;
+int sda_function = FUNCTION_GPIO;
+int scl_function = FUNCTION_GPIO;
+event_callback_t last_irq;
+
+
+void reset()
+{
+    device = NULL;
+    hang_next = false;
+    sda_held = false;
+    clocks = 0;
+    scl_level = 1;
+    sda_level = 1;
+    pins_reserved = false;
+    sda_function = FUNCTION_GPIO;
+    scl_function = FUNCTION_GPIO;
+    last_irq = event_callback_t();
+}
+}
+
+
+const PinMap PinMap_I2C_SDA[] = {
+    { 1,  0, sim::FUNCTION_I2C },
+    { NC, 0, 0 }
+};
+
+const PinMap PinMap_I2C_SCL[] = {
+    { 2,  0, sim::FUNCTION_I2C },
+    { NC, 0, 0 }
+};
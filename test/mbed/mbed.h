@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TEST_MBED_H_
+#define TEST_MBED_H_
+
+/** Host model of the few mbed APIs used by the bus driver and the sensor
+ * interfaces.
+ *
+ * Event queue runs on simulated time advanced by dispatch(), the kernel
+ * clock follows the queue set up by the test. I2C transfers
+ * are served by a bus model which completes them after 1 ms, or lets the
+ * addressed slave hang in the middle of a read holding SDA low until it
+ * sees enough SCL clocks on the GPIO driven lines. Data of the present
+ * slave can be served by a device model.
+ *
+ * As in the PSoC 6 HAL, I2C reserves its pins and the destructor frees
+ * nothing, a second initialization on the same pins halts in error().
+ * Controller sees the bus only while both pins are routed to it.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <map>
+#include <utility>
+
+typedef int PinName;
+enum { NC = -1 };
+
+enum PinDirection { PIN_INPUT, PIN_OUTPUT };
+enum PinMode { PullNone, PullUp, PullDown, OpenDrain, PullDefault };
+
+#define I2C_EVENT_ERROR                 (1 << 1)
+#define I2C_EVENT_ERROR_NO_SLAVE        (1 << 2)
+#define I2C_EVENT_TRANSFER_COMPLETE     (1 << 3)
+#define I2C_EVENT_TRANSFER_EARLY_NACK   (1 << 4)
+#define I2C_EVENT_ALL                   (I2C_EVENT_ERROR | I2C_EVENT_TRANSFER_COMPLETE | \
+                                         I2C_EVENT_ERROR_NO_SLAVE | I2C_EVENT_TRANSFER_EARLY_NACK)
+
+
+template <typename F> class Callback;
+
+template <typename R, typename... A> class Callback<R(A...)> {
+public:
+    Callback() {}
+    template <typename T, typename U> Callback(U *obj, R (T::*method)(A...)) :
+        _f([obj, method](A... a) { return (obj->*method)(a...); })
+    {}
+    template <typename T, typename U> Callback(R (*func)(T *, A...), U *arg) :
+        _f([func, arg](A... a) { return func(arg, a...); })
+    {}
+    R operator()(A... a) const { return _f(a...); }
+    explicit operator bool() const { return (bool)_f; }
+
+private:
+    std::function<R(A...)> _f;
+};
+
+template <typename T, typename U, typename R, typename... A>
+Callback<R(A...)> callback(U *obj, R (T::*method)(A...))
+{
+    return Callback<R(A...)>(obj, method);
+}
+
+template <typename T, typename U, typename R, typename... A>
+Callback<R(A...)> callback(R (*func)(T *, A...), U *arg)
+{
+    return Callback<R(A...)>(func, arg);
+}
+
+typedef Callback<void(int)> event_callback_t;
+
+
+class EventQueue {
+public:
+    EventQueue() : _now_ms(0), _seq(0), _next_id(1) {}
+
+    template <typename F> int call(F f) { return call_in(0, f); }
+    template <typename F, typename A0> int call(F f, A0 a0) { return call_in(0, f, a0); }
+    template <typename F, typename A0> int call_in(int ms, F f, A0 a0) { return post(ms, [f, a0]() { f(a0); }); }
+    template <typename F> int call_in(int ms, F f) { return post(ms, [f]() { f(); }); }
+
+    bool cancel(int id)
+    {
+        for (Events::iterator it = _events.begin(); it != _events.end(); ++it) {
+            if (it->second.first == id) {
+                _events.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Run events due within the next ms milliseconds of simulated time.
+     */
+    void dispatch(int ms)
+    {
+        uint64_t until = _now_ms + ms;
+        while (!_events.empty() && (_events.begin()->first.first <= until)) {
+            Events::iterator it = _events.begin();
+            std::function<void()> f = it->second.second;
+            _now_ms = it->first.first;
+            _events.erase(it);
+            f();
+        }
+        _now_ms = until;
+    }
+
+    uint64_t tick() const { return _now_ms; }
+
+private:
+    typedef std::map<std::pair<uint64_t, uint64_t>, std::pair<int, std::function<void()> > > Events;
+
+    int post(int ms, std::function<void()> f)
+    {
+        int id = _next_id++;
+        _events[std::make_pair(_now_ms + ms, _seq++)] = std::make_pair(id, f);
+        return id;
+    }
+
+    uint64_t    _now_ms;
+    uint64_t    _seq;
+    int         _next_id;
+    Events      _events;
+};
+
+
+/** Fatal error, the target halts.
+ */
+inline void error(const char *message)
+{
+    printf("error(): %s\n", message);
+    exit(1);
+}
+
+
+/** Bus model state, set up and inspected by the test.
+ */
+namespace sim {
+
+enum PinFunction {
+    FUNCTION_GPIO = 0,
+    FUNCTION_I2C
+};
+
+/** Slave model with data, replaces the acknowledge-only present slave.
+ */
+struct Device {
+    virtual ~Device() {}
+
+    /** Serve a transfer addressed to the device.
+     *
+     * @returns I2C event reported by the controller
+     */
+    virtual int transfer(const char *tx, int tx_length, char *rx, int rx_length) = 0;
+};
+
+extern EventQueue *queue;           //<! queue used to deliver transfer interrupts
+extern PinName sda_pin;
+extern PinName scl_pin;
+extern int present_address;         //<! only slave on the bus, others do not acknowledge
+extern Device *device;              //<! model serving the present slave, NULL to acknowledge only
+extern bool hang_next;              //<! next transfer stops mid-read with SDA held low
+extern bool sda_held;               //<! slave holds SDA low
+extern int release_after;           //<! SCL clocks after which the slave releases SDA
+extern int clocks;                  //<! SCL clocks seen while SDA was held
+extern int scl_level;
+extern int sda_level;
+extern int transfers;               //<! transfers started on the controller
+extern int aborts;
+extern int inits;                   //<! controller initializations
+extern bool pins_reserved;
+extern int sda_function;
+extern int scl_function;
+extern event_callback_t last_irq;   //<! interrupt handler of the latest transfer
+
+/** Power-on state of the bus, lines and pin reservations.
+ */
+void reset();
+}
+
+
+namespace rtos {
+namespace Kernel {
+inline uint64_t get_ms_count() { return sim::queue ? sim::queue->tick() : 0; }
+}
+}
+
+
+struct PinMap {
+    PinName pin;
+    int     peripheral;
+    int     function;
+};
+
+inline uint32_t pinmap_function(PinName pin, const PinMap *map)
+{
+    for (; map->pin != NC; ++map) {
+        if (map->pin == pin) {
+            return map->function;
+        }
+    }
+    error("pinmap not found for function");
+    return 0;
+}
+
+inline void pin_function(PinName pin, int function)
+{
+    if (pin == sim::scl_pin) {
+        sim::scl_function = function;
+    } else if (pin == sim::sda_pin) {
+        sim::sda_function = function;
+    }
+}
+
+
+inline void wait_us(int) {}
+
+
+class DigitalInOut {
+public:
+    DigitalInOut(PinName pin, PinDirection, PinMode, int value) : _pin(pin)
+    {
+        pin_function(pin, sim::FUNCTION_GPIO);
+        write(value);
+    }
+    DigitalInOut &operator=(int value) { write(value); return *this; }
+    operator int() { return read(); }
+
+    void write(int value)
+    {
+        if (_pin == sim::scl_pin) {
+            if (sim::scl_level && !value && sim::sda_held && (++sim::clocks >= sim::release_after)) {
+                sim::sda_held = false;
+            }
+            sim::scl_level = value;
+        } else {
+            sim::sda_level = value;
+        }
+    }
+
+    int read()
+    {
+        return (_pin == sim::scl_pin) ? sim::scl_level : (sim::sda_level && !sim::sda_held);
+    }
+
+private:
+    PinName _pin;
+};
+
+
+class I2C {
+public:
+    I2C(PinName sda, PinName scl) : _transfer_id(0), _busy(false)
+    {
+        if (sim::pins_reserved) {
+            error("I2C pin reservation conflict.");
+        }
+        sim::pins_reserved = true;
+        ++sim::inits;
+        pin_function(sda, sim::FUNCTION_I2C);
+        pin_function(scl, sim::FUNCTION_I2C);
+    }
+
+    void frequency(int) {}
+
+    int transfer(int address, const char *tx, int tx_length, char *rx, int rx_length,
+                 const event_callback_t &cb, int, bool = false)
+    {
+        if (_busy) {
+            return -1;
+        }
+        _busy = true;
+        ++sim::transfers;
+        sim::last_irq = cb;
+
+        int event = I2C_EVENT_TRANSFER_COMPLETE;
+        if ((sim::sda_function != sim::FUNCTION_I2C) || (sim::scl_function != sim::FUNCTION_I2C)) {
+            // Pins left in GPIO mode, controller sees idle lines and no acknowledge.
+            event = I2C_EVENT_ERROR_NO_SLAVE;
+        } else if (sim::sda_held) {
+            // Bus busy, reported as arbitration lost after the address byte.
+            event = I2C_EVENT_ERROR;
+        } else if (address != sim::present_address) {
+            event = I2C_EVENT_ERROR_NO_SLAVE;
+        } else if (sim::hang_next) {
+            // Slave stops in the middle of a read, no interrupt ever comes.
+            sim::hang_next = false;
+            sim::sda_held = true;
+            sim::clocks = 0;
+            return 0;
+        } else if (sim::device != NULL) {
+            event = sim::device->transfer(tx, tx_length, rx, rx_length);
+        }
+        int id = ++_transfer_id;
+        sim::queue->call_in(1, [this, cb, event, id]() {
+            if ((id == _transfer_id) && _busy) {
+                _busy = false;
+                cb(event);
+            }
+        });
+        return 0;
+    }
+
+    void abort_transfer()
+    {
+        ++sim::aborts;
+        ++_transfer_id;
+        _busy = false;
+    }
+
+private:
+    int     _transfer_id;
+    bool    _busy;
+};
+
+#endif // TEST_MBED_H_
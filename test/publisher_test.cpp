@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mbed.h>
+#include "HostTest.h"
+#include "Publisher.h"
+
+#define CAPACITY    3
+
+
+struct Value {
+    int         level;
+};
+
+
+/** Records what a subscriber received and when.
+ */
+struct Consumer {
+    static int  calls;
+
+    const Value *received;
+    int         count;
+    int         order;
+
+    Consumer() : received(NULL), count(0), order(0) {}
+
+    void receive(const Value& value)
+    {
+        received = &value;
+        ++count;
+        order = ++calls;
+    }
+};
+
+int Consumer::calls = 0;
+
+
+/** Every subscriber gets the producer's value itself, in subscription order.
+ */
+static void test_fan_out()
+{
+    Publisher<Value, CAPACITY> publisher;
+    Consumer consumers[CAPACITY];
+    Value value = { 5 };
+
+    publisher.publish(value);
+    CHECK(publisher.get_count() == 0);
+
+    for (int i = 0; i < CAPACITY; ++i) {
+        CHECK(publisher.subscribe(callback(&consumers[i], &Consumer::receive)) == 0);
+    }
+    CHECK(publisher.get_count() == CAPACITY);
+
+    Consumer::calls = 0;
+    publisher.publish(value);
+    publisher.publish(value);
+    for (int i = 0; i < CAPACITY; ++i) {
+        CHECK(consumers[i].count == 2);
+        CHECK(consumers[i].received == &value);
+        CHECK(consumers[i].order == CAPACITY + i + 1);
+    }
+}
+
+
+/** Subscription beyond the capacity fails and leaves the list unchanged.
+ */
+static void test_overflow()
+{
+    Publisher<Value, CAPACITY> publisher;
+    Consumer consumers[CAPACITY];
+    Consumer extra;
+    Value value = { 7 };
+
+    for (int i = 0; i < CAPACITY; ++i) {
+        publisher.subscribe(callback(&consumers[i], &Consumer::receive));
+    }
+    CHECK(publisher.subscribe(callback(&extra, &Consumer::receive)) == -1);
+    CHECK(publisher.subscribe(callback(&extra, &Consumer::receive)) == -1);
+    CHECK(publisher.get_count() == CAPACITY);
+
+    publisher.publish(value);
+    CHECK(extra.count == 0);
+    for (int i = 0; i < CAPACITY; ++i) {
+        CHECK(consumers[i].count == 1);
+    }
+}
+
+
+int main()
+{
+    test_fan_out();
+    test_overflow();
+    return test_result();
+}
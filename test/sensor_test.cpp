@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <mbed.h>
+#include "HostTest.h"
+#include "Sensor.h"
+
+#define SILENCE_MS      1000
+
+
+/** Filtered value: absolute threshold of 10 and relative threshold of 5 %.
+ */
+struct FilteredValue {
+    int32_t     level;
+};
+
+/** Value notified on every update.
+ */
+struct PlainValue {
+    int32_t     level;
+};
+
+namespace sequana {
+
+template <> struct NotifyFilter<FilteredValue> {
+    static const uint32_t MAX_SILENCE_MS = SILENCE_MS;
+
+    static bool changed(const FilteredValue& value, const FilteredValue& notified)
+    {
+        return outside_deadband(value.level, notified.level, 10, 50);
+    }
+};
+
+} //namespace
+
+
+template <typename ValueT> class TestSensor : public Sensor<ValueT> {
+public:
+    virtual void start(EventQueue&) {}
+
+    void update(int32_t level)
+    {
+        this->_value.level = level;
+        this->update_notify();
+    }
+};
+
+
+/** Records the values passed to a subscriber.
+ */
+template <typename ValueT> struct Consumer {
+    int         count;
+    int32_t     last;
+
+    Consumer() : count(0), last(0) {}
+
+    void receive(const ValueT& value)
+    {
+        ++count;
+        last = value.level;
+    }
+};
+
+
+/** Both thresholds apply, the relative one grows with the notified value.
+ */
+static void test_deadband()
+{
+    CHECK(!sequana::outside_deadband(109, 100, 10));
+    CHECK(sequana::outside_deadband(110, 100, 10));
+    CHECK(sequana::outside_deadband(90, 100, 10));
+    CHECK(!sequana::outside_deadband(91, 100, 10));
+
+    // 5 % of 1000 is 50, above the absolute threshold of 10.
+    CHECK(!sequana::outside_deadband(1049, 1000, 10, 50));
+    CHECK(sequana::outside_deadband(1050, 1000, 10, 50));
+    CHECK(sequana::outside_deadband(950, 1000, 10, 50));
+    // 5 % of 100 is 5, the absolute threshold rules.
+    CHECK(!sequana::outside_deadband(105, 100, 10, 50));
+    CHECK(sequana::outside_deadband(110, 100, 10, 50));
+    // Negative values use the magnitude.
+    CHECK(!sequana::outside_deadband(-1049, -1000, 10, 50));
+    CHECK(sequana::outside_deadband(-1050, -1000, 10, 50));
+    // Unsigned values changing downwards.
+    CHECK(sequana::outside_deadband<uint16_t>(900, 1000, 10, 50));
+}
+
+
+/** Small changes are suppressed and counted, a significant change and
+ * the maximum silence both send the value.
+ */
+static void test_suppression()
+{
+    EventQueue queue;
+    sim::queue = &queue;
+    TestSensor<FilteredValue> sensor;
+    Consumer<FilteredValue> consumer;
+
+    sensor.subscribe(callback(&consumer, &Consumer<FilteredValue>::receive));
+
+    // First value always goes out.
+    sensor.update(1000);
+    CHECK(consumer.count == 1);
+    CHECK(consumer.last == 1000);
+
+    // Within 5 %, compared to the notified value, not the previous one.
+    for (int32_t level = 1010; level < 1050; level += 10) {
+        queue.dispatch(10);
+        sensor.update(level);
+    }
+    CHECK(consumer.count == 1);
+    CHECK(sensor.get_suppressed_count() == 4);
+
+    sensor.update(1050);
+    CHECK(consumer.count == 2);
+    CHECK(consumer.last == 1050);
+
+    // Unchanged value is resent once the maximum silence has passed.
+    queue.dispatch(SILENCE_MS - 1);
+    sensor.update(1050);
+    CHECK(consumer.count == 2);
+    queue.dispatch(1);
+    sensor.update(1050);
+    CHECK(consumer.count == 3);
+    CHECK(sensor.get_value().level == 1050);
+
+    CHECK(sensor.get_sent_count() == 3);
+    CHECK(sensor.get_suppressed_count() == 5);
+}
+
+
+/** Without a filter specialization every update is sent.
+ */
+static void test_unfiltered()
+{
+    EventQueue queue;
+    sim::queue = &queue;
+    TestSensor<PlainValue> sensor;
+    Consumer<PlainValue> consumer;
+
+    sensor.subscribe(callback(&consumer, &Consumer<PlainValue>::receive));
+    for (int i = 0; i < 5; ++i) {
+        sensor.update(7);
+    }
+    CHECK(consumer.count == 5);
+    CHECK(sensor.get_sent_count() == 5);
+    CHECK(sensor.get_suppressed_count() == 0);
+}
+
+
+/** Characteristic updater takes one subscriber slot however often it's
+ * registered, also after being cleared with an empty callback.
+ */
+static void test_updater()
+{
+    EventQueue queue;
+    sim::queue = &queue;
+    TestSensor<PlainValue> sensor;
+    Consumer<PlainValue> first;
+    Consumer<PlainValue> second;
+    int updates = 0;
+    struct Counter {
+        int *count;
+        void update() { ++*count; }
+    } counter = { &updates };
+
+    sensor.register_updater(callback(&counter, &Counter::update));
+    sensor.register_updater(Callback<void()>());
+    sensor.update(1);
+    CHECK(updates == 0);
+
+    sensor.register_updater(callback(&counter, &Counter::update));
+    sensor.update(2);
+    CHECK(updates == 1);
+
+    // Updater and two more consumers fit, a fourth does not.
+    CHECK(sensor.subscribe(callback(&first, &Consumer<PlainValue>::receive)) == 0);
+    CHECK(sensor.subscribe(callback(&second, &Consumer<PlainValue>::receive)) == 0);
+    CHECK(sensor.subscribe(callback(&second, &Consumer<PlainValue>::receive)) == -1);
+    sensor.update(3);
+    CHECK(updates == 2);
+    CHECK((first.count == 1) && (second.count == 1));
+}
+
+
+int main()
+{
+    test_deadband();
+    test_suppression();
+    test_unfiltered();
+    test_updater();
+    return test_result();
+}
@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <vector>
+#include "HostTest.h"
+#include "Shdlc.h"
+
+#define ROUND_TRIP_FRAMES   20000
+#define FUZZ_RUNS           2000
+#define FUZZ_STREAM_SIZE    2000
+#define FUZZ_CORRUPTIONS    20
+
+typedef std::vector<uint8_t> Bytes;
+
+/** Byte-at-a-time parser replaced by ShdlcDecoder, the shdlc_state_machine()
+ * of the former Sps30Driver reduced to frame counting. Kept as the reference
+ * for the benchmark.
+ */
+class ReferenceParser {
+public:
+    ReferenceParser() : _state(SEARCH), _length(0), _frames(0) {}
+
+    void feed(uint8_t data)
+    {
+        switch (_state) {
+            case ERROR:
+            case READY:
+            case SEARCH:
+                if (data == Shdlc::START_SYMBOL) {
+                    _length = 0;
+                    _state = GET;
+                }
+                break;
+
+            case STUFF:
+                if (data == 0x5E) {
+                    data = 0x7E;
+                } else if (data == 0x5D) {
+                    data = 0x7D;
+                } else if (data == 0x31) {
+                    data = 0x11;
+                } else if (data == 0x33) {
+                    data = 0x13;
+                } else {
+                    error_recovery();
+                    break;
+                }
+                if (_length < FRAME_MAX_SIZE) {
+                    _raw[_length++] = data;
+                } else {
+                    error_recovery();
+                    break;
+                }
+                _state = GET;
+                break;
+
+            case GET:
+                if (data == Shdlc::STUFF_SYMBOL) {
+                    _state = STUFF;
+                } else if (data == Shdlc::START_SYMBOL) {
+                    if (_length == 0) {
+                        break;
+                    }
+                    if (_length < FRAME_MAX_SIZE) {
+                        _raw[_length] = data;
+                        if (frame_is_valid()) {
+                            _state = READY;
+                            ++_frames;
+                        }
+                    } else {
+                        error_recovery();
+                    }
+                } else {
+                    if (_length < FRAME_MAX_SIZE) {
+                        _raw[_length++] = data;
+                    } else {
+                        error_recovery();
+                    }
+                }
+                break;
+        }
+    }
+
+    uint32_t get_frames() const { return _frames; }
+
+private:
+    static const uint32_t FRAME_MAX_SIZE = Shdlc::HDR_LENGTH + Shdlc::DATA_MAX_LEN + 2;
+
+    enum State { ERROR, READY, SEARCH, STUFF, GET };
+
+    bool frame_is_valid()
+    {
+        uint32_t sum = 0;
+
+        if ((_length < Shdlc::HDR_LENGTH + 1) || (_length != _raw[3] + Shdlc::HDR_LENGTH + 1)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < _length - 1; ++i) {
+            sum += _raw[i];
+        }
+        return _raw[_length - 1] == (uint8_t)~sum;
+    }
+
+    void error_recovery()
+    {
+        _state = ERROR;
+        _length = 0;
+    }
+
+    State       _state;
+    uint32_t    _length;
+    uint32_t    _frames;
+    uint8_t     _raw[FRAME_MAX_SIZE];
+};
+
+static bool needs_stuffing(uint8_t b)
+{
+    return (b == 0x7E) || (b == 0x7D) || (b == 0x11) || (b == 0x13);
+}
+
+/** Build unstuffed MISO frame: address, command, state, length, data, checksum.
+ */
+static Bytes miso_frame(uint8_t cmd, uint8_t state, const uint8_t *data, uint32_t len)
+{
+    Bytes raw;
+    uint32_t sum = 0;
+
+    raw.push_back(0);
+    raw.push_back(cmd);
+    raw.push_back(state);
+    raw.push_back((uint8_t)len);
+    raw.insert(raw.end(), data, data + len);
+    for (size_t i = 0; i < raw.size(); ++i) {
+        sum += raw[i];
+    }
+    raw.push_back((uint8_t)~sum);
+    return raw;
+}
+
+static void append_stuffed(Bytes &stream, const Bytes &raw)
+{
+    stream.push_back((uint8_t)Shdlc::START_SYMBOL);
+    for (size_t i = 0; i < raw.size(); ++i) {
+        if (needs_stuffing(raw[i])) {
+            stream.push_back((uint8_t)Shdlc::STUFF_SYMBOL);
+            stream.push_back(raw[i] ^ Shdlc::STUFF_MASK);
+        } else {
+            stream.push_back(raw[i]);
+        }
+    }
+    stream.push_back((uint8_t)Shdlc::START_SYMBOL);
+}
+
+/** Feed stream in chunks, collect decoded frames.
+ */
+static std::vector<Bytes> decode_all(ShdlcDecoder &decoder, const Bytes &stream, uint32_t &seed, size_t max_chunk)
+{
+    std::vector<Bytes> frames;
+    size_t offset = 0;
+
+    while (offset < stream.size()) {
+        size_t chunk = 1 + test_random(seed) % max_chunk;
+        if (chunk > stream.size() - offset) {
+            chunk = stream.size() - offset;
+        }
+        size_t done = 0;
+        while (done < chunk) {
+            done += decoder.decode(&stream[offset + done], chunk - done);
+            if (decoder.frame_ready()) {
+                const ShdlcFrame &f = decoder.get_frame();
+                const uint8_t *p = (const uint8_t *)&f;
+                frames.push_back(Bytes(p, p + Shdlc::HDR_LENGTH + f.len + 1));
+            }
+        }
+        offset += chunk;
+    }
+    return frames;
+}
+
+/** Encoder output matches SPS30 datasheet frames.
+ */
+static void test_encoder_vectors()
+{
+    static const uint8_t start[] = {0x7E, 0x00, 0x00, 0x02, 0x01, 0x03, 0xF9, 0x7E};
+    static const uint8_t read[] = {0x7E, 0x00, 0x03, 0x00, 0xFC, 0x7E};
+    static const uint8_t reset[] = {0x7E, 0x00, 0xD3, 0x00, 0x2C, 0x7E};
+    static const uint8_t start_data[] = {0x01, 0x03};
+    uint8_t out[ShdlcEncoder::FRAME_MAX_SIZE];
+    size_t n;
+
+    n = ShdlcEncoder::encode(0, 0x00, start_data, 2, out, sizeof(out));
+    CHECK((n == sizeof(start)) && (memcmp(out, start, n) == 0));
+    n = ShdlcEncoder::encode(0, 0x03, NULL, 0, out, sizeof(out));
+    CHECK((n == sizeof(read)) && (memcmp(out, read, n) == 0));
+    n = ShdlcEncoder::encode(0, 0xD3, NULL, 0, out, sizeof(out));
+    CHECK((n == sizeof(reset)) && (memcmp(out, reset, n) == 0));
+    CHECK(ShdlcEncoder::encode(0, 0, start_data, 2, out, 10) == 0);
+}
+
+/** Every data length decodes, including the maximum 255 bytes with
+ * every byte stuffed, the delimiter arrives with the buffer full.
+ */
+static void test_all_lengths()
+{
+    uint8_t data[Shdlc::DATA_MAX_LEN];
+    uint32_t seed = 7;
+
+    for (uint32_t len = 0; len <= Shdlc::DATA_MAX_LEN; ++len) {
+        for (int stuffed = 0; stuffed < 2; ++stuffed) {
+            for (uint32_t i = 0; i < len; ++i) {
+                data[i] = stuffed ? 0x7E : (uint8_t)test_random(seed);
+            }
+            Bytes raw = miso_frame(0x03, 0, data, len);
+            Bytes stream;
+            append_stuffed(stream, raw);
+
+            ShdlcDecoder decoder;
+            std::vector<Bytes> frames = decode_all(decoder, stream, seed, stream.size());
+            CHECK((frames.size() == 1) && (frames[0] == raw));
+            CHECK(decoder.get_errors() == 0);
+        }
+    }
+}
+
+/** One data byte more than the maximum frame is rejected, the decoder
+ * recovers with the next frame.
+ */
+static void test_too_long()
+{
+    uint8_t data[Shdlc::DATA_MAX_LEN] = {0};
+    Bytes raw = miso_frame(0x03, 0, data, Shdlc::DATA_MAX_LEN);
+    Bytes stream;
+    uint32_t seed = 3;
+
+    raw.insert(raw.end() - 1, 0x55);
+    append_stuffed(stream, raw);
+    Bytes good = miso_frame(0x03, 0, data, 4);
+    append_stuffed(stream, good);
+
+    ShdlcDecoder decoder;
+    std::vector<Bytes> frames = decode_all(decoder, stream, seed, 16);
+    CHECK((frames.size() == 1) && (frames[0] == good));
+    CHECK(decoder.get_errors() >= 1);
+}
+
+/** Random frames fed in random chunks all decode unchanged.
+ * Corrupted streams never crash the decoder and intact frames
+ * following corruption are recovered.
+ */
+static void test_round_trip_and_fuzz()
+{
+    std::vector<Bytes> sent;
+    Bytes stream;
+    uint32_t seed = 1;
+    static const uint8_t special[] = {0x7E, 0x7D, 0x11, 0x13};
+
+    for (int f = 0; f < ROUND_TRIP_FRAMES; ++f) {
+        uint8_t data[Shdlc::DATA_MAX_LEN];
+        uint32_t len = test_random(seed) % 48;
+        for (uint32_t i = 0; i < len; ++i) {
+            data[i] = (test_random(seed) % 4 == 0) ? special[test_random(seed) % 4] : (uint8_t)test_random(seed);
+        }
+        sent.push_back(miso_frame(0x03, test_random(seed) % 4, data, len));
+        append_stuffed(stream, sent.back());
+    }
+
+    ShdlcDecoder decoder;
+    std::vector<Bytes> frames = decode_all(decoder, stream, seed, 64);
+    CHECK(frames == sent);
+    CHECK(decoder.get_errors() == 0);
+
+    uint32_t lost = 0;
+    for (int run = 0; run < FUZZ_RUNS; ++run) {
+        size_t base = test_random(seed) % (stream.size() - 2 * FUZZ_STREAM_SIZE);
+        Bytes fuzzed(stream.begin() + base, stream.begin() + base + FUZZ_STREAM_SIZE);
+        for (int k = 0; k < FUZZ_CORRUPTIONS; ++k) {
+            fuzzed[test_random(seed) % FUZZ_STREAM_SIZE] = (uint8_t)test_random(seed);
+        }
+        // Intact tail: a known frame must be found after any corruption. Delimiter
+        // following a corrupted escape is lost, so that one frame may go with it.
+        append_stuffed(fuzzed, sent[0]);
+        append_stuffed(fuzzed, sent[0]);
+
+        ShdlcDecoder fuzz_decoder;
+        std::vector<Bytes> found = decode_all(fuzz_decoder, fuzzed, seed, 64);
+        if (found.empty() || (found.back() != sent[0])) {
+            ++lost;
+        }
+    }
+    CHECK(lost == 0);
+}
+
+static void bench_decode()
+{
+    Bytes stream;
+    uint8_t data[40];
+    uint32_t seed = 5;
+    const int repeat = 200;
+
+    for (int f = 0; f < 1000; ++f) {
+        for (uint32_t i = 0; i < sizeof(data); ++i) {
+            data[i] = (uint8_t)test_random(seed);
+        }
+        append_stuffed(stream, miso_frame(0x03, 0, data, sizeof(data)));
+    }
+
+    ShdlcDecoder decoder;
+    uint32_t frames = 0;
+    uint64_t cycles = test_cycles();
+    double start = test_time_ns();
+    for (int r = 0; r < repeat; ++r) {
+        size_t p = 0;
+        while (p < stream.size()) {
+            p += decoder.decode(&stream[p], stream.size() - p);
+            frames += decoder.frame_ready();
+        }
+    }
+    double ns = test_time_ns() - start;
+    cycles = test_cycles() - cycles;
+    CHECK(frames == 1000 * repeat);
+
+    ReferenceParser reference;
+    uint64_t reference_cycles = test_cycles();
+    double reference_start = test_time_ns();
+    for (int r = 0; r < repeat; ++r) {
+        for (size_t p = 0; p < stream.size(); ++p) {
+            reference.feed(stream[p]);
+        }
+    }
+    double reference_ns = test_time_ns() - reference_start;
+    reference_cycles = test_cycles() - reference_cycles;
+    CHECK(reference.get_frames() == frames);
+
+    double bytes = (double)repeat * stream.size();
+    printf("bench: 40 byte frames (host), decoder %.2f ns per byte, byte-at-a-time %.2f ns per byte\n",
+           ns / bytes, reference_ns / bytes);
+    if (cycles && reference_cycles) {
+        printf("bench: decoder %.3f bytes per cycle, byte-at-a-time %.3f bytes per cycle\n",
+               bytes / cycles, bytes / reference_cycles);
+    }
+}
+
+int main()
+{
+    test_encoder_vectors();
+    test_all_lengths();
+    test_too_long();
+    test_round_trip_and_fuzz();
+    bench_decode();
+    return test_result();
+}
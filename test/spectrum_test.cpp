@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2019 Future Electronics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include "HostTest.h"
+#include "SpectrumAnalyzer.h"
+
+// KX64 sampling rate used by the spectrum mode.
+#define SAMPLE_RATE_HZ      1600
+#define FREQUENCY_TOL_HZ    1.0
+#define AMPLITUDE_TOL       0.15
+#define BENCH_BLOCKS        2000
+
+static void fill_block(SpectrumAnalyzer &analyzer, double f1, double a1, double f2, double a2)
+{
+    for (int i = 0; i < SPECTRUM_FFT_SIZE; ++i) {
+        double t = (double)i / SAMPLE_RATE_HZ;
+        double v = 2000 + a1 * sin(2 * M_PI * f1 * t) + a2 * sin(2 * M_PI * f2 * t);
+        analyzer.add_sample((int16_t)lround(v));
+    }
+}
+
+/** Two tones below Nyquist frequency are the two largest peaks,
+ * with their frequencies and amplitude ratio.
+ */
+static void test_two_tones()
+{
+    static const double tones[][2] = {
+        {12.3, 40.9}, {50.0, 105.0}, {101.7, 192.9}, {333.3, 586.6}, {700.0, 150.0}
+    };
+
+    for (unsigned i = 0; i < sizeof(tones) / sizeof(tones[0]); ++i) {
+        SpectrumAnalyzer analyzer;
+        analyzer.set_sample_rate(SAMPLE_RATE_HZ * 1000);
+        fill_block(analyzer, tones[i][0], 1000, tones[i][1], 300);
+
+        const SpectrumPeaks &peaks = analyzer.get_peaks();
+        double f1 = peaks.peak[0].frequency / 10.0;
+        double f2 = peaks.peak[1].frequency / 10.0;
+        double ratio = (double)peaks.peak[1].amplitude / peaks.peak[0].amplitude;
+        printf("tones %.1f/%.1f Hz: peaks %.1f/%.1f Hz, amplitude ratio %.2f\n",
+               tones[i][0], tones[i][1], f1, f2, ratio);
+        CHECK(fabs(f1 - tones[i][0]) <= FREQUENCY_TOL_HZ);
+        CHECK(fabs(f2 - tones[i][1]) <= FREQUENCY_TOL_HZ);
+        CHECK(fabs(ratio - 0.3) <= 0.3 * AMPLITUDE_TOL);
+    }
+}
+
+/** Constant input has no spectral peaks, DC is removed.
+ */
+static void test_dc_only()
+{
+    SpectrumAnalyzer analyzer;
+    analyzer.set_sample_rate(SAMPLE_RATE_HZ * 1000);
+    fill_block(analyzer, 0, 0, 0, 0);
+    CHECK(analyzer.get_peaks().peak[0].amplitude == 0);
+}
+
+static void bench_block()
+{
+    SpectrumAnalyzer analyzer;
+    uint32_t seed = 1;
+    analyzer.set_sample_rate(SAMPLE_RATE_HZ * 1000);
+
+    double start = test_time_ns();
+    for (int b = 0; b < BENCH_BLOCKS; ++b) {
+        for (int i = 0; i < SPECTRUM_FFT_SIZE; ++i) {
+            analyzer.add_sample((int16_t)(test_random(seed) & 0x0fff));
+        }
+    }
+    printf("bench: %.2f us per %d sample block (host)\n",
+           (test_time_ns() - start) / BENCH_BLOCKS / 1000.0, SPECTRUM_FFT_SIZE);
+}
+
+int main()
+{
+    test_two_tones();
+    test_dc_only();
+    bench_block();
+    return test_result();
+}